@@ -111,6 +111,14 @@ def proxy_wasm_cpp_host_repositories():
         urls = ["https://github.com/google/googletest/archive/release-1.10.0.tar.gz"],
     )
 
+    maybe(
+        http_archive,
+        name = "com_github_google_benchmark",
+        sha256 = "23082937d1663a53b90cb5b61df4bcc312f6dee7018da78ba00dd6bd669dfef2",
+        strip_prefix = "benchmark-1.5.1",
+        urls = ["https://github.com/google/benchmark/archive/v1.5.1.tar.gz"],
+    )
+
     # NullVM dependencies.
 
     maybe(
@@ -206,23 +214,14 @@ def proxy_wasm_cpp_host_repositories():
         url = "https://github.com/bytecodealliance/wasmtime/archive/v9.0.3.tar.gz",
     )
 
-    maybe(
-        http_archive,
-        name = "com_github_webassembly_wasm_c_api",
-        build_file = "@proxy_wasm_cpp_host//bazel/external:wasm-c-api.BUILD",
-        sha256 = "c774044f51431429e878bd1b9e2a4e38932f861f9211df72f75e9427eb6b8d32",
-        strip_prefix = "wasm-c-api-c9d31284651b975f05ac27cee0bab1377560b87e",
-        url = "https://github.com/WebAssembly/wasm-c-api/archive/c9d31284651b975f05ac27cee0bab1377560b87e.tar.gz",
-    )
-
     native.bind(
         name = "wasmtime",
-        actual = "@com_github_webassembly_wasm_c_api//:wasmtime_lib",
+        actual = "@com_github_bytecodealliance_wasmtime//:wasmtime_lib",
     )
 
     native.bind(
         name = "prefixed_wasmtime",
-        actual = "@com_github_webassembly_wasm_c_api//:prefixed_wasmtime_lib",
+        actual = "@com_github_bytecodealliance_wasmtime//:prefixed_wasmtime_lib",
     )
 
     # WAVM with dependencies.
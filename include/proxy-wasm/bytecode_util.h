@@ -13,6 +13,7 @@
 // limitations under the License.
 #pragma once
 
+#include <cstdint>
 #include <string_view>
 #include <vector>
 #include <unordered_map>
@@ -21,6 +22,35 @@
 
 namespace proxy_wasm {
 
+// Index of the sections, imports and exports of a Wasm module, built by BytecodeUtil in a single
+// pass over the bytecode, so that queries don't have to parse it again. All views point into the
+// indexed bytecode, which must outlive the index.
+struct ModuleIndex {
+  struct Section {
+    uint8_t id;
+    std::string_view name;     // Name of a custom section, empty for other sections.
+    std::string_view contents; // Contents, without the id, size and name of the section.
+    std::string_view raw;      // Entire section, including its header.
+  };
+
+  struct Import {
+    std::string_view module;
+    std::string_view name;
+    uint8_t kind; // 0: function, 1: table, 2: memory, 3: global, 4: tag.
+  };
+
+  struct Export {
+    std::string_view name;
+    uint8_t kind; // 0: function, 1: table, 2: memory, 3: global, 4: tag.
+    uint32_t index;
+  };
+
+  std::string_view bytecode;
+  std::vector<Section> sections; // In the order they appear in the module.
+  std::vector<Import> imports;
+  std::vector<Export> exports;
+};
+
 // Utilitiy functions which directly operate on Wasm bytecodes.
 class BytecodeUtil {
 public:
@@ -31,6 +61,24 @@ public:
    */
   static bool checkWasmHeader(std::string_view bytecode);
 
+  /**
+   * getModuleIndex parses the section list, imports and exports of the bytecode.
+   * @param bytecode is the target bytecode.
+   * @param ret is the reference to store the index.
+   * @return indicates whether parsing succeeded or not.
+   */
+  static bool getModuleIndex(std::string_view bytecode, ModuleIndex &ret);
+
+  /**
+   * parseSection parses the section at the start of the bytecode (after the Wasm header), which
+   * may not have been received completely yet, and adds it to the index.
+   * @param bytecode starts with the section, and may end before or after it.
+   * @param index is the reference to the index to add the section to.
+   * @param size is the reference to store the size of the section, or 0 if it's incomplete.
+   * @return indicates whether parsing succeeded or not.
+   */
+  static bool parseSection(std::string_view bytecode, ModuleIndex &index, size_t &size);
+
   /**
    * getAbiVersion extracts ABI version from the bytecode.
    * @param bytecode is the target bytecode.
@@ -38,6 +86,7 @@ public:
    * @return indicates whether parsing succeeded or not.
    */
   static bool getAbiVersion(std::string_view bytecode, proxy_wasm::AbiVersion &ret);
+  static bool getAbiVersion(const ModuleIndex &index, proxy_wasm::AbiVersion &ret);
 
   /**
    * getCustomSection extract the view of the custom section for a given name.
@@ -48,6 +97,8 @@ public:
    */
   static bool getCustomSection(std::string_view bytecode, std::string_view name,
                                std::string_view &ret);
+  static bool getCustomSection(const ModuleIndex &index, std::string_view name,
+                               std::string_view &ret);
 
   /**
    * getFunctionNameIndex constructs the map from function indexes to function names stored in
@@ -59,6 +110,17 @@ public:
    */
   static bool getFunctionNameIndex(std::string_view bytecode,
                                    std::unordered_map<uint32_t, std::string> &ret);
+  static bool getFunctionNameIndex(const ModuleIndex &index,
+                                   std::unordered_map<uint32_t, std::string> &ret);
+
+  /**
+   * getMutableGlobals lists the mutable globals defined (not imported) by the module.
+   * @param index is the index of the target bytecode.
+   * @param ret is the reference to store the names of the mutable globals, from the global name
+   * subsection in "name" custom section or from the exports, or empty for unnamed globals.
+   * @return indicates whether parsing succeeded or not.
+   */
+  static bool getMutableGlobals(const ModuleIndex &index, std::vector<std::string_view> &ret);
 
   /**
    * getStrippedSource gets Wasm module without Custom Sections to save some memory in workers.
@@ -67,8 +129,44 @@ public:
    * @return indicates whether parsing succeeded or not.
    */
   static bool getStrippedSource(std::string_view bytecode, std::string &ret);
+  static bool getStrippedSource(const ModuleIndex &index, std::string &ret);
+
+  /**
+   * getStrippedSource gets Wasm module without "precompiled_" Custom Sections, without copying it
+   * if there is nothing to strip.
+   * @param bytecode is the original bytecode.
+   * @param ret is the reference to the stripped bytecode, or to the original bytecode.
+   * @return indicates whether parsing succeeded or not.
+   */
+  static bool getStrippedSource(const WasmBytecodePtr &bytecode, WasmBytecodePtr &ret);
+  static bool getStrippedSource(const WasmBytecodePtr &bytecode, const ModuleIndex &index,
+                                WasmBytecodePtr &ret);
+
+  /**
+   * makeBytecode takes ownership of the bytecode, so that it can be shared without copying.
+   * @param bytecode is the bytecode.
+   * @return the shared bytecode.
+   */
+  static WasmBytecodePtr makeBytecode(std::string bytecode);
+
+  /**
+   * mapBytecodeFile maps a Wasm module read-only into memory, instead of reading it.
+   * @param path is the path of the Wasm module.
+   * @return the shared bytecode, or nullptr if the file can't be read.
+   */
+  static WasmBytecodePtr mapBytecodeFile(const std::string &path);
 
 private:
+  static void stripPrecompiledSections(const ModuleIndex &index, std::string &ret);
+  static bool parseImports(std::string_view section, std::vector<ModuleIndex::Import> &ret);
+  static bool parseExports(std::string_view section, std::vector<ModuleIndex::Export> &ret);
+  static bool parseName(const char *&pos, const char *end, std::string_view &ret);
+  static bool parseNameMap(std::string_view name_section, uint8_t subsection_id,
+                           std::unordered_map<uint32_t, std::string_view> &ret);
+  static bool skipConstExpr(const char *&pos, const char *end);
+  static bool skipLimits(const char *&pos, const char *end);
+  static bool skipValType(const char *&pos, const char *end);
+  static bool skipVarint(const char *&pos, const char *end);
   static bool parseVarint(const char *&pos, const char *end, uint32_t &ret);
 };
 
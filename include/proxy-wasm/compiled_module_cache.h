@@ -0,0 +1,71 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace proxy_wasm {
+
+// A compiled module returned by CompiledModuleCache::get(). The data is valid for as long as the
+// pointer is alive.
+using CompiledModulePtr = std::shared_ptr<const std::string_view>;
+
+/**
+ * Cache of compiled modules (serialized by the Wasm engine), so that modules don't have to be
+ * recompiled from bytecode after a restart. Compiled modules contain native code, so the cache
+ * must only be writable by trusted parties.
+ */
+class CompiledModuleCache {
+public:
+  virtual ~CompiledModuleCache() = default;
+
+  /**
+   * Get a compiled module.
+   * @param key identifies the engine (and its version and flags) and the module.
+   * @return the compiled module, or nullptr if it isn't cached.
+   */
+  virtual CompiledModulePtr get(std::string_view key) = 0;
+
+  /**
+   * Store a compiled module, replacing any existing one.
+   * @param key identifies the engine (and its version and flags) and the module.
+   * @param compiled_module is the serialized compiled module.
+   */
+  virtual void put(std::string_view key, std::string_view compiled_module) = 0;
+};
+
+// Stores each compiled module in a file named after its key in 'directory', and maps the files
+// back into memory (or reads them, on Windows).
+class FileCompiledModuleCache : public CompiledModuleCache {
+public:
+  explicit FileCompiledModuleCache(std::string directory) : directory_(std::move(directory)) {}
+
+  CompiledModulePtr get(std::string_view key) override;
+  void put(std::string_view key, std::string_view compiled_module) override;
+
+private:
+  std::string path(std::string_view key) const;
+
+  const std::string directory_;
+};
+
+// Set the cache used by WasmBase::load() for engines which can serialize compiled modules, or
+// nullptr (the default) to disable caching.
+void setCompiledModuleCache(std::shared_ptr<CompiledModuleCache> cache);
+std::shared_ptr<CompiledModuleCache> getCompiledModuleCache();
+
+} // namespace proxy_wasm
@@ -195,6 +195,7 @@ public:
   bool onConfigure(std::shared_ptr<PluginBase> plugin) override;
   void onTick(TimerToken token) override;
   void onQueueReady(SharedQueueDequeueToken token) override;
+  void onSharedDataChanged(SharedDataSubscriptionToken token) override;
 
   // HTTP
   FilterHeadersStatus onRequestHeaders(uint32_t headers, bool end_of_stream) override;
@@ -339,10 +340,16 @@ public:
   // Shared Data
   WasmResult getSharedData(std::string_view key,
                            std::pair<std::string, uint32_t /* cas */> *data) override;
+  WasmResult getSharedDataValue(std::string_view key, SharedDataValuePtr *data) override;
+  WasmResult getSharedDataValues(const std::vector<std::string_view> &keys,
+                                 std::vector<SharedDataValuePtr> *values) override;
   WasmResult setSharedData(std::string_view key, std::string_view value, uint32_t cas) override;
   WasmResult getSharedDataKeys(std::vector<std::string> *result) override;
   WasmResult removeSharedDataKey(std::string_view key, uint32_t cas,
                                  std::pair<std::string, uint32_t> *result) override;
+  WasmResult subscribeSharedData(std::string_view key, bool prefix,
+                                 SharedDataSubscriptionToken *token_ptr) override;
+  WasmResult unsubscribeSharedData(SharedDataSubscriptionToken token) override;
 
   // Shared Queue
   WasmResult registerSharedQueue(std::string_view queue_name,
@@ -350,6 +357,8 @@ public:
   WasmResult lookupSharedQueue(std::string_view vm_id, std::string_view queue_name,
                                SharedQueueEnqueueToken *token_ptr) override;
   WasmResult dequeueSharedQueue(uint32_t token, std::string *data) override;
+  WasmResult dequeueSharedQueueItems(uint32_t token, size_t max_items, size_t max_bytes,
+                                     std::vector<std::string> *data) override;
   WasmResult enqueueSharedQueue(uint32_t token, std::string_view value) override;
 
   // Header/Trailer/Metadata Maps
@@ -38,6 +38,7 @@ using GrpcToken = uint32_t;
 using GrpcStatusCode = uint32_t;
 using SharedQueueDequeueToken = uint32_t;
 using SharedQueueEnqueueToken = uint32_t;
+using SharedDataSubscriptionToken = uint32_t;
 
 // TODO: update SDK and use this.
 enum class ProxyAction : uint32_t {
@@ -164,11 +165,18 @@ struct RootInterface : public RootGrpcInterface {
                                   uint32_t trailers) = 0;
 
   /**
-   * Called on a Root Context when an Inter-VM shared queue message has arrived.
+   * Called on a Root Context when an Inter-VM shared queue message has arrived. If the host
+   * coalesces notifications for the queue, the queue should be drained until it is empty.
    * @token is the token returned by registerSharedQueue().
    */
   virtual void onQueueReady(SharedQueueDequeueToken token) = 0;
 
+  /**
+   * Called on a Root Context when shared data it subscribed to has been set or removed.
+   * @token is the token returned by subscribeSharedData().
+   */
+  virtual void onSharedDataChanged(SharedDataSubscriptionToken /* token */) {}
+
   /**
    * Call when a stream has completed (both sides have closed) or on a Root Context when the VM is
    * shutting down.
@@ -595,6 +603,16 @@ struct GeneralInterface {
   virtual void onForeignFunction(uint32_t foreign_function_id, uint32_t data_size) = 0;
 };
 
+/**
+ * An immutable value stored in the data shared between VMs, along with its compare-and-swap value.
+ * Values are reference-counted, so that they can be read without copying them out of the store.
+ */
+struct SharedDataValue {
+  std::string data;
+  uint32_t cas;
+};
+using SharedDataValuePtr = std::shared_ptr<const SharedDataValue>;
+
 /**
  * SharedDataInterface is for sharing data between VMs. In general the VMs may be on different
  * threads.  Keys can have any format, but good practice would use reverse DNS and namespacing
@@ -613,6 +631,42 @@ struct SharedDataInterface {
   getSharedData(std::string_view key,
                 std::pair<std::string /* value */, uint32_t /* cas */> *data) = 0;
 
+  /**
+   * Get proxy-wide key-value data shared between VMs without copying the value.
+   * @param key is a proxy-wide key mapping to the shared data value.
+   * @param data is a location to store a reference to the immutable value and its 'cas'.
+   */
+  virtual WasmResult getSharedDataValue(std::string_view key, SharedDataValuePtr *data) {
+    std::pair<std::string, uint32_t> value;
+    auto result = getSharedData(key, &value);
+    if (result == WasmResult::Ok) {
+      *data = std::make_shared<const SharedDataValue>(
+          SharedDataValue{std::move(value.first), value.second});
+    }
+    return result;
+  }
+
+  /**
+   * Get several keys of the data shared between VMs at once, without copying the values.
+   * @param keys are proxy-wide keys mapping to the shared data values.
+   * @param values is a location to store references to the values (and their 'cas'), in the
+   * order of 'keys'. Keys which are not found are stored as nullptr.
+   */
+  virtual WasmResult getSharedDataValues(const std::vector<std::string_view> &keys,
+                                         std::vector<SharedDataValuePtr> *values) {
+    values->clear();
+    values->reserve(keys.size());
+    for (auto key : keys) {
+      SharedDataValuePtr value;
+      auto result = getSharedDataValue(key, &value);
+      if (result != WasmResult::Ok && result != WasmResult::NotFound) {
+        return result;
+      }
+      values->push_back(std::move(value));
+    }
+    return WasmResult::Ok;
+  }
+
   /**
    * Set a key-value data shared between VMs.
    * @param key is a proxy-wide key mapping to the shared data value.
@@ -622,6 +676,22 @@ struct SharedDataInterface {
    */
   virtual WasmResult setSharedData(std::string_view key, std::string_view value, uint32_t cas) = 0;
 
+  /**
+   * Set several key-value data shared between VMs at once, ignoring their 'cas'. Pairs are set
+   * one at a time, not atomically: if setting a pair fails (e.g. because it would exceed the
+   * limits of the vm_id), the pairs before it remain set and the following ones aren't set.
+   * @param pairs are proxy-wide keys and the values to store. Stops at the first failure.
+   */
+  virtual WasmResult setSharedDataPairs(const Pairs &pairs) {
+    for (const auto &[key, value] : pairs) {
+      auto result = setSharedData(key, value, 0);
+      if (result != WasmResult::Ok) {
+        return result;
+      }
+    }
+    return WasmResult::Ok;
+  }
+
   /**
    * Return all the keys from the data shraed between VMs
    * @param data is a location to store the returned value.
@@ -638,6 +708,26 @@ struct SharedDataInterface {
   virtual WasmResult
   removeSharedDataKey(std::string_view key, uint32_t cas,
                       std::pair<std::string /* value */, uint32_t /* cas */> *result) = 0;
+
+  /**
+   * Subscribe the Root Context to changes of the data shared between VMs, so that it doesn't
+   * have to poll for them. onSharedDataChanged() is called when a matching key is set or removed.
+   * @param key is a proxy-wide key (or a key prefix) to watch.
+   * @param prefix whether all keys starting with 'key' should be watched.
+   * @param token_ptr a location to store a token corresponding to the subscription.
+   */
+  virtual WasmResult subscribeSharedData(std::string_view /* key */, bool /* prefix */,
+                                         SharedDataSubscriptionToken * /* token_ptr */) {
+    return WasmResult::Unimplemented;
+  }
+
+  /**
+   * Cancel a subscription to changes of the data shared between VMs.
+   * @param token is a token returned by subscribeSharedData() on the same Root Context.
+   */
+  virtual WasmResult unsubscribeSharedData(SharedDataSubscriptionToken /* token */) {
+    return WasmResult::Unimplemented;
+  }
 }; // namespace proxy_wasm
 
 struct SharedQueueInterface {
@@ -668,6 +758,29 @@ struct SharedQueueInterface {
    */
   virtual WasmResult dequeueSharedQueue(SharedQueueDequeueToken token, std::string *data_ptr) = 0;
 
+  /**
+   * Dequeue several messages from a shared queue at once.
+   * @param token is a token returned by registerSharedQueue();
+   * @param max_items is the maximum number of messages to dequeue.
+   * @param max_bytes stops dequeuing once the total size of the messages reaches it.
+   * @param data_ptr is a location to store the data dequeued.
+   */
+  virtual WasmResult dequeueSharedQueueItems(SharedQueueDequeueToken token, size_t max_items,
+                                             size_t max_bytes, std::vector<std::string> *data_ptr) {
+    data_ptr->clear();
+    size_t bytes = 0;
+    while (data_ptr->size() < max_items && bytes < max_bytes) {
+      std::string data;
+      auto result = dequeueSharedQueue(token, &data);
+      if (result != WasmResult::Ok) {
+        return data_ptr->empty() ? result : WasmResult::Ok;
+      }
+      bytes += data.size();
+      data_ptr->push_back(std::move(data));
+    }
+    return WasmResult::Ok;
+  }
+
   /**
    * Enqueue a message on a shared queue.
    * @param token is a token returned by resolveSharedQueue();
@@ -82,10 +82,16 @@ Word clear_route_cache();
 Word get_shared_data(Word key_ptr, Word key_size, Word value_ptr_ptr, Word value_size_ptr,
                      Word cas_ptr);
 Word set_shared_data(Word key_ptr, Word key_size, Word value_ptr, Word value_size, Word cas);
+Word get_shared_data_pairs(Word keys_ptr, Word keys_size, Word ptr_ptr, Word size_ptr);
+Word set_shared_data_pairs(Word ptr, Word size);
+Word subscribe_shared_data(Word key_ptr, Word key_size, Word prefix, Word token_ptr);
+Word unsubscribe_shared_data(Word token);
 Word register_shared_queue(Word queue_name_ptr, Word queue_name_size, Word token_ptr);
 Word resolve_shared_queue(Word vm_id_ptr, Word vm_id_size, Word queue_name_ptr,
                           Word queue_name_size, Word token_ptr);
 Word dequeue_shared_queue(Word token, Word data_ptr_ptr, Word data_size_ptr);
+Word dequeue_shared_queue_items(Word token, Word max_items, Word max_bytes, Word ptr_ptr,
+                                Word size_ptr);
 Word enqueue_shared_queue(Word token, Word data_ptr, Word data_size);
 Word get_buffer_bytes(Word type, Word start, Word length, Word ptr_ptr, Word size_ptr);
 Word get_buffer_status(Word type, Word length_ptr, Word flags_ptr);
@@ -153,8 +159,10 @@ void emscripten_notify_memory_growth(Word);
 
 #define FOR_ALL_HOST_FUNCTIONS(_f)                                                                 \
   _f(log) _f(get_status) _f(set_property) _f(get_property) _f(send_local_response)                 \
-      _f(get_shared_data) _f(set_shared_data) _f(register_shared_queue) _f(resolve_shared_queue)   \
-          _f(dequeue_shared_queue) _f(enqueue_shared_queue) _f(get_header_map_value)               \
+      _f(get_shared_data) _f(set_shared_data) _f(get_shared_data_pairs) _f(set_shared_data_pairs)  \
+          _f(subscribe_shared_data) _f(unsubscribe_shared_data) _f(register_shared_queue)          \
+          _f(resolve_shared_queue) _f(dequeue_shared_queue) _f(dequeue_shared_queue_items)         \
+          _f(enqueue_shared_queue) _f(get_header_map_value)                                        \
               _f(add_header_map_value) _f(replace_header_map_value) _f(remove_header_map_value)    \
                   _f(get_header_map_pairs) _f(set_header_map_pairs) _f(get_header_map_size)        \
                       _f(get_buffer_status) _f(get_buffer_bytes) _f(set_buffer_bytes)              \
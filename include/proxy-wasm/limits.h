@@ -40,3 +40,27 @@
 #ifndef PROXY_WASM_HOST_PAIRS_MAX_COUNT
 #define PROXY_WASM_HOST_PAIRS_MAX_COUNT 1024
 #endif
+
+// Default maximum size of the shared data (keys and values) stored by a single vm_id.
+// This can be adjusted per vm_id at runtime.
+#ifndef PROXY_WASM_HOST_SHARED_DATA_MAX_BYTES_PER_VM_ID
+#define PROXY_WASM_HOST_SHARED_DATA_MAX_BYTES_PER_VM_ID (1024 * 1024 * 1024)
+#endif
+
+// Default maximum number of items in a shared queue, or 0 (the default) for unbounded queues. Once
+// a bounded queue is full, enqueues fail by default. The limit and the overflow policy can be
+// adjusted per vm_id or per queue at runtime.
+#ifndef PROXY_WASM_HOST_SHARED_QUEUE_MAX_ITEMS
+#define PROXY_WASM_HOST_SHARED_QUEUE_MAX_ITEMS 0
+#endif
+
+// Maximum number of threads used to create base Wasm instances in parallel by createWasmAsync().
+#ifndef PROXY_WASM_HOST_MAX_CREATE_WASM_THREADS
+#define PROXY_WASM_HOST_MAX_CREATE_WASM_THREADS 4
+#endif
+
+// Interval at which the execution watchdog checks the deadlines of calls into Wasm VMs with an
+// execution timeout. It bounds how late a call exceeding its timeout is interrupted.
+#ifndef PROXY_WASM_HOST_EXECUTION_WATCHDOG_INTERVAL_MS
+#define PROXY_WASM_HOST_EXECUTION_WATCHDOG_INTERVAL_MS 10
+#endif
@@ -16,6 +16,8 @@
 #pragma once
 
 #include <memory>
+#include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -49,6 +51,7 @@ struct NullVm : public WasmVm {
 #define _FORWARD_GET_FUNCTION(_T)                                                                  \
   void getFunction(std::string_view function_name, _T *f) override {                               \
     plugin_->getFunction(function_name, f);                                                        \
+    armExecutionDeadline(function_name, f);                                                        \
   }
   FOR_ALL_WASM_VM_EXPORTS(_FORWARD_GET_FUNCTION)
 #undef _FORWARD_GET_FUNCTION
@@ -65,6 +68,36 @@ struct NullVm : public WasmVm {
 
   std::string plugin_name_;
   std::unique_ptr<NullVmPlugin> plugin_;
+
+private:
+  // Arms the execution timeout around calls into the plugin. Native code can't be interrupted, so
+  // a call exceeding the timeout only fails the VM once it returns.
+  template <typename R, typename... Args>
+  void armExecutionDeadline(std::string_view function_name,
+                            std::function<R(ContextBase *, Args...)> *f) {
+    if (*f == nullptr) {
+      return;
+    }
+    *f = [this, function_name = std::string(function_name),
+          call = std::move(*f)](ContextBase *context, Args... args) -> R {
+      ExecutionDeadline deadline(this);
+      if constexpr (std::is_void_v<R>) {
+        call(context, args...);
+        failIfExceeded(deadline, function_name);
+      } else {
+        auto result = call(context, args...);
+        failIfExceeded(deadline, function_name);
+        return result;
+      }
+    };
+  }
+
+  void failIfExceeded(ExecutionDeadline &deadline, const std::string &function_name) {
+    if (deadline.disarm()) {
+      fail(FailState::RuntimeError,
+           "Function: " + function_name + " failed: execution timeout exceeded");
+    }
+  }
 };
 
 } // namespace proxy_wasm
@@ -16,6 +16,8 @@
 
 #include <string_view>
 
+#include "include/proxy-wasm/bytecode_util.h"
+
 namespace proxy_wasm {
 
 // Utility functions to verify Wasm signatures.
@@ -28,6 +30,7 @@ public:
    * @return indicates whether the bytecode has a valid Wasm signature.
    */
   static bool verifySignature(std::string_view bytecode, std::string &message);
+  static bool verifySignature(const ModuleIndex &index, std::string &message);
 };
 
 } // namespace proxy_wasm
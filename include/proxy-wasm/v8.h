@@ -21,6 +21,23 @@
 
 namespace proxy_wasm {
 
+// How V8 compiles Wasm modules.
+enum class V8CompilationMode {
+  // Compile all functions with TurboFan before the module is instantiated. Slowest to start, but
+  // runs optimized code from the first request.
+  Optimized,
+  // Compile all functions with Liftoff, and recompile hot functions with TurboFan in the
+  // background.
+  Tiered,
+  // Like Tiered, but compile each function with Liftoff only when it's called for the first time.
+  LazyTiered,
+};
+
+// Set the compilation mode of all V8 VMs (Optimized by default). V8 flags are process-wide, so it
+// must be called before the first V8 VM is created.
+// @return false if V8 was already initialized with another mode.
+bool setV8CompilationMode(V8CompilationMode mode);
+
 std::unique_ptr<WasmVm> createV8Vm();
 
 } // namespace proxy_wasm
@@ -21,6 +21,23 @@
 
 namespace proxy_wasm {
 
+// How WAMR runs Wasm bytecode. Modules precompiled with wamrc (AOT) run as native code in all
+// modes. Only the modes WAMR was built with are available.
+enum class WamrRunningMode {
+  // The fastest mode WAMR was built with.
+  Default,
+  // Interpreter (the fast interpreter, unless WAMR was built with the classic one).
+  Interpreter,
+  // Fast JIT: compiles quickly, but generates slower code than LlvmJit.
+  FastJit,
+  // LLVM JIT: compiles slowly, but generates the fastest code.
+  LlvmJit,
+};
+
+// @return whether WAMR was built with 'mode'.
+bool isWamrRunningModeSupported(WamrRunningMode mode);
+
 std::unique_ptr<WasmVm> createWamrVm();
+std::unique_ptr<WasmVm> createWamrVm(WamrRunningMode mode);
 
 } // namespace proxy_wasm
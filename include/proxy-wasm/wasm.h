@@ -21,6 +21,7 @@
 #include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -35,6 +36,8 @@ namespace proxy_wasm {
 
 class ContextBase;
 class WasmHandleBase;
+class Sha256Hasher;
+struct ParsedModule;
 
 using WasmVmFactory = std::function<std::unique_ptr<WasmVm>()>;
 using CallOnThreadFunction = std::function<void(std::function<void()>)>;
@@ -55,7 +58,10 @@ public:
   WasmBase(const std::shared_ptr<WasmHandleBase> &base_wasm_handle, const WasmVmFactory &factory);
   virtual ~WasmBase();
 
+  // Copies 'code', use the WasmBytecodePtr variant to share it instead.
   bool load(const std::string &code, bool allow_precompiled = false);
+  // Keeps a reference to 'code' (without copying it) for as long as it's needed.
+  bool load(const WasmBytecodePtr &code, bool allow_precompiled = false);
   bool initialize();
   void startVm(ContextBase *root_context);
   bool configure(ContextBase *root_context, std::shared_ptr<PluginBase> plugin);
@@ -79,8 +85,24 @@ public:
 
   const std::string &vm_configuration() const;
 
-  const std::string &moduleBytecode() const { return module_bytecode_; }
-  const std::string &modulePrecompiled() const { return module_precompiled_; }
+  // Capture the linear memory of this (base) VM after it has been started, and initialize VMs
+  // cloned from it by copying the snapshot instead of running data segment initialization and
+  // _initialize/main (or _start) again. Must be called before initialize(). Ignored for modules
+  // which define mutable globals other than the stack pointer (named "__stack_pointer" in the
+  // "name" section or in the exports), since their clones wouldn't get the globals' state.
+  void enableMemorySnapshot() { memory_snapshot_enabled_ = true; }
+  const std::string &memorySnapshot() const { return memory_snapshot_; }
+
+  std::string_view moduleBytecode() const {
+    return module_bytecode_ ? *module_bytecode_ : std::string_view();
+  }
+  std::string_view modulePrecompiled() const { return module_precompiled_; }
+  const SharedModulePtr &sharedModule() const { return shared_module_; }
+  // Serialize the compiled module of this (base) VM again and replace it in the compiled module
+  // cache (see setCompiledModuleCache()), e.g. once an engine which compiles functions lazily or
+  // tiers them up while they run (see V8CompilationMode) optimized the hot ones.
+  // @return whether or not the cache was updated.
+  bool updateCompiledModuleCache();
   const std::unordered_map<uint32_t, std::string> functionNames() const { return function_names_; }
 
   void timerReady(uint32_t root_context_id);
@@ -116,6 +138,10 @@ public:
   virtual void setTimerPeriod(uint32_t root_context_id, std::chrono::milliseconds period) {
     timer_period_[root_context_id] = period;
   }
+  // Stop the timers of all root contexts, e.g. while a canary VM is parked, and restart them.
+  // Periods set while the timers are paused take effect once they're resumed.
+  void pauseTimers();
+  void resumeTimers();
 
   // Support functions.
   //
@@ -205,6 +231,8 @@ protected:
   class ShutdownHandle;
 
   void establishEnvironment(); // Language specific environments.
+  void captureMemorySnapshot();
+  bool restoreMemorySnapshot();
 
   std::string vm_id_;  // User-provided vm_id.
   std::string vm_key_; // vm_id + hash of code.
@@ -219,6 +247,8 @@ protected:
   std::unordered_set<std::unique_ptr<ContextBase>> pending_delete_;             // Root contexts.
   std::unordered_map<uint32_t, ContextBase *> contexts_;                 // Contains all contexts.
   std::unordered_map<uint32_t, std::chrono::milliseconds> timer_period_; // per root_id.
+  bool timers_paused_ = false;
+  std::unordered_map<uint32_t, std::chrono::milliseconds> paused_timer_period_; // per root_id.
   std::unique_ptr<ShutdownHandle> shutdown_handle_;
   std::unordered_map<std::string, std::string>
       envs_; // environment variables passed through wasi.environ_get
@@ -264,6 +294,7 @@ protected:
   WasmCallVoid<3> on_grpc_receive_trailing_metadata_;
 
   WasmCallVoid<2> on_queue_ready_;
+  WasmCallVoid<2> on_shared_data_changed_;
   WasmCallVoid<3> on_foreign_function_;
 
   WasmCallWord<1> on_done_;
@@ -277,8 +308,8 @@ protected:
               _f(on_request_trailers) _f(on_request_metadata) _f(on_response_body)                 \
                   _f(on_response_trailers) _f(on_response_metadata) _f(on_http_call_response)      \
                       _f(on_grpc_receive) _f(on_grpc_close) _f(on_grpc_receive_initial_metadata)   \
-                          _f(on_grpc_receive_trailing_metadata) _f(on_queue_ready) _f(on_done)     \
-                              _f(on_log) _f(on_delete)
+                          _f(on_grpc_receive_trailing_metadata) _f(on_queue_ready)                 \
+                              _f(on_shared_data_changed) _f(on_done) _f(on_log) _f(on_delete)
 
   // Capabilities which are allowed to be linked to the module. If this is empty, restriction
   // is not enforced.
@@ -286,10 +317,22 @@ protected:
 
   std::shared_ptr<WasmHandleBase> base_wasm_handle_;
 
-  // Used by the base_wasm to enable non-clonable thread local Wasm(s) to be constructed.
-  std::string module_bytecode_;
-  std::string module_precompiled_;
+  // Used by the base_wasm to enable non-clonable thread local Wasm(s) to be constructed. Both
+  // reference the original bytecode (or the cached compiled module) instead of copying it.
+  WasmBytecodePtr module_bytecode_;
+  std::string_view module_precompiled_;
+  std::shared_ptr<const std::string_view> module_precompiled_storage_;
+  // Key of the compiled module in the compiled module cache, if it's enabled.
+  std::string compiled_module_cache_key_;
   std::unordered_map<uint32_t, std::string> function_names_;
+  // Keeps the parsed bytecode available to other base VMs loading the same code.
+  std::shared_ptr<const ParsedModule> parsed_module_;
+  // Keeps the compiled module available to other base VMs loading the same bytecode.
+  SharedModulePtr shared_module_;
+
+  // Used by the base_wasm to initialize thread local Wasm(s) from a memory snapshot.
+  bool memory_snapshot_enabled_ = false;
+  std::string memory_snapshot_;
 
   // ABI version.
   AbiVersion abi_version_ = AbiVersion::Unknown;
@@ -328,6 +371,12 @@ public:
     }
   }
 
+  // Check that 'plugin' can be started and configured in a clone of this VM. Verdicts are cached
+  // by plugin key for the lifetime of this VM. The clone created by a successful canary is parked
+  // with its timers paused, and reused as the thread-local VM if the next
+  // getOrCreateThreadLocalPlugin() call on the calling thread is for this VM. It's discarded by a
+  // createWasm() call for another VM on that thread, once nothing else references this VM, or
+  // right away if the canary runs on the createWasmAsync() pool.
   bool canary(const std::shared_ptr<PluginBase> &plugin,
               const WasmHandleCloneFactory &clone_factory);
 
@@ -337,18 +386,73 @@ public:
 
 protected:
   std::shared_ptr<WasmBase> wasm_base_;
+  std::mutex canary_mutex_; // Serializes canaries, which may run on different threads.
   std::unordered_map<std::string, bool> plugin_canary_cache_;
 };
 
+// Receives the bytecode of a module in chunks (e.g. while it's being downloaded), and does the work
+// which doesn't need the complete module as they arrive: each section is validated as soon as it's
+// complete, so that corrupted modules are rejected before the rest is received, and the code is
+// hashed incrementally, so that makeVmKey() and WasmBase::load() don't have to hash it again.
+class WasmBytecodeStream {
+public:
+  // 'expected_size' (e.g. the Content-Length) avoids reallocating the buffer as chunks arrive.
+  explicit WasmBytecodeStream(size_t expected_size = 0);
+  ~WasmBytecodeStream();
+
+  // Returns false if the bytecode received so far is corrupted.
+  bool append(std::string_view chunk);
+  // Returns the complete bytecode, to be passed to makeVmKey(), createWasm() or WasmBase::load(),
+  // or nullptr if it's corrupted or incomplete. Can only be called once.
+  WasmBytecodePtr finish();
+
+private:
+  std::string bytecode_;
+  size_t next_section_ = 8; // Offset of the first section which hasn't been completely received.
+  bool failed_ = false;
+  std::unique_ptr<Sha256Hasher> hasher_;
+};
+
 std::string makeVmKey(std::string_view vm_id, std::string_view configuration,
                       std::string_view code);
+// Same as above, but the hash of the code is computed only once per code buffer and reused for as
+// long as the buffer is alive, e.g. when the configuration is updated. Both variants return the
+// same key for the same code.
+std::string makeVmKey(std::string_view vm_id, std::string_view configuration,
+                      const WasmBytecodePtr &code);
 
-// Returns nullptr on failure (i.e. initialization of the VM fails).
+// Returns nullptr on failure (i.e. initialization of the VM fails). Concurrent calls with the same
+// 'vm_key' share a single base VM: the first caller creates it and the others wait for it. Calls
+// with different keys load and initialize their base VMs in parallel.
 std::shared_ptr<WasmHandleBase> createWasm(const std::string &vm_key, const std::string &code,
                                            const std::shared_ptr<PluginBase> &plugin,
                                            const WasmHandleFactory &factory,
                                            const WasmHandleCloneFactory &clone_factory,
                                            bool allow_precompiled);
+// Same as above, but shares 'code' with the base VM instead of copying it, e.g. a module mapped
+// into memory with BytecodeUtil::mapBytecodeFile().
+std::shared_ptr<WasmHandleBase> createWasm(const std::string &vm_key, const WasmBytecodePtr &code,
+                                           const std::shared_ptr<PluginBase> &plugin,
+                                           const WasmHandleFactory &factory,
+                                           const WasmHandleCloneFactory &clone_factory,
+                                           bool allow_precompiled);
+
+// Called with the base Wasm handle, or nullptr on failure.
+using CreateWasmCallback = std::function<void(std::shared_ptr<WasmHandleBase> wasm_handle)>;
+
+// Asynchronous variant of createWasm(), which runs on a bounded pool of threads (up to
+// PROXY_WASM_HOST_MAX_CREATE_WASM_THREADS) and calls 'callback' on that pool's thread once done.
+// 'factory' and 'clone_factory' must be safe to call from the pool's threads.
+// The pool's threads are started on demand and detached. They are never stopped and are left
+// blocked waiting for work at exit, so callers must wait for their pending callbacks before
+// exiting.
+void createWasmAsync(std::string vm_key, std::string code, std::shared_ptr<PluginBase> plugin,
+                     WasmHandleFactory factory, WasmHandleCloneFactory clone_factory,
+                     bool allow_precompiled, CreateWasmCallback callback);
+// Same as above, but shares 'code' with the base VM instead of copying it.
+void createWasmAsync(std::string vm_key, WasmBytecodePtr code, std::shared_ptr<PluginBase> plugin,
+                     WasmHandleFactory factory, WasmHandleCloneFactory clone_factory,
+                     bool allow_precompiled, CreateWasmCallback callback);
 // Get an existing ThreadLocal VM matching 'vm_key' or nullptr if there isn't one.
 std::shared_ptr<WasmHandleBase> getThreadLocalWasm(std::string_view vm_key);
 
@@ -380,6 +484,65 @@ std::shared_ptr<PluginHandleBase> getOrCreateThreadLocalPlugin(
     const std::shared_ptr<WasmHandleBase> &base_handle, const std::shared_ptr<PluginBase> &plugin,
     const WasmHandleCloneFactory &clone_factory, const PluginHandleFactory &plugin_factory);
 
+// Called on each worker thread with the worker's index in 'workers' and its thread-local Plugin
+// handle (or nullptr on failure). The thread-local caches don't own the handles, so the embedder
+// must keep a reference for the pre-warmed VM to survive.
+using WarmUpWorkerCallback =
+    std::function<void(size_t worker, std::shared_ptr<PluginHandleBase> plugin_handle)>;
+// Called once all the workers are done, with the readiness of each worker. It runs on the thread
+// of the last worker to finish.
+using WarmUpDoneCallback = std::function<void(const std::vector<bool> &ready)>;
+
+// Clone, initialize, start and configure the thread-local VM for 'plugin' on every worker ahead of
+// traffic, by dispatching getOrCreateThreadLocalPlugin() to each of 'workers'. This moves clone
+// and initialization latency out of the first requests handled by each worker, and allows the
+// embedder to wait until all the workers are ready.
+void warmUpThreadLocalPlugins(const std::shared_ptr<WasmHandleBase> &base_handle,
+                              const std::shared_ptr<PluginBase> &plugin,
+                              const WasmHandleCloneFactory &clone_factory,
+                              const PluginHandleFactory &plugin_factory,
+                              const std::vector<CallOnThreadFunction> &workers,
+                              WarmUpWorkerCallback on_worker, WarmUpDoneCallback on_done);
+
+enum class PluginSwapStage {
+  CreatingBaseWasm, // Compiling and initializing the new base VM off the worker threads.
+  WarmingUp,        // Pre-warming the new thread-local VMs on the workers.
+  Swapping,         // Replacing the active plugin on the workers.
+  Done,             // The new plugin is active on all the workers.
+  Failed,           // The new plugin couldn't be created, the old one is still active.
+};
+
+struct PluginSwapProgress {
+  PluginSwapStage stage = PluginSwapStage::CreatingBaseWasm;
+  size_t workers = 0;
+  size_t workers_warmed_up = 0;
+  size_t workers_swapped = 0;
+};
+
+// Called whenever the swap makes progress. Calls are serialized, but may come from the thread
+// calling swapThreadLocalPlugins(), from the createWasmAsync() pool or from the workers.
+using PluginSwapCallback = std::function<void(const PluginSwapProgress &progress)>;
+
+// Replace the plugin active under 'swap_key' on every worker with 'plugin' running 'code', without
+// stalling traffic. The base VM is created on the createWasmAsync() pool, and the thread-local VMs
+// are pre-warmed on every worker with warmUpThreadLocalPlugins(). Only once all the workers are
+// ready, each worker replaces its active plugin on its own thread, and releases the old handle,
+// which drains the old plugin through WasmBase::startShutdown(). If anything fails, the old plugin
+// stays active and the pre-warmed handles are released on their workers. The first swap for a
+// 'swap_key' installs its plugin.
+void swapThreadLocalPlugins(std::string swap_key, std::string vm_key, WasmBytecodePtr code,
+                            std::shared_ptr<PluginBase> plugin, WasmHandleFactory factory,
+                            WasmHandleCloneFactory clone_factory,
+                            PluginHandleFactory plugin_factory, bool allow_precompiled,
+                            std::vector<CallOnThreadFunction> workers,
+                            PluginSwapCallback on_progress);
+
+// Get the plugin active under 'swap_key' on the calling thread, or nullptr if there isn't one.
+// It's always fully initialized, so streams never wait for a swap in progress.
+std::shared_ptr<PluginHandleBase> getThreadLocalActivePlugin(std::string_view swap_key);
+// Release the plugin active under 'swap_key' on the calling thread, which drains it.
+void removeThreadLocalActivePlugin(std::string_view swap_key);
+
 // Clear Base Wasm cache and the thread-local Wasm sandbox cache for the calling thread.
 void clearWasmCachesForTesting();
 
@@ -123,6 +123,30 @@ inline WasmResult proxy_set_shared_data(const char *key_ptr, size_t key_size, co
       exports::set_shared_data(WR(key_ptr), WS(key_size), WR(value_ptr), WS(value_size), WS(cas)));
 }
 
+// Get several keys at once. 'keys' are serialized pairs, of which only the names are used. The
+// result is serialized as one pair per key, in the same order, with the CAS value (or an empty
+// string if the key wasn't found) as the name and the shared data value as the value.
+inline WasmResult proxy_get_shared_data_pairs(const char *keys_ptr, size_t keys_size,
+                                              const char **ptr, size_t *size) {
+  return wordToWasmResult(
+      exports::get_shared_data_pairs(WR(keys_ptr), WS(keys_size), WR(ptr), WR(size)));
+}
+// Set several keys at once, regardless of their CAS values. Stops at the first failure.
+inline WasmResult proxy_set_shared_data_pairs(const char *ptr, size_t size) {
+  return wordToWasmResult(exports::set_shared_data_pairs(WR(ptr), WS(size)));
+}
+
+// Subscribe to changes of 'key' (or all keys starting with 'key' if 'prefix' is set). Changes are
+// delivered to the root context via proxy_on_shared_data_changed.
+inline WasmResult proxy_subscribe_shared_data(const char *key_ptr, size_t key_size, bool prefix,
+                                              uint32_t *token) {
+  return wordToWasmResult(
+      exports::subscribe_shared_data(WR(key_ptr), WS(key_size), WS(prefix), WR(token)));
+}
+inline WasmResult proxy_unsubscribe_shared_data(uint32_t token) {
+  return wordToWasmResult(exports::unsubscribe_shared_data(WS(token)));
+}
+
 // SharedQueue
 // Note: Registering the same queue_name will overwrite the old registration while preseving any
 // pending data. Consequently it should typically be followed by a call to
@@ -144,6 +168,14 @@ inline WasmResult proxy_dequeue_shared_queue(uint32_t token, const char **data_p
                                              size_t *data_size) {
   return wordToWasmResult(exports::dequeue_shared_queue(WS(token), WR(data_ptr), WR(data_size)));
 }
+// Dequeues up to 'max_items' items (stopping once their total size reaches 'max_bytes'), serialized
+// as pairs with empty names and the items as values. Returns Empty if the queue is empty.
+inline WasmResult proxy_dequeue_shared_queue_items(uint32_t token, size_t max_items,
+                                                   size_t max_bytes, const char **ptr,
+                                                   size_t *size) {
+  return wordToWasmResult(exports::dequeue_shared_queue_items(WS(token), WS(max_items),
+                                                              WS(max_bytes), WR(ptr), WR(size)));
+}
 // Returns false if the queue was not found and the data was not enqueued.
 inline WasmResult proxy_enqueue_shared_queue(uint32_t token, const char *data_ptr,
                                              size_t data_size) {
@@ -15,10 +15,12 @@
 
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -141,6 +143,19 @@ enum class Cloneable {
 
 enum class AbiVersion { ProxyWasm_0_1_0, ProxyWasm_0_2_0, ProxyWasm_0_2_1, Unknown };
 
+// Immutable Wasm bytecode, either owned or memory-mapped from a file (see BytecodeUtil), which is
+// shared by the base VM and the VMs created from it without copying. The data is valid for as long
+// as the pointer is alive.
+using WasmBytecodePtr = std::shared_ptr<const std::string_view>;
+
+// Engine-specific compiled module, which can be loaded by other VMs of the same engine without
+// compiling the bytecode again (see WasmVm::getSharedModule()).
+class SharedModule {
+public:
+  virtual ~SharedModule() = default;
+};
+using SharedModulePtr = std::shared_ptr<SharedModule>;
+
 class NullPlugin;
 
 // Integrator specific WasmVm operations.
@@ -271,6 +286,13 @@ public:
    */
   virtual bool setWord(uint64_t pointer, Word data) = 0;
 
+  /**
+   * Grow the memory of the VM to at least 'size' bytes.
+   * @param size the requested size of the memory in bytes.
+   * @return whether the memory is now at least 'size' bytes long.
+   */
+  virtual bool growMemory(uint64_t /*size*/) { return false; }
+
   /**
    * @return the Word size in this VM.
    */
@@ -282,6 +304,40 @@ public:
    */
   virtual std::string_view getPrecompiledSectionName() = 0;
 
+  /**
+   * Get the version of the compiled modules returned by getCompiledModule(), which should change
+   * with the engine version and any flags affecting the generated code.
+   * @return the version, or an empty string if compiled modules cannot be serialized.
+   */
+  virtual std::string_view getCompiledModuleVersion() { return ""; }
+
+  /**
+   * Serialize the loaded module, so that it can later be passed as 'precompiled' to load() instead
+   * of compiling the bytecode again.
+   * @return the serialized compiled module, or an empty string on failure.
+   */
+  virtual std::string getCompiledModule() { return ""; }
+
+  /**
+   * Get the loaded module in a form which can be passed to loadSharedModule() of another VM of the
+   * same engine, e.g. a base VM with a different vm_id or configuration but the same bytecode.
+   * @return the shared module, or nullptr if not supported.
+   */
+  virtual SharedModulePtr getSharedModule() { return nullptr; }
+
+  /**
+   * Load a module returned by getSharedModule() of another VM of the same engine, instead of
+   * compiling the bytecode with load().
+   * @param shared_module the module to load.
+   * @param function_names (optional) an index-to-name mapping for the functions.
+   * @return whether or not the load was successful.
+   */
+  virtual bool loadSharedModule(const SharedModulePtr & /*shared_module*/,
+                                const std::unordered_map<uint32_t, std::string> &
+                                /*function_names*/) {
+    return false;
+  }
+
   /**
    * Get typed function exported by the WASM module.
    */
@@ -303,6 +359,21 @@ public:
    */
   virtual void terminate() = 0;
 
+  /**
+   * Interrupt the call currently executing in this VM, which then returns a trap. It's called by
+   * the execution watchdog from another thread while the VM is running (see
+   * setExecutionTimeout()).
+   * @return whether or not the VM supports interrupting execution.
+   */
+  virtual bool interrupt() { return false; }
+
+  /**
+   * Whether or not calls can be interrupted while they execute (see interrupt()), rather than only
+   * at their next host function call or once they return. Only V8 and Wasmtime support it: WAMR
+   * and WasmEdge return false, as their APIs can't stop a call from the watchdog thread.
+   */
+  virtual bool supportsInterrupt() { return false; }
+
   /**
    * Byte order flag (host or wasm).
    * @return 'false' for a null VM and 'true' for a wasm VM.
@@ -321,6 +392,17 @@ public:
     fail_callbacks_.push_back(fail_callback);
   }
 
+  // Limit the duration of each call into the VM, or 0 for no limit. A call exceeding it fails the
+  // VM with FailState::RuntimeError. It's only interrupted right away by engines which support it
+  // (V8 and Wasmtime). WAMR and WasmEdge stop it at its next host function call, and WAVM and the
+  // NullVM once it returns, so they can't stop a call which loops without calling the host.
+  // Returns whether or not calls exceeding the timeout are interrupted right away.
+  bool setExecutionTimeout(std::chrono::milliseconds timeout) {
+    execution_timeout_ = timeout;
+    return timeout.count() == 0 || supportsInterrupt();
+  }
+  std::chrono::milliseconds executionTimeout() const { return execution_timeout_; }
+
   bool isHostFunctionAllowed(const std::string &name) {
     return !restricted_callback_ || allowed_hostcalls_.find(name) != allowed_hostcalls_.end();
   }
@@ -339,6 +421,7 @@ protected:
   std::unique_ptr<WasmVmIntegration> integration_;
   FailState failed_ = FailState::Ok;
   std::vector<std::function<void(FailState)>> fail_callbacks_;
+  std::chrono::milliseconds execution_timeout_{0};
 
 private:
   bool restricted_callback_{false};
@@ -374,4 +457,40 @@ struct SaveRestoreContext {
   uint32_t saved_effective_context_id_;
 };
 
+// Arms the execution timeout of a VM (see WasmVm::setExecutionTimeout()) for the duration of a call
+// into it. Calls made while another call is executing on the same thread (e.g. into malloc from a
+// host function) are covered by the deadline of the outermost call.
+class ExecutionDeadline {
+public:
+  explicit ExecutionDeadline(WasmVm *vm) {
+    if (vm->executionTimeout().count() > 0) {
+      arm(vm);
+    }
+  }
+  ~ExecutionDeadline() { disarm(); }
+  ExecutionDeadline(const ExecutionDeadline &) = delete;
+  ExecutionDeadline &operator=(const ExecutionDeadline &) = delete;
+
+  // Disarm the deadline, before handling the result of the call.
+  // @return whether or not the call exceeded the deadline.
+  bool disarm() { return vm_ != nullptr && disarmArmed(); }
+
+  // Whether this is the outermost call on this thread, which enforces the deadline.
+  bool armed() const { return vm_ != nullptr; }
+
+  // Whether the call executing on this thread exceeded its deadline. Host functions return a trap
+  // if it did, to stop engines which cannot be interrupted.
+  static bool exceeded();
+
+  // Registers a function called by the watchdog on every check, once the first call is armed,
+  // e.g. to advance the epoch of an engine which enforces deadlines itself.
+  static void addWatchdogTick(std::function<void()> tick);
+
+private:
+  void arm(WasmVm *vm);
+  bool disarmArmed();
+
+  WasmVm *vm_ = nullptr;
+};
+
 } // namespace proxy_wasm
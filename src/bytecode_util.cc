@@ -18,7 +18,19 @@
 #include <cxxabi.h>
 #endif
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <sstream>
+#endif
+
+#include <algorithm>
 #include <cstring>
+#include <utility>
 
 namespace proxy_wasm {
 
@@ -28,110 +40,117 @@ bool BytecodeUtil::checkWasmHeader(std::string_view bytecode) {
   return (bytecode.size() < 8 || ::memcmp(bytecode.data(), wasm_magic_number, 4) == 0);
 }
 
-bool BytecodeUtil::getAbiVersion(std::string_view bytecode, proxy_wasm::AbiVersion &ret) {
-  ret = proxy_wasm::AbiVersion::Unknown;
+bool BytecodeUtil::getModuleIndex(std::string_view bytecode, ModuleIndex &ret) {
+  ret = {};
+  ret.bytecode = bytecode;
   // Check Wasm header.
   if (!checkWasmHeader(bytecode)) {
     return false;
   }
+  if (bytecode.size() < 8) {
+    return true;
+  }
 
   // Skip the Wasm header.
-  const char *pos = bytecode.data() + 8;
+  size_t pos = 8;
+  while (pos < bytecode.size()) {
+    size_t section_size = 0;
+    if (!parseSection(bytecode.substr(pos), ret, section_size) || section_size == 0) {
+      return false;
+    }
+    pos += section_size;
+  }
+  return true;
+}
+
+bool BytecodeUtil::parseSection(std::string_view bytecode, ModuleIndex &index, size_t &size) {
+  size = 0;
+  if (bytecode.empty()) {
+    return true;
+  }
+  const char *pos = bytecode.data();
   const char *end = bytecode.data() + bytecode.size();
-  while (pos < end) {
-    if (pos + 1 > end) {
+  const auto section_id = static_cast<uint8_t>(*pos++);
+  uint32_t section_len = 0;
+  if (!parseVarint(pos, end, section_len)) {
+    // The size is incomplete rather than corrupted if all of its bytes so far are continued.
+    const auto size_bytes = bytecode.substr(1);
+    return size_bytes.size() < 5 && std::all_of(size_bytes.begin(), size_bytes.end(),
+                                                [](char b) { return (b & 0x80) != 0; });
+  }
+  if (section_len > end - pos) {
+    return true;
+  }
+  const char *section_end = pos + section_len;
+  const auto raw_size = static_cast<size_t>(section_end - bytecode.data());
+  ModuleIndex::Section section{section_id, {}, {pos, section_len}, {bytecode.data(), raw_size}};
+  if (section_id == 0 /* custom section */) {
+    if (!parseName(pos, section_end, section.name)) {
       return false;
     }
-    const auto section_type = *pos++;
-    uint32_t section_len = 0;
-    if (!parseVarint(pos, end, section_len) || pos + section_len > end) {
+    section.contents = {pos, static_cast<size_t>(section_end - pos)};
+  } else if (section_id == 2 /* import section */) {
+    if (!parseImports(section.contents, index.imports)) {
       return false;
     }
-    if (section_type == 7 /* export section */) {
-      const char *section_end = pos + section_len;
-      uint32_t export_vector_size = 0;
-      if (!parseVarint(pos, section_end, export_vector_size) ||
-          pos + export_vector_size > section_end) {
-        return false;
-      }
-      // Search thourgh exports.
-      for (uint32_t i = 0; i < export_vector_size; i++) {
-        // Parse name of the export.
-        uint32_t export_name_size = 0;
-        if (!parseVarint(pos, section_end, export_name_size) ||
-            pos + export_name_size > section_end) {
-          return false;
-        }
-        const auto *const name_begin = pos;
-        pos += export_name_size;
-        if (pos + 1 > end) {
-          return false;
-        }
-        // Check if it is a function type export
-        if (*pos++ == 0x00 /* function */) {
-          const std::string export_name = {name_begin, export_name_size};
-          // Check the name of the function.
-          if (export_name == "proxy_abi_version_0_1_0") {
-            ret = AbiVersion::ProxyWasm_0_1_0;
-            return true;
-          }
-          if (export_name == "proxy_abi_version_0_2_0") {
-            ret = AbiVersion::ProxyWasm_0_2_0;
-            return true;
-          }
-          if (export_name == "proxy_abi_version_0_2_1") {
-            ret = AbiVersion::ProxyWasm_0_2_1;
-            return true;
-          }
-        }
-        // Skip export's index.
-        if (!parseVarint(pos, end, export_name_size)) {
-          return false;
-        }
-      }
+  } else if (section_id == 7 /* export section */) {
+    if (!parseExports(section.contents, index.exports)) {
+      return false;
+    }
+  }
+  index.sections.push_back(section);
+  size = section.raw.size();
+  return true;
+}
+
+bool BytecodeUtil::getAbiVersion(std::string_view bytecode, proxy_wasm::AbiVersion &ret) {
+  ModuleIndex index;
+  if (!getModuleIndex(bytecode, index)) {
+    ret = proxy_wasm::AbiVersion::Unknown;
+    return false;
+  }
+  return getAbiVersion(index, ret);
+}
+
+bool BytecodeUtil::getAbiVersion(const ModuleIndex &index, proxy_wasm::AbiVersion &ret) {
+  ret = proxy_wasm::AbiVersion::Unknown;
+  for (const auto &export_ : index.exports) {
+    // Check if it is a function type export.
+    if (export_.kind != 0x00 /* function */) {
+      continue;
+    }
+    // Check the name of the function.
+    if (export_.name == "proxy_abi_version_0_1_0") {
+      ret = AbiVersion::ProxyWasm_0_1_0;
+      return true;
+    }
+    if (export_.name == "proxy_abi_version_0_2_0") {
+      ret = AbiVersion::ProxyWasm_0_2_0;
+      return true;
+    }
+    if (export_.name == "proxy_abi_version_0_2_1") {
+      ret = AbiVersion::ProxyWasm_0_2_1;
       return true;
     }
-    pos += section_len;
   }
   return true;
 }
 
 bool BytecodeUtil::getCustomSection(std::string_view bytecode, std::string_view name,
                                     std::string_view &ret) {
-  // Check Wasm header.
-  if (!checkWasmHeader(bytecode)) {
+  ModuleIndex index;
+  if (!getModuleIndex(bytecode, index)) {
     return false;
   }
+  return getCustomSection(index, name, ret);
+}
 
-  // Skip the Wasm header.
-  const char *pos = bytecode.data() + 8;
-  const char *end = bytecode.data() + bytecode.size();
-  while (pos < end) {
-    if (pos + 1 > end) {
-      return false;
-    }
-    const auto section_type = *pos++;
-    uint32_t section_len = 0;
-    if (!parseVarint(pos, end, section_len) || pos + section_len > end) {
-      return false;
-    }
-    if (section_type == 0) {
-      // Custom section.
-      const char *section_end = pos + section_len;
-      uint32_t section_name_len = 0;
-      if (!BytecodeUtil::parseVarint(pos, section_end, section_name_len) ||
-          pos + section_name_len > section_end) {
-        return false;
-      }
-      if (section_name_len == name.size() && ::memcmp(pos, name.data(), section_name_len) == 0) {
-        pos += section_name_len;
-        ret = {pos, static_cast<size_t>(section_end - pos)};
-        return true;
-      }
-      pos = section_end;
-    } else {
-      // Skip other sections.
-      pos += section_len;
+bool BytecodeUtil::getCustomSection(const ModuleIndex &index, std::string_view name,
+                                    std::string_view &ret) {
+  for (const auto &section : index.sections) {
+    if (section.id == 0 && section.name == name) {
+      ret = section.contents;
+      return true;
     }
   }
   return true;
@@ -139,8 +158,17 @@ bool BytecodeUtil::getCustomSection(std::string_view bytecode, std::string_view
 
 bool BytecodeUtil::getFunctionNameIndex(std::string_view bytecode,
                                         std::unordered_map<uint32_t, std::string> &ret) {
+  ModuleIndex index;
+  if (!getModuleIndex(bytecode, index)) {
+    return false;
+  }
+  return getFunctionNameIndex(index, ret);
+}
+
+bool BytecodeUtil::getFunctionNameIndex(const ModuleIndex &index,
+                                        std::unordered_map<uint32_t, std::string> &ret) {
   std::string_view name_section = {};
-  if (!BytecodeUtil::getCustomSection(bytecode, "name", name_section)) {
+  if (!BytecodeUtil::getCustomSection(index, "name", name_section)) {
     return false;
   };
   if (!name_section.empty()) {
@@ -194,56 +222,341 @@ bool BytecodeUtil::getFunctionNameIndex(std::string_view bytecode,
   return true;
 }
 
-bool BytecodeUtil::getStrippedSource(std::string_view bytecode, std::string &ret) {
-  // Check Wasm header.
-  if (!checkWasmHeader(bytecode)) {
+bool BytecodeUtil::getMutableGlobals(const ModuleIndex &index,
+                                     std::vector<std::string_view> &ret) {
+  // Imported globals come first in the global index space.
+  uint32_t global_index = 0;
+  for (const auto &import : index.imports) {
+    if (import.kind == 0x03) {
+      global_index++;
+    }
+  }
+
+  std::unordered_map<uint32_t, std::string_view> names;
+  std::string_view name_section = {};
+  if (!getCustomSection(index, "name", name_section) ||
+      !parseNameMap(name_section, 7 /* global names */, names)) {
     return false;
   }
+  for (const auto &export_ : index.exports) {
+    if (export_.kind == 0x03) {
+      names.insert({export_.index, export_.name});
+    }
+  }
 
-  // Skip the Wasm header.
-  const char *pos = bytecode.data() + 8;
-  const char *end = bytecode.data() + bytecode.size();
-  while (pos < end) {
-    const auto *const section_start = pos;
-    if (pos + 1 > end) {
-      return false;
+  for (const auto &section : index.sections) {
+    if (section.id != 6 /* global */) {
+      continue;
     }
-    const auto section_type = *pos++;
-    uint32_t section_len = 0;
-    if (!parseVarint(pos, end, section_len) || pos + section_len > end) {
+    const char *pos = section.contents.data();
+    const char *end = section.contents.data() + section.contents.size();
+    uint32_t global_vector_size = 0;
+    if (!parseVarint(pos, end, global_vector_size) || global_vector_size > end - pos) {
       return false;
     }
-    if (section_type == 0 /* custom section */) {
-      const auto *const section_data_start = pos;
-      uint32_t section_name_len = 0;
-      if (!parseVarint(pos, end, section_name_len) || pos + section_name_len > end) {
+    for (uint32_t i = 0; i < global_vector_size; i++, global_index++) {
+      if (!skipValType(pos, end) || pos >= end) {
         return false;
       }
-      auto section_name = std::string_view(pos, section_name_len);
-      if (section_name.find("precompiled_") != std::string::npos) {
-        // If this is the first "precompiled_" section, then save everything
-        // before it, otherwise skip it.
-        if (ret.empty()) {
-          const char *start = bytecode.data();
-          ret.append(start, section_start);
-        }
+      const auto mutability = static_cast<uint8_t>(*pos++);
+      if (!skipConstExpr(pos, end)) {
+        return false;
       }
-      pos = section_data_start + section_len;
-    } else {
-      pos += section_len;
-      // Save this section if we already saw a custom "precompiled_" section.
-      if (!ret.empty()) {
-        ret.append(section_start, pos);
+      if (mutability != 0x00) {
+        auto it = names.find(global_index);
+        ret.push_back(it != names.end() ? it->second : std::string_view());
       }
     }
   }
+  return true;
+}
+
+bool BytecodeUtil::getStrippedSource(std::string_view bytecode, std::string &ret) {
+  ModuleIndex index;
+  if (!getModuleIndex(bytecode, index)) {
+    return false;
+  }
+  return getStrippedSource(index, ret);
+}
+
+bool BytecodeUtil::getStrippedSource(const ModuleIndex &index, std::string &ret) {
+  ret.clear();
+  stripPrecompiledSections(index, ret);
   if (ret.empty()) {
     // Copy the original source code if it is empty.
-    ret = std::string(bytecode);
+    ret = std::string(index.bytecode);
+  }
+  return true;
+}
+
+bool BytecodeUtil::getStrippedSource(const WasmBytecodePtr &bytecode, WasmBytecodePtr &ret) {
+  ModuleIndex index;
+  if (!getModuleIndex(*bytecode, index)) {
+    return false;
+  }
+  return getStrippedSource(bytecode, index, ret);
+}
+
+bool BytecodeUtil::getStrippedSource(const WasmBytecodePtr &bytecode, const ModuleIndex &index,
+                                     WasmBytecodePtr &ret) {
+  std::string stripped;
+  stripPrecompiledSections(index, stripped);
+  // Share the original bytecode if there was nothing to strip.
+  ret = stripped.empty() ? bytecode : makeBytecode(std::move(stripped));
+  return true;
+}
+
+WasmBytecodePtr BytecodeUtil::makeBytecode(std::string bytecode) {
+  auto owned = std::make_shared<std::pair<const std::string, std::string_view>>(
+      std::move(bytecode), std::string_view());
+  owned->second = owned->first;
+  return {owned, &owned->second};
+}
+
+WasmBytecodePtr BytecodeUtil::mapBytecodeFile(const std::string &path) {
+#if !defined(_WIN32)
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return nullptr;
+  }
+  auto size = static_cast<size_t>(st.st_size);
+  void *data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  return WasmBytecodePtr(new std::string_view(static_cast<const char *>(data), size),
+                         [](const std::string_view *view) {
+                           ::munmap(const_cast<char *>(view->data()), view->size());
+                           delete view;
+                         });
+#else
+  std::ifstream file(path, std::ios::binary);
+  if (file.fail()) {
+    return nullptr;
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return makeBytecode(contents.str());
+#endif
+}
+
+void BytecodeUtil::stripPrecompiledSections(const ModuleIndex &index, std::string &ret) {
+  bool stripping = false;
+  for (const auto &section : index.sections) {
+    if (section.id == 0 /* custom section */) {
+      if (section.name.find("precompiled_") != std::string::npos && !stripping) {
+        // If this is the first "precompiled_" section, then save everything before it, and skip
+        // custom sections from then on.
+        ret.append(index.bytecode.data(), section.raw.data());
+        stripping = true;
+      }
+    } else if (stripping) {
+      // Save this section if we already saw a custom "precompiled_" section.
+      ret.append(section.raw);
+    }
+  }
+}
+
+bool BytecodeUtil::parseImports(std::string_view section,
+                                std::vector<ModuleIndex::Import> &ret) {
+  const char *pos = section.data();
+  const char *end = section.data() + section.size();
+  uint32_t import_vector_size = 0;
+  if (!parseVarint(pos, end, import_vector_size) || import_vector_size > end - pos) {
+    return false;
   }
+  ret.reserve(import_vector_size);
+  for (uint32_t i = 0; i < import_vector_size; i++) {
+    ModuleIndex::Import import;
+    if (!parseName(pos, end, import.module) || !parseName(pos, end, import.name) || pos >= end) {
+      return false;
+    }
+    import.kind = static_cast<uint8_t>(*pos++);
+    bool ok = false;
+    switch (import.kind) {
+    case 0x00: // function: type index.
+      ok = skipVarint(pos, end);
+      break;
+    case 0x01: // table: reference type and limits.
+      ok = skipValType(pos, end) && skipLimits(pos, end);
+      break;
+    case 0x02: // memory: limits.
+      ok = skipLimits(pos, end);
+      break;
+    case 0x03: // global: value type and mutability.
+      ok = skipValType(pos, end) && pos++ < end;
+      break;
+    case 0x04: // tag: attribute and type index.
+      ok = pos++ < end && skipVarint(pos, end);
+      break;
+    default:
+      break;
+    }
+    if (!ok) {
+      return false;
+    }
+    ret.push_back(import);
+  }
+  return true;
+}
+
+bool BytecodeUtil::parseExports(std::string_view section,
+                                std::vector<ModuleIndex::Export> &ret) {
+  const char *pos = section.data();
+  const char *end = section.data() + section.size();
+  uint32_t export_vector_size = 0;
+  if (!parseVarint(pos, end, export_vector_size) || export_vector_size > end - pos) {
+    return false;
+  }
+  ret.reserve(export_vector_size);
+  for (uint32_t i = 0; i < export_vector_size; i++) {
+    ModuleIndex::Export export_;
+    if (!parseName(pos, end, export_.name) || pos >= end) {
+      return false;
+    }
+    export_.kind = static_cast<uint8_t>(*pos++);
+    if (!parseVarint(pos, end, export_.index)) {
+      return false;
+    }
+    ret.push_back(export_);
+  }
+  return true;
+}
+
+bool BytecodeUtil::parseName(const char *&pos, const char *end, std::string_view &ret) {
+  uint32_t name_len = 0;
+  if (!parseVarint(pos, end, name_len) || name_len > end - pos) {
+    return false;
+  }
+  ret = {pos, name_len};
+  pos += name_len;
   return true;
 }
 
+bool BytecodeUtil::parseNameMap(std::string_view name_section, uint8_t subsection_id,
+                                std::unordered_map<uint32_t, std::string_view> &ret) {
+  const char *pos = name_section.data();
+  const char *end = name_section.data() + name_section.size();
+  while (pos < end) {
+    const auto id = static_cast<uint8_t>(*pos++);
+    uint32_t subsection_size = 0;
+    if (!parseVarint(pos, end, subsection_size) || subsection_size > end - pos) {
+      return false;
+    }
+    const char *subsection_end = pos + subsection_size;
+    if (id != subsection_id) {
+      pos = subsection_end;
+      continue;
+    }
+    uint32_t namemap_vector_size = 0;
+    if (!parseVarint(pos, subsection_end, namemap_vector_size)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < namemap_vector_size; i++) {
+      uint32_t index = 0;
+      std::string_view name;
+      if (!parseVarint(pos, subsection_end, index) || !parseName(pos, subsection_end, name)) {
+        return false;
+      }
+      ret.insert({index, name});
+    }
+    if (pos != subsection_end) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool BytecodeUtil::skipConstExpr(const char *&pos, const char *end) {
+  while (pos < end) {
+    const auto opcode = static_cast<uint8_t>(*pos++);
+    switch (opcode) {
+    case 0x0b: // end
+      return true;
+    case 0x41: // i32.const
+    case 0x42: // i64.const
+    case 0x23: // global.get
+    case 0xd0: // ref.null
+    case 0xd2: // ref.func
+      if (!skipVarint(pos, end)) {
+        return false;
+      }
+      break;
+    case 0x43: // f32.const
+      if (end - pos < 4) {
+        return false;
+      }
+      pos += 4;
+      break;
+    case 0x44: // f64.const
+      if (end - pos < 8) {
+        return false;
+      }
+      pos += 8;
+      break;
+    case 0x6a: // i32.add
+    case 0x6b: // i32.sub
+    case 0x6c: // i32.mul
+    case 0x7c: // i64.add
+    case 0x7d: // i64.sub
+    case 0x7e: // i64.mul
+      break;
+    case 0xfd: { // v128.const
+      uint32_t simd_opcode = 0;
+      if (!parseVarint(pos, end, simd_opcode) || simd_opcode != 12 || end - pos < 16) {
+        return false;
+      }
+      pos += 16;
+      break;
+    }
+    default:
+      // Not a constant instruction, or one which isn't supported.
+      return false;
+    }
+  }
+  return false;
+}
+
+bool BytecodeUtil::skipLimits(const char *&pos, const char *end) {
+  if (pos >= end) {
+    return false;
+  }
+  const auto flags = static_cast<uint8_t>(*pos++);
+  // Minimum, optional maximum (flag 0x01) and optional page size (flag 0x08).
+  if (!skipVarint(pos, end)) {
+    return false;
+  }
+  if ((flags & 0x01) != 0 && !skipVarint(pos, end)) {
+    return false;
+  }
+  return (flags & 0x08) == 0 || skipVarint(pos, end);
+}
+
+bool BytecodeUtil::skipValType(const char *&pos, const char *end) {
+  if (pos >= end) {
+    return false;
+  }
+  const auto type = static_cast<uint8_t>(*pos++);
+  // (ref null? heaptype) is followed by the heap type.
+  return (type != 0x63 && type != 0x64) || skipVarint(pos, end);
+}
+
+bool BytecodeUtil::skipVarint(const char *&pos, const char *end) {
+  // Up to 10 bytes (for 64-bit values).
+  for (int i = 0; i < 10 && pos < end; i++) {
+    if ((*pos++ & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
 bool BytecodeUtil::parseVarint(const char *&pos, const char *end, uint32_t &ret) {
   uint32_t shift = 0;
   uint32_t total = 0;
@@ -0,0 +1,155 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "include/proxy-wasm/compiled_module_cache.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <process.h>
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#endif
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace proxy_wasm {
+
+namespace {
+
+std::shared_ptr<CompiledModuleCache> global_compiled_module_cache;
+
+} // namespace
+
+void setCompiledModuleCache(std::shared_ptr<CompiledModuleCache> cache) {
+  std::atomic_store(&global_compiled_module_cache, std::move(cache));
+}
+
+std::shared_ptr<CompiledModuleCache> getCompiledModuleCache() {
+  return std::atomic_load(&global_compiled_module_cache);
+}
+
+std::string FileCompiledModuleCache::path(std::string_view key) const {
+  // Keys are used as file names.
+  if (key.empty() || key.find('/') != std::string_view::npos || key[0] == '.') {
+    return "";
+  }
+  return directory_ + "/" + std::string(key);
+}
+
+CompiledModulePtr FileCompiledModuleCache::get(std::string_view key) {
+  auto file_path = path(key);
+  if (file_path.empty()) {
+    return nullptr;
+  }
+#if !defined(_WIN32)
+  int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return nullptr;
+  }
+  auto size = static_cast<size_t>(st.st_size);
+  void *data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  return CompiledModulePtr(new std::string_view(static_cast<const char *>(data), size),
+                           [](const std::string_view *view) {
+                             ::munmap(const_cast<char *>(view->data()), view->size());
+                             delete view;
+                           });
+#else
+  std::ifstream file(file_path, std::ios::binary);
+  if (file.fail()) {
+    return nullptr;
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  auto owned = std::make_shared<std::pair<const std::string, std::string_view>>(contents.str(),
+                                                                                std::string_view());
+  if (owned->first.empty()) {
+    return nullptr;
+  }
+  owned->second = owned->first;
+  return {owned, &owned->second};
+#endif
+}
+
+void FileCompiledModuleCache::put(std::string_view key, std::string_view compiled_module) {
+  auto file_path = path(key);
+  if (file_path.empty()) {
+    return;
+  }
+  // Write to a temporary file and rename it, so that readers never see a partial module.
+#if !defined(_WIN32)
+  auto pid = ::getpid();
+#else
+  auto pid = ::_getpid();
+#endif
+  auto tmp_path = file_path + ".tmp" + std::to_string(pid) + "_" +
+                  std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+#if !defined(_WIN32)
+  int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return;
+  }
+  const char *pos = compiled_module.data();
+  size_t remaining = compiled_module.size();
+  while (remaining > 0) {
+    auto written = ::write(fd, pos, remaining);
+    if (written <= 0) {
+      break;
+    }
+    pos += written;
+    remaining -= written;
+  }
+  if (::close(fd) != 0 || remaining != 0 || ::rename(tmp_path.c_str(), file_path.c_str()) != 0) {
+    ::unlink(tmp_path.c_str());
+  }
+#else
+  std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+  if (file.fail()) {
+    return;
+  }
+  file.write(compiled_module.data(), compiled_module.size());
+  file.close();
+  std::error_code ec;
+  if (file.fail()) {
+    std::filesystem::remove(tmp_path, ec);
+    return;
+  }
+  // Unlike ::rename(), this replaces an existing file on Windows.
+  std::filesystem::rename(tmp_path, file_path, ec);
+  if (ec) {
+    std::filesystem::remove(tmp_path, ec);
+  }
+#endif
+}
+
+} // namespace proxy_wasm
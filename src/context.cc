@@ -196,6 +196,16 @@ WasmResult ContextBase::getSharedData(std::string_view key,
   return getGlobalSharedData().get(wasm_->vm_id(), key, data);
 }
 
+WasmResult ContextBase::getSharedDataValue(std::string_view key, SharedDataValuePtr *data) {
+  return getGlobalSharedData().get(wasm_->vm_id(), key, data);
+}
+
+WasmResult ContextBase::getSharedDataValues(const std::vector<std::string_view> &keys,
+                                            std::vector<SharedDataValuePtr> *values) {
+  getGlobalSharedData().get(wasm_->vm_id(), keys, values);
+  return WasmResult::Ok;
+}
+
 WasmResult ContextBase::setSharedData(std::string_view key, std::string_view value, uint32_t cas) {
   return getGlobalSharedData().set(wasm_->vm_id(), key, value, cas);
 }
@@ -209,6 +219,22 @@ WasmResult ContextBase::removeSharedDataKey(std::string_view key, uint32_t cas,
   return getGlobalSharedData().remove(wasm_->vm_id(), key, cas, result);
 }
 
+WasmResult ContextBase::subscribeSharedData(std::string_view key, bool prefix,
+                                            SharedDataSubscriptionToken *token_ptr) {
+  // Get the id of the root context if this is a stream context because onSharedDataChanged is on
+  // the root.
+  *token_ptr = getGlobalSharedData().subscribe(wasm_->vm_id(), key, prefix, wasm_,
+                                               isRootContext() ? id_ : parent_context_id_,
+                                               wasm_->callOnThreadFunction(), wasm_->vm_key());
+  return WasmResult::Ok;
+}
+
+WasmResult ContextBase::unsubscribeSharedData(SharedDataSubscriptionToken token) {
+  // Subscriptions can only be cancelled by the root context which owns them.
+  return getGlobalSharedData().unsubscribe(wasm_->vm_id(), wasm_,
+                                           isRootContext() ? id_ : parent_context_id_, token);
+}
+
 // Shared Queue
 
 WasmResult ContextBase::registerSharedQueue(std::string_view queue_name,
@@ -236,6 +262,11 @@ WasmResult ContextBase::dequeueSharedQueue(uint32_t token, std::string *data) {
   return getGlobalSharedQueue().dequeue(token, data);
 }
 
+WasmResult ContextBase::dequeueSharedQueueItems(uint32_t token, size_t max_items,
+                                                size_t max_bytes, std::vector<std::string> *data) {
+  return getGlobalSharedQueue().dequeue(token, max_items, max_bytes, data);
+}
+
 WasmResult ContextBase::enqueueSharedQueue(uint32_t token, std::string_view value) {
   return getGlobalSharedQueue().enqueue(token, value);
 }
@@ -248,7 +279,7 @@ void ContextBase::destroy() {
 }
 
 void ContextBase::onTick(uint32_t /*token*/) {
-  if (!isFailed() && wasm_->on_tick_) {
+  if (!isFailed() && !wasm_->timers_paused_ && wasm_->on_tick_) {
     DeferAfterCallActions actions(this);
     wasm_->on_tick_(this, id_);
   }
@@ -427,6 +458,13 @@ void ContextBase::onQueueReady(uint32_t token) {
   }
 }
 
+void ContextBase::onSharedDataChanged(uint32_t token) {
+  if (!isFailed() && wasm_->on_shared_data_changed_) {
+    DeferAfterCallActions actions(this);
+    wasm_->on_shared_data_changed_(this, id_, token);
+  }
+}
+
 void ContextBase::onGrpcReceiveInitialMetadata(uint32_t token, uint32_t elements) {
   if (isFailed() || !wasm_->on_grpc_receive_initial_metadata_) {
     return;
@@ -483,7 +521,13 @@ void ContextBase::onDelete() {
 
 WasmResult ContextBase::setTimerPeriod(std::chrono::milliseconds period,
                                        uint32_t *timer_token_ptr) {
-  wasm()->setTimerPeriod(root_context()->id(), period);
+  auto root_context_id = root_context()->id();
+  if (wasm()->timers_paused_) {
+    wasm()->paused_timer_period_[root_context_id] = period;
+  } else {
+    wasm()->timer_period_[root_context_id] = period;
+    wasm()->setTimerPeriod(root_context_id, period);
+  }
   *timer_token_ptr = 0;
   return WasmResult::Ok;
 }
@@ -529,6 +573,9 @@ ContextBase::~ContextBase() {
   // Do not remove vm context which has the same lifetime as wasm_.
   if (id_ != 0U) {
     wasm_->contexts_.erase(id_);
+    if (isRootContext()) {
+      getGlobalSharedData().unsubscribeContext(wasm_->vm_id(), wasm_, id_);
+    }
   }
 }
 
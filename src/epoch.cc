@@ -0,0 +1,122 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/epoch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+namespace proxy_wasm {
+
+// All the operations on the epochs (and the pointers readers follow) are sequentially consistent:
+// if a reader loaded an object before the writer unlinked it, then the writer tags the object with
+// an epoch no lower than the reader's, and sees the reader's epoch when reclaiming.
+struct alignas(64) EpochThreadSlot {
+  // Epoch in which the thread entered its outermost EpochGuard, or 0 outside of EpochGuards.
+  std::atomic<uint64_t> epoch{0};
+  std::atomic<bool> in_use{true};
+  // Only accessed by the thread owning the slot.
+  uint32_t depth = 0;
+  // Immutable once the slot is published.
+  EpochThreadSlot *next = nullptr;
+};
+
+namespace {
+
+std::atomic<uint64_t> global_epoch{1};
+
+// Slots are reused by new threads once their thread exits, and are intentionally leaked.
+std::atomic<EpochThreadSlot *> thread_slots{nullptr};
+
+EpochThreadSlot *claimThreadSlot() {
+  for (auto *slot = thread_slots.load(); slot != nullptr; slot = slot->next) {
+    bool in_use = false;
+    if (!slot->in_use.load(std::memory_order_relaxed) &&
+        slot->in_use.compare_exchange_strong(in_use, true)) {
+      return slot;
+    }
+  }
+  auto *slot = new EpochThreadSlot;
+  auto *head = thread_slots.load();
+  do {
+    slot->next = head;
+  } while (!thread_slots.compare_exchange_weak(head, slot));
+  return slot;
+}
+
+struct ThreadSlotClaim {
+  ThreadSlotClaim() : slot(claimThreadSlot()) {}
+  ~ThreadSlotClaim() { slot->in_use = false; }
+
+  EpochThreadSlot *slot;
+};
+
+EpochThreadSlot *getThreadSlot() {
+  thread_local ThreadSlotClaim claim;
+  return claim.slot;
+}
+
+uint64_t minActiveEpoch() {
+  auto min = std::numeric_limits<uint64_t>::max();
+  for (auto *slot = thread_slots.load(); slot != nullptr; slot = slot->next) {
+    auto epoch = slot->epoch.load();
+    if (epoch != 0 && epoch < min) {
+      min = epoch;
+    }
+  }
+  return min;
+}
+
+} // namespace
+
+EpochGuard::EpochGuard() : slot_(getThreadSlot()) {
+  if (slot_->depth++ == 0) {
+    slot_->epoch = global_epoch.load();
+  }
+}
+
+EpochGuard::~EpochGuard() {
+  if (--slot_->depth == 0) {
+    slot_->epoch = 0;
+  }
+}
+
+EpochRetireList::~EpochRetireList() {
+  for (const auto &retired : retired_) {
+    retired.deleter(retired.object);
+  }
+}
+
+void EpochRetireList::retire(void *object, void (*deleter)(void *)) {
+  retired_.push_back({object, deleter, global_epoch.load()});
+  if (retired_.size() >= kReclaimThreshold) {
+    reclaim();
+  }
+}
+
+void EpochRetireList::reclaim() {
+  // Readers entering from now on can't see any of the retired objects.
+  global_epoch++;
+  auto min_active_epoch = minActiveEpoch();
+  auto end = std::partition(retired_.begin(), retired_.end(), [min_active_epoch](const auto &r) {
+    return r.epoch >= min_active_epoch;
+  });
+  for (auto it = end; it != retired_.end(); ++it) {
+    it->deleter(it->object);
+  }
+  retired_.erase(end, retired_.end());
+}
+
+} // namespace proxy_wasm
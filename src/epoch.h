@@ -0,0 +1,77 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace proxy_wasm {
+
+struct EpochThreadSlot;
+
+// Epoch-based reclamation. Readers traverse shared structures inside an EpochGuard without taking
+// any lock, while writers unlink objects and retire them to an EpochRetireList. Retired objects
+// are freed once no reader which could have seen them is still inside its EpochGuard.
+//
+// Entering and leaving an EpochGuard only loads the global epoch and stores it to a per-thread
+// slot, so readers never wait for writers or for each other. Each thread claims its slot with a
+// compare-and-swap the first time it enters an EpochGuard.
+
+class EpochGuard {
+public:
+  EpochGuard();
+  ~EpochGuard();
+
+  EpochGuard(const EpochGuard &) = delete;
+  EpochGuard &operator=(const EpochGuard &) = delete;
+
+private:
+  EpochThreadSlot *slot_;
+};
+
+// Objects retired by writers. It's not thread-safe, so it must be guarded by the writers' lock.
+class EpochRetireList {
+public:
+  EpochRetireList() = default;
+  // Frees all the retired objects, so readers must not be able to reach the owner anymore.
+  ~EpochRetireList();
+
+  EpochRetireList(const EpochRetireList &) = delete;
+  EpochRetireList &operator=(const EpochRetireList &) = delete;
+
+  // Retires an object which readers can't reach anymore, but which readers inside an EpochGuard
+  // might still be using.
+  template <typename T> void retire(const T *object) {
+    retire(const_cast<T *>(object), [](void *ptr) { delete static_cast<T *>(ptr); });
+  }
+  void retire(void *object, void (*deleter)(void *));
+
+  // Frees the retired objects which no reader can be using anymore.
+  void reclaim();
+
+private:
+  // Objects are reclaimed in batches, once that many are retired.
+  static constexpr size_t kReclaimThreshold = 64;
+
+  struct Retired {
+    void *object;
+    void (*deleter)(void *);
+    uint64_t epoch;
+  };
+  std::vector<Retired> retired_;
+};
+
+} // namespace proxy_wasm
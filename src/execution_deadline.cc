@@ -0,0 +1,145 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "include/proxy-wasm/limits.h"
+#include "include/proxy-wasm/wasm_vm.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace proxy_wasm {
+
+namespace {
+
+// Call armed on a thread. 'vm' and 'deadline' are only set by the thread itself, with 'mutex' held,
+// so that the watchdog never interrupts a VM after the call returned.
+struct ThreadCall {
+  std::mutex mutex;
+  WasmVm *vm = nullptr;
+  std::chrono::steady_clock::time_point deadline;
+  std::atomic<bool> exceeded{false};
+};
+
+// Thread checking the deadlines of the calls armed on all threads, every
+// PROXY_WASM_HOST_EXECUTION_WATCHDOG_INTERVAL_MS. It's started by the first armed call and is never
+// stopped, so it's intentionally leaked.
+class ExecutionWatchdog {
+public:
+  void add(ThreadCall *call) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    calls_.push_back(call);
+    if (!started_) {
+      started_ = true;
+      std::thread([this] { run(); }).detach();
+    }
+  }
+
+  void remove(ThreadCall *call) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    calls_.erase(std::remove(calls_.begin(), calls_.end(), call), calls_.end());
+  }
+
+  void addTick(std::function<void()> tick) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    ticks_.push_back(std::move(tick));
+  }
+
+private:
+  void run() {
+    while (true) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(PROXY_WASM_HOST_EXECUTION_WATCHDOG_INTERVAL_MS));
+      auto now = std::chrono::steady_clock::now();
+      std::lock_guard<std::mutex> guard(mutex_);
+      for (auto *call : calls_) {
+        std::lock_guard<std::mutex> call_guard(call->mutex);
+        if (call->vm != nullptr && now >= call->deadline && !call->exceeded) {
+          call->exceeded = true;
+          call->vm->interrupt();
+        }
+      }
+      // After the checks, so that calls interrupted by a tick are already marked as exceeded.
+      for (const auto &tick : ticks_) {
+        tick();
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::vector<ThreadCall *> calls_;
+  std::vector<std::function<void()>> ticks_;
+  bool started_ = false;
+};
+
+ExecutionWatchdog &getExecutionWatchdog() {
+  static auto *watchdog = new ExecutionWatchdog;
+  return *watchdog;
+}
+
+// Registers the calls of a thread with the watchdog, from the first armed call until the thread
+// exits.
+struct ThreadCallRegistration {
+  ThreadCallRegistration() { getExecutionWatchdog().add(&call); }
+  ~ThreadCallRegistration() { getExecutionWatchdog().remove(&call); }
+
+  ThreadCall call;
+};
+
+ThreadCall &getThreadCall() {
+  thread_local ThreadCallRegistration registration;
+  return registration.call;
+}
+
+// Whether a call is armed on this thread, which avoids registering threads with the watchdog
+// unless they make calls into VMs with an execution timeout.
+thread_local bool call_armed = false;
+
+} // namespace
+
+void ExecutionDeadline::arm(WasmVm *vm) {
+  if (call_armed) {
+    return;
+  }
+  auto &call = getThreadCall();
+  std::lock_guard<std::mutex> guard(call.mutex);
+  call.vm = vm;
+  call.deadline = std::chrono::steady_clock::now() + vm->executionTimeout();
+  call.exceeded = false;
+  call_armed = true;
+  vm_ = vm;
+}
+
+bool ExecutionDeadline::disarmArmed() {
+  auto &call = getThreadCall();
+  {
+    std::lock_guard<std::mutex> guard(call.mutex);
+    call.vm = nullptr;
+  }
+  call_armed = false;
+  vm_ = nullptr;
+  return call.exceeded;
+}
+
+bool ExecutionDeadline::exceeded() { return call_armed && getThreadCall().exceeded; }
+
+void ExecutionDeadline::addWatchdogTick(std::function<void()> tick) {
+  getExecutionWatchdog().addTick(std::move(tick));
+}
+
+} // namespace proxy_wasm
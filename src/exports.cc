@@ -19,6 +19,7 @@
 
 #include <openssl/rand.h>
 
+#include <algorithm>
 #include <utility>
 
 namespace proxy_wasm {
@@ -231,15 +232,16 @@ Word get_shared_data(Word key_ptr, Word key_size, Word value_ptr_ptr, Word value
   if (!key) {
     return WasmResult::InvalidMemoryAccess;
   }
-  std::pair<std::string, uint32_t> data;
-  WasmResult result = context->getSharedData(key.value(), &data);
+  // Copy straight from the shared (immutable) value into the VM memory.
+  SharedDataValuePtr data;
+  WasmResult result = context->getSharedDataValue(key.value(), &data);
   if (result != WasmResult::Ok) {
     return result;
   }
-  if (!context->wasm()->copyToPointerSize(data.first, value_ptr_ptr, value_size_ptr)) {
+  if (!context->wasm()->copyToPointerSize(data->data, value_ptr_ptr, value_size_ptr)) {
     return WasmResult::InvalidMemoryAccess;
   }
-  if (!context->wasmVm()->setMemory(cas_ptr, sizeof(uint32_t), &data.second)) {
+  if (!context->wasmVm()->setMemory(cas_ptr, sizeof(uint32_t), &data->cas)) {
     return WasmResult::InvalidMemoryAccess;
   }
   return WasmResult::Ok;
@@ -255,6 +257,112 @@ Word set_shared_data(Word key_ptr, Word key_size, Word value_ptr, Word value_siz
   return context->setSharedData(key.value(), value.value(), cas);
 }
 
+// The keys are serialized as pairs (only the names are used). The result contains one pair per
+// requested key, in the same order: the name is the CAS value (empty if the key wasn't found) and
+// the value is the shared data value. Malformed keys are rejected with BadArgument.
+namespace {
+
+// toPairs() returns no pairs for a malformed buffer, so make sure that the buffer is exactly the
+// serialization of the pairs (4 zero bytes if there are none).
+bool isSerializedPairs(std::string_view buffer, const Pairs &pairs) {
+  return PairsUtil::pairsSize(pairs) == buffer.size() &&
+         (!pairs.empty() || buffer.find_first_not_of('\0') == std::string_view::npos);
+}
+
+} // namespace
+
+Word get_shared_data_pairs(Word keys_ptr, Word keys_size, Word ptr_ptr, Word size_ptr) {
+  auto *context = contextOrEffectiveContext();
+  auto data = context->wasmVm()->getMemory(keys_ptr, keys_size);
+  if (!data) {
+    return WasmResult::InvalidMemoryAccess;
+  }
+  auto key_pairs = PairsUtil::toPairs(data.value());
+  if (!isSerializedPairs(data.value(), key_pairs)) {
+    return WasmResult::BadArgument;
+  }
+  std::vector<std::string_view> keys;
+  keys.reserve(key_pairs.size());
+  for (const auto &p : key_pairs) {
+    keys.push_back(p.first);
+  }
+  std::vector<SharedDataValuePtr> values;
+  auto result = context->getSharedDataValues(keys, &values);
+  if (result != WasmResult::Ok) {
+    return result;
+  }
+  if (values.empty()) {
+    if (!context->wasm()->copyToPointerSize("", ptr_ptr, size_ptr)) {
+      return WasmResult::InvalidMemoryAccess;
+    }
+    return WasmResult::Ok;
+  }
+  // Values are serialized straight from the shared (immutable) values into the VM memory.
+  std::vector<uint32_t> cas(values.size());
+  Pairs pairs;
+  pairs.reserve(values.size());
+  for (size_t i = 0; i < values.size(); i++) {
+    if (!values[i]) {
+      pairs.emplace_back("", "");
+      continue;
+    }
+    cas[i] = htowasm(values[i]->cas, context->wasmVm()->usesWasmByteOrder());
+    pairs.emplace_back(std::string_view(reinterpret_cast<const char *>(&cas[i]), sizeof(uint32_t)),
+                       values[i]->data);
+  }
+  uint64_t size = PairsUtil::pairsSize(pairs);
+  uint64_t ptr = 0;
+  char *buffer = static_cast<char *>(context->wasm()->allocMemory(size, &ptr));
+  if (buffer == nullptr) {
+    return WasmResult::InvalidMemoryAccess;
+  }
+  if (!PairsUtil::marshalPairs(pairs, buffer, size)) {
+    return WasmResult::InvalidMemoryAccess;
+  }
+  if (!context->wasmVm()->setWord(ptr_ptr, Word(ptr))) {
+    return WasmResult::InvalidMemoryAccess;
+  }
+  if (!context->wasmVm()->setWord(size_ptr, Word(size))) {
+    return WasmResult::InvalidMemoryAccess;
+  }
+  return WasmResult::Ok;
+}
+
+Word set_shared_data_pairs(Word ptr, Word size) {
+  auto *context = contextOrEffectiveContext();
+  auto data = context->wasmVm()->getMemory(ptr, size);
+  if (!data) {
+    return WasmResult::InvalidMemoryAccess;
+  }
+  auto pairs = PairsUtil::toPairs(data.value());
+  if (!isSerializedPairs(data.value(), pairs)) {
+    return WasmResult::BadArgument;
+  }
+  return context->setSharedDataPairs(pairs);
+}
+
+Word subscribe_shared_data(Word key_ptr, Word key_size, Word prefix, Word token_ptr) {
+  auto *context = contextOrEffectiveContext();
+  auto key = context->wasmVm()->getMemory(key_ptr, key_size);
+  if (!key) {
+    return WasmResult::InvalidMemoryAccess;
+  }
+  uint32_t token;
+  auto result = context->subscribeSharedData(key.value(), prefix.u64_ != 0, &token);
+  if (result != WasmResult::Ok) {
+    return result;
+  }
+  if (!context->wasm()->setDatatype(token_ptr, token)) {
+    return WasmResult::InvalidMemoryAccess;
+  }
+  return WasmResult::Ok;
+}
+
+Word unsubscribe_shared_data(Word token) {
+  auto *context = contextOrEffectiveContext();
+  return context->unsubscribeSharedData(token.u32());
+}
+
 Word register_shared_queue(Word queue_name_ptr, Word queue_name_size, Word token_ptr) {
   auto *context = contextOrEffectiveContext();
   auto queue_name = context->wasmVm()->getMemory(queue_name_ptr, queue_name_size);
@@ -285,6 +393,42 @@ Word dequeue_shared_queue(Word token, Word data_ptr_ptr, Word data_size_ptr) {
   return WasmResult::Ok;
 }
 
+// The items are serialized as pairs with empty names and the items as values, so that the SDKs
+// can parse them like any other pairs. At most PROXY_WASM_HOST_PAIRS_MAX_COUNT items (and about
+// PROXY_WASM_HOST_PAIRS_MAX_BYTES bytes) are returned, regardless of 'max_items' and 'max_bytes'.
+Word dequeue_shared_queue_items(Word token, Word max_items, Word max_bytes, Word ptr_ptr,
+                                Word size_ptr) {
+  auto *context = contextOrEffectiveContext();
+  std::vector<std::string> items;
+  WasmResult result = context->dequeueSharedQueueItems(
+      token.u32(), std::min<uint64_t>(max_items.u64_, PROXY_WASM_HOST_PAIRS_MAX_COUNT),
+      std::min<uint64_t>(max_bytes.u64_, PROXY_WASM_HOST_PAIRS_MAX_BYTES), &items);
+  if (result != WasmResult::Ok) {
+    return result;
+  }
+  Pairs pairs;
+  pairs.reserve(items.size());
+  for (const auto &item : items) {
+    pairs.emplace_back("", item);
+  }
+  uint64_t size = PairsUtil::pairsSize(pairs);
+  uint64_t ptr = 0;
+  char *buffer = static_cast<char *>(context->wasm()->allocMemory(size, &ptr));
+  if (buffer == nullptr) {
+    return WasmResult::InvalidMemoryAccess;
+  }
+  if (!PairsUtil::marshalPairs(pairs, buffer, size)) {
+    return WasmResult::InvalidMemoryAccess;
+  }
+  if (!context->wasmVm()->setWord(ptr_ptr, Word(ptr))) {
+    return WasmResult::InvalidMemoryAccess;
+  }
+  if (!context->wasmVm()->setWord(size_ptr, Word(size))) {
+    return WasmResult::InvalidMemoryAccess;
+  }
+  return WasmResult::Ok;
+}
+
 Word resolve_shared_queue(Word vm_id_ptr, Word vm_id_size, Word queue_name_ptr,
                           Word queue_name_size, Word token_ptr) {
   auto *context = contextOrEffectiveContext();
@@ -51,4 +51,16 @@ std::string Sha256String(const std::vector<std::string_view> &parts) {
   return BytesToHex(Sha256(parts));
 }
 
+Sha256Hasher::Sha256Hasher() { SHA256_Init(&sha_ctx_); }
+
+void Sha256Hasher::update(std::string_view part) {
+  SHA256_Update(&sha_ctx_, part.data(), part.size());
+}
+
+std::string Sha256Hasher::finish() {
+  uint8_t sha256[SHA256_DIGEST_LENGTH];
+  SHA256_Final(sha256, &sha_ctx_);
+  return BytesToHex(std::vector<uint8_t>(std::begin(sha256), std::end(sha256)));
+}
+
 } // namespace proxy_wasm
\ No newline at end of file
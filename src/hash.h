@@ -24,4 +24,15 @@ namespace proxy_wasm {
 std::vector<uint8_t> Sha256(const std::vector<std::string_view> &parts);
 std::string Sha256String(const std::vector<std::string_view> &parts);
 
+// Incremental variant of Sha256String(), for data which arrives in parts.
+class Sha256Hasher {
+public:
+  Sha256Hasher();
+  void update(std::string_view part);
+  std::string finish();
+
+private:
+  SHA256_CTX sha_ctx_;
+};
+
 } // namespace proxy_wasm
@@ -88,6 +88,9 @@ void NullPlugin::getFunction(std::string_view function_name, WasmCallVoid<2> *f)
       SaveRestoreContext saved_context(context);
       plugin->onQueueReady(context_id, token);
     };
+  } else if (function_name == "proxy_on_shared_data_changed") {
+    // Not supported by the NullVM SDK.
+    *f = nullptr;
   } else if (!wasm_vm_->integration()->getNullVmFunction(function_name, false, 2, this, f)) {
     error("Missing getFunction for: " + std::string(function_name));
     *f = nullptr;
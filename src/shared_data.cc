@@ -14,12 +14,14 @@
 
 #include "src/shared_data.h"
 
-#include <deque>
+#include <algorithm>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <random>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
 
 #include "include/proxy-wasm/vm_id_handle.h"
 
@@ -30,43 +32,266 @@ SharedData &getGlobalSharedData() {
   return *ptr;
 };
 
-SharedData::SharedData(bool register_vm_id_callback) {
+struct SharedData::Node {
+  Node(std::string_view key, size_t hash, ValuePtr value, Node *next)
+      : key(key), hash(hash), value(std::move(value)), next(next) {}
+
+  const std::string key;
+  const size_t hash;
+  const ValuePtr value;
+  std::atomic<Node *> next;
+};
+
+struct SharedData::Table {
+  explicit Table(size_t size) : buckets(size) {}
+  // Frees the nodes still linked into the table.
+  ~Table() {
+    for (auto &bucket : buckets) {
+      for (auto *node = bucket.load(); node != nullptr;) {
+        auto *next = node->next.load();
+        delete node;
+        node = next;
+      }
+    }
+  }
+
+  std::atomic<Node *> &getBucket(size_t hash) {
+    return buckets[(hash / kNumShards) % buckets.size()];
+  }
+
+  std::vector<std::atomic<Node *>> buckets;
+};
+
+namespace {
+
+constexpr size_t kInitialBuckets = 8;
+// Keys sampled to choose a key to evict, and the maximum number of keys evicted by an update.
+constexpr size_t kEvictionSamples = 5;
+constexpr size_t kMaxEvictionRounds = 16;
+
+} // namespace
+
+SharedData::Shard::~Shard() { delete table.load(); }
+
+const SharedData::Node *SharedData::Shard::find(std::string_view key, size_t hash) const {
+  auto *current = table.load();
+  if (current == nullptr) {
+    return nullptr;
+  }
+  for (auto *node = current->getBucket(hash).load(); node != nullptr; node = node->next.load()) {
+    if (node->hash == hash && node->key == key) {
+      return node;
+    }
+  }
+  return nullptr;
+}
+
+std::atomic<SharedData::Node *> *SharedData::Shard::findLink(std::string_view key, size_t hash) {
+  auto *current = table.load();
+  if (current == nullptr) {
+    return nullptr;
+  }
+  for (auto *link = &current->getBucket(hash); link->load() != nullptr;
+       link = &link->load()->next) {
+    auto *node = link->load();
+    if (node->hash == hash && node->key == key) {
+      return link;
+    }
+  }
+  return nullptr;
+}
+
+void SharedData::Shard::insert(Node *node) {
+  auto *current = table.load();
+  if (current == nullptr) {
+    current = new Table(kInitialBuckets);
+    table.store(current);
+  }
+  auto &bucket = current->getBucket(node->hash);
+  node->next.store(bucket.load());
+  bucket.store(node);
+  if (++size <= current->buckets.size()) {
+    return;
+  }
+
+  // Readers may still be following the links of the current table, so its nodes are copied.
+  auto *new_table = new Table(current->buckets.size() * 2);
+  for (auto &old_bucket : current->buckets) {
+    for (auto *node = old_bucket.load(); node != nullptr; node = node->next.load()) {
+      auto &new_bucket = new_table->getBucket(node->hash);
+      new_bucket.store(new Node(node->key, node->hash, node->value, new_bucket.load()));
+    }
+  }
+  table.store(new_table);
+  retired.retire(current);
+}
+
+void SharedData::Shard::replace(std::atomic<Node *> *link, Node *node) {
+  auto *old_node = link->load();
+  node->next.store(old_node->next.load());
+  link->store(node);
+  retired.retire(old_node);
+}
+
+void SharedData::Shard::unlink(std::atomic<Node *> *link) {
+  auto *old_node = link->load();
+  link->store(old_node->next.load());
+  size--;
+  retired.retire(old_node);
+}
+
+SharedData::SharedData(bool register_vm_id_callback) : vm_data_(new VmMap) {
   if (register_vm_id_callback) {
     registerVmIdHandleCallback([this](std::string_view vm_id) { this->deleteByVmId(vm_id); });
   }
 }
 
+SharedData::~SharedData() {
+  const auto *vm_map = vm_data_.load();
+  for (const auto &[vm_id, vm_data] : *vm_map) {
+    delete vm_data;
+  }
+  delete vm_map;
+}
+
+const SharedData::ValuePtr *SharedData::find(VmData *vm_data, std::string_view key,
+                                             int64_t time) {
+  if (vm_data == nullptr) {
+    return nullptr;
+  }
+  auto hash = hashKey(key);
+  const auto *node = vm_data->getShard(hash).find(key, hash);
+  if (node == nullptr || node->value->expired(time)) {
+    return nullptr;
+  }
+  node->value->touch(time);
+  return &node->value;
+}
+
+SharedData::VmData *SharedData::getVmData(std::string_view vm_id, bool create) {
+  const auto *vm_map = vm_data_.load();
+  auto it = vm_map->find(vm_id);
+  if (it != vm_map->end()) {
+    return it->second;
+  }
+  if (!create) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(vm_data_mutex_);
+  vm_map = vm_data_.load();
+  it = vm_map->find(vm_id);
+  if (it != vm_map->end()) {
+    return it->second;
+  }
+  auto *vm_data = new VmData;
+  auto *new_vm_map = new VmMap(*vm_map);
+  new_vm_map->emplace(vm_id, vm_data);
+  vm_data_.store(new_vm_map);
+  retired_.retire(vm_map);
+  return vm_data;
+}
+
+WasmResult SharedData::setLimits(std::string_view vm_id, const SharedDataLimits &limits) {
+  if (limits.eviction_policy == SharedDataEvictionPolicy::Ttl &&
+      limits.ttl <= std::chrono::milliseconds::zero()) {
+    return WasmResult::BadArgument;
+  }
+  EpochGuard guard;
+  auto *vm_data = getVmData(vm_id, true);
+  std::lock_guard<std::mutex> lock(vm_data_mutex_);
+  retired_.retire(vm_data->limits.exchange(new SharedDataLimits(limits)));
+  return WasmResult::Ok;
+}
+
+SharedDataStats SharedData::getStats(std::string_view vm_id) {
+  SharedDataStats stats;
+  EpochGuard guard;
+  auto *vm_data = getVmData(vm_id, false);
+  if (vm_data != nullptr) {
+    stats.bytes = vm_data->bytes;
+    stats.keys = vm_data->keys;
+    stats.evictions = vm_data->evictions;
+  }
+  return stats;
+}
+
 void SharedData::deleteByVmId(std::string_view vm_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  data_.erase(std::string(vm_id));
+  {
+    std::lock_guard<std::mutex> lock(vm_data_mutex_);
+    const auto *vm_map = vm_data_.load();
+    auto it = vm_map->find(vm_id);
+    if (it != vm_map->end()) {
+      auto *vm_data = it->second;
+      auto *new_vm_map = new VmMap(*vm_map);
+      new_vm_map->erase(new_vm_map->find(vm_id));
+      vm_data_.store(new_vm_map);
+      retired_.retire(vm_map);
+      retired_.retire(vm_data);
+    }
+  }
+  deleteSubscriptionsByVmId(vm_id);
 }
 
 WasmResult SharedData::get(std::string_view vm_id, const std::string_view key,
                            std::pair<std::string, uint32_t> *result) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  auto map = data_.find(std::string(vm_id));
-  if (map == data_.end()) {
+  EpochGuard guard;
+  const auto *value = find(getVmData(vm_id, false), key, now());
+  if (value == nullptr) {
     return WasmResult::NotFound;
   }
-  auto it = map->second.find(std::string(key));
-  if (it != map->second.end()) {
-    *result = it->second;
-    return WasmResult::Ok;
+  // Copy the bytes without taking a reference to the value.
+  result->first.assign((*value)->data);
+  result->second = (*value)->cas;
+  return WasmResult::Ok;
+}
+
+WasmResult SharedData::get(std::string_view vm_id, std::string_view key,
+                           SharedDataValuePtr *result) {
+  EpochGuard guard;
+  const auto *value = find(getVmData(vm_id, false), key, now());
+  if (value == nullptr) {
+    return WasmResult::NotFound;
+  }
+  *result = *value;
+  return WasmResult::Ok;
+}
+
+void SharedData::get(std::string_view vm_id, const std::vector<std::string_view> &keys,
+                     std::vector<SharedDataValuePtr> *result) {
+  result->clear();
+  result->reserve(keys.size());
+
+  EpochGuard guard;
+  auto *vm_data = getVmData(vm_id, false);
+  auto time = now();
+  for (auto key : keys) {
+    const auto *value = find(vm_data, key, time);
+    result->push_back(value != nullptr ? *value : nullptr);
   }
-  return WasmResult::NotFound;
 }
 
 WasmResult SharedData::keys(std::string_view vm_id, std::vector<std::string> *result) {
   result->clear();
 
-  std::lock_guard<std::mutex> lock(mutex_);
-  auto map = data_.find(std::string(vm_id));
-  if (map == data_.end()) {
+  EpochGuard guard;
+  auto *vm_data = getVmData(vm_id, false);
+  if (vm_data == nullptr) {
     return WasmResult::Ok;
   }
-
-  for (const auto &kv : map->second) {
-    result->push_back(kv.first);
+  auto time = now();
+  for (auto &shard : vm_data->shards) {
+    auto *table = shard.table.load();
+    if (table == nullptr) {
+      continue;
+    }
+    for (auto &bucket : table->buckets) {
+      for (auto *node = bucket.load(); node != nullptr; node = node->next.load()) {
+        if (!node->value->expired(time)) {
+          result->push_back(node->key);
+        }
+      }
+    }
   }
 
   return WasmResult::Ok;
@@ -74,47 +299,317 @@ WasmResult SharedData::keys(std::string_view vm_id, std::vector<std::string> *re
 
 WasmResult SharedData::set(std::string_view vm_id, std::string_view key, std::string_view value,
                            uint32_t cas) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  std::unordered_map<std::string, std::pair<std::string, uint32_t>> *map;
-  auto map_it = data_.find(std::string(vm_id));
-  if (map_it == data_.end()) {
-    map = &data_[std::string(vm_id)];
-  } else {
-    map = &map_it->second;
+  WasmResult result;
+  {
+    EpochGuard guard;
+    auto *vm_data = getVmData(vm_id, true);
+    uint64_t needed_bytes = 0;
+    result = setValue(*vm_data, key, value, cas, &needed_bytes);
+    if (result == WasmResult::InternalFailure && needed_bytes != 0) {
+      // Try to make room for the update, unless it cannot possibly fit.
+      if (evict(*vm_data, vm_id, needed_bytes) >= needed_bytes) {
+        result = setValue(*vm_data, key, value, cas, &needed_bytes);
+      }
+    }
+  }
+  if (result == WasmResult::Ok) {
+    notifySubscribers(vm_id, key);
   }
-  auto it = map->find(std::string(key));
-  if (it != map->end()) {
-    if (cas != 0U && cas != it->second.second) {
+  return result;
+}
+
+WasmResult SharedData::setValue(VmData &vm_data, std::string_view key, std::string_view value,
+                                uint32_t cas, uint64_t *needed_bytes) {
+  const auto &limits = *vm_data.limits.load();
+  auto time = now();
+  auto hash = hashKey(key);
+
+  auto &shard = vm_data.getShard(hash);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto *link = shard.findLink(key, hash);
+  const Value *old_value = nullptr;
+  if (link != nullptr) {
+    old_value = link->load()->value.get();
+    if (cas != 0U && cas != old_value->cas && !old_value->expired(time)) {
       return WasmResult::CasMismatch;
     }
-    it->second = std::make_pair(std::string(value), nextCas());
+  }
+
+  // Reserve the additional space needed by the update.
+  uint64_t old_size = old_value != nullptr ? key.size() + old_value->data.size() : 0;
+  uint64_t new_size = key.size() + value.size();
+  if (new_size > old_size) {
+    auto delta = new_size - old_size;
+    auto bytes = vm_data.bytes.load();
+    do {
+      if (bytes + delta > limits.max_bytes) {
+        // The ABI doesn't have a "resource exhausted" status.
+        *needed_bytes = limits.eviction_policy != SharedDataEvictionPolicy::None &&
+                                new_size <= limits.max_bytes
+                            ? bytes + delta - limits.max_bytes
+                            : 0;
+        return WasmResult::InternalFailure;
+      }
+    } while (!vm_data.bytes.compare_exchange_weak(bytes, bytes + delta));
   } else {
-    map->emplace(key, std::make_pair(std::string(value), nextCas()));
+    vm_data.bytes -= old_size - new_size;
+  }
+
+  auto expiration = limits.eviction_policy == SharedDataEvictionPolicy::Ttl
+                        ? time + std::chrono::nanoseconds(limits.ttl).count()
+                        : 0;
+  auto *node = new Node(key, hash,
+                        std::make_shared<const Value>(
+                            std::string(value), nextCas(), expiration,
+                            limits.eviction_policy == SharedDataEvictionPolicy::Lru),
+                        nullptr);
+  if (link != nullptr) {
+    shard.replace(link, node);
+  } else {
+    shard.insert(node);
+    vm_data.keys++;
   }
   return WasmResult::Ok;
 }
 
+uint64_t SharedData::evict(VmData &vm_data, std::string_view vm_id, uint64_t needed_bytes) {
+  auto policy = vm_data.limits.load()->eviction_policy;
+  thread_local std::minstd_rand random(std::random_device{}());
+
+  uint64_t evicted_bytes = 0;
+  for (size_t round = 0; round < kMaxEvictionRounds && evicted_bytes < needed_bytes; round++) {
+    // Sample the keys following a random bucket (wrapping around, so that all the keys are sampled
+    // when there are only a few), and evict the best candidate among them: an expired key or (LRU
+    // only) the least recently used one.
+    auto time = now();
+    const Node *victim = nullptr;
+    size_t samples = 0;
+    auto sample = [&](Table *table, size_t begin, size_t end) {
+      for (auto i = begin; i < end && samples < kEvictionSamples; i++) {
+        for (auto *node = table->buckets[i].load(); node != nullptr && samples < kEvictionSamples;
+             node = node->next.load(), samples++) {
+          const auto &value = node->value;
+          if (victim != nullptr && victim->value->expired(time)) {
+            continue;
+          }
+          if (value->expired(time) ||
+              (policy == SharedDataEvictionPolicy::Lru &&
+               (victim == nullptr || value->last_access < victim->value->last_access))) {
+            victim = node;
+          }
+        }
+      }
+    };
+    auto first_shard = random() % kNumShards;
+    auto *first_table = vm_data.shards[first_shard].table.load();
+    size_t first_bucket = first_table != nullptr ? random() % first_table->buckets.size() : 0;
+    if (first_table != nullptr) {
+      sample(first_table, first_bucket, first_table->buckets.size());
+    }
+    for (size_t i = 1; i < kNumShards; i++) {
+      auto *table = vm_data.shards[(first_shard + i) % kNumShards].table.load();
+      if (table != nullptr) {
+        sample(table, 0, table->buckets.size());
+      }
+    }
+    if (first_table != nullptr) {
+      sample(first_table, 0, first_bucket);
+    }
+    if (samples == 0) {
+      break;
+    }
+    if (victim == nullptr) {
+      continue;
+    }
+
+    // Keys updated since they were sampled have a different CAS and aren't evicted.
+    std::string key = victim->key;
+    std::pair<std::string, uint32_t> value;
+    if (removeValue(vm_data, key, victim->value->cas, &value, true) == WasmResult::Ok) {
+      evicted_bytes += key.size() + value.first.size();
+      vm_data.evictions++;
+      notifySubscribers(vm_id, key);
+    }
+  }
+  return evicted_bytes;
+}
+
 WasmResult SharedData::remove(std::string_view vm_id, std::string_view key, uint32_t cas,
                               std::pair<std::string, uint32_t> *result) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  std::unordered_map<std::string, std::pair<std::string, uint32_t>> *map;
-  auto map_it = data_.find(std::string(vm_id));
-  if (map_it == data_.end()) {
+  WasmResult status;
+  {
+    EpochGuard guard;
+    auto *vm_data = getVmData(vm_id, false);
+    if (vm_data == nullptr) {
+      return WasmResult::NotFound;
+    }
+    status = removeValue(*vm_data, key, cas, result, false);
+  }
+  if (status == WasmResult::Ok) {
+    notifySubscribers(vm_id, key);
+  }
+  return status;
+}
+
+WasmResult SharedData::removeValue(VmData &vm_data, std::string_view key, uint32_t cas,
+                                   std::pair<std::string, uint32_t> *result, bool allow_expired) {
+  auto hash = hashKey(key);
+  auto &shard = vm_data.getShard(hash);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto *link = shard.findLink(key, hash);
+  if (link == nullptr) {
     return WasmResult::NotFound;
   }
-  map = &map_it->second;
-  auto it = map->find(std::string(key));
-  if (it != map->end()) {
-    if (cas != 0U && cas != it->second.second) {
-      return WasmResult::CasMismatch;
+  const auto &value = link->load()->value;
+  if (!allow_expired && value->expired(now())) {
+    return WasmResult::NotFound;
+  }
+  if (cas != 0U && cas != value->cas) {
+    return WasmResult::CasMismatch;
+  }
+  if (result != nullptr) {
+    *result = std::make_pair(value->data, value->cas);
+  }
+  vm_data.bytes -= key.size() + value->data.size();
+  vm_data.keys--;
+  shard.unlink(link);
+  return WasmResult::Ok;
+}
+
+uint32_t SharedData::nextSubscriptionToken() {
+  while (true) {
+    uint32_t token = next_subscription_token_++;
+    if (token == 0) {
+      continue; // 0 is an illegal token.
     }
-    if (result != nullptr) {
-      *result = it->second;
+
+    if (subscription_vm_ids_.find(token) == subscription_vm_ids_.end()) {
+      return token;
     }
-    map->erase(it);
-    return WasmResult::Ok;
   }
-  return WasmResult::NotFound;
+}
+
+uint32_t SharedData::subscribe(std::string_view vm_id, std::string_view key, bool prefix,
+                               const WasmBase *wasm, uint32_t context_id,
+                               CallOnThreadFunction call_on_thread, std::string_view vm_key) {
+  std::lock_guard<std::mutex> lock(subscriptions_mutex_);
+  auto token = nextSubscriptionToken();
+  auto &subscription = subscriptions_[std::string(vm_id)][token];
+  subscription.key = std::string(key);
+  subscription.prefix = prefix;
+  subscription.vm_key = std::string(vm_key);
+  subscription.wasm = wasm;
+  subscription.context_id = context_id;
+  subscription.call_on_thread = std::move(call_on_thread);
+  subscription.pending = std::make_shared<std::atomic<bool>>(false);
+  subscription_vm_ids_[token] = std::string(vm_id);
+  num_subscriptions_++;
+  return token;
+}
+
+WasmResult SharedData::unsubscribe(std::string_view vm_id, const WasmBase *wasm,
+                                   uint32_t context_id, uint32_t token) {
+  std::lock_guard<std::mutex> lock(subscriptions_mutex_);
+  auto vm_subscriptions = subscriptions_.find(std::string(vm_id));
+  if (vm_subscriptions == subscriptions_.end()) {
+    return WasmResult::NotFound;
+  }
+  auto it = vm_subscriptions->second.find(token);
+  if (it == vm_subscriptions->second.end() || it->second.wasm != wasm ||
+      it->second.context_id != context_id) {
+    return WasmResult::NotFound;
+  }
+  vm_subscriptions->second.erase(it);
+  if (vm_subscriptions->second.empty()) {
+    subscriptions_.erase(vm_subscriptions);
+  }
+  subscription_vm_ids_.erase(token);
+  num_subscriptions_--;
+  return WasmResult::Ok;
+}
+
+void SharedData::unsubscribeContext(std::string_view vm_id, const WasmBase *wasm,
+                                    uint32_t context_id) {
+  if (num_subscriptions_ == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(subscriptions_mutex_);
+  auto vm_subscriptions = subscriptions_.find(std::string(vm_id));
+  if (vm_subscriptions == subscriptions_.end()) {
+    return;
+  }
+  auto &tokens = vm_subscriptions->second;
+  for (auto it = tokens.begin(); it != tokens.end();) {
+    if (it->second.wasm == wasm && it->second.context_id == context_id) {
+      subscription_vm_ids_.erase(it->first);
+      num_subscriptions_--;
+      it = tokens.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (tokens.empty()) {
+    subscriptions_.erase(vm_subscriptions);
+  }
+}
+
+void SharedData::deleteSubscriptionsByVmId(std::string_view vm_id) {
+  std::lock_guard<std::mutex> lock(subscriptions_mutex_);
+  auto vm_subscriptions = subscriptions_.find(std::string(vm_id));
+  if (vm_subscriptions == subscriptions_.end()) {
+    return;
+  }
+  for (const auto &subscription : vm_subscriptions->second) {
+    subscription_vm_ids_.erase(subscription.first);
+    num_subscriptions_--;
+  }
+  subscriptions_.erase(vm_subscriptions);
+}
+
+void SharedData::notifySubscribers(std::string_view vm_id, std::string_view key) {
+  if (num_subscriptions_ == 0) {
+    return;
+  }
+
+  std::vector<std::pair<uint32_t, Subscription>> notifications;
+  {
+    std::lock_guard<std::mutex> lock(subscriptions_mutex_);
+    auto vm_subscriptions = subscriptions_.find(std::string(vm_id));
+    if (vm_subscriptions == subscriptions_.end()) {
+      return;
+    }
+    for (const auto &[token, subscription] : vm_subscriptions->second) {
+      if (subscription.prefix ? key.substr(0, subscription.key.size()) != subscription.key
+                              : key != subscription.key) {
+        continue;
+      }
+      // Coalesce notifications, i.e. don't notify again until the subscriber has been called.
+      if (!subscription.call_on_thread || subscription.pending->exchange(true)) {
+        continue;
+      }
+      notifications.emplace_back(token, subscription);
+    }
+  }
+
+  for (auto &[token, subscription] : notifications) {
+    subscription.call_on_thread([vm_key = std::move(subscription.vm_key),
+                                 subscribed_wasm = subscription.wasm,
+                                 context_id = subscription.context_id, token = token,
+                                 pending = std::move(subscription.pending)] {
+      // This code may or may not execute in another thread.
+      // Make sure that the lock is no longer held here.
+      pending->store(false);
+      auto wasm = getThreadLocalWasm(vm_key);
+      // Context IDs are only unique within a VM, so skip the notification unless the subscription
+      // belongs to the thread-local VM (e.g. rather than to its base VM).
+      if (wasm && wasm->wasm().get() == subscribed_wasm) {
+        auto *context = wasm->wasm()->getContext(context_id);
+        if (context != nullptr) {
+          context->onSharedDataChanged(token);
+        }
+      }
+    });
+  }
 }
 
 } // namespace proxy_wasm
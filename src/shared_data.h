@@ -14,17 +14,52 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
 
+#include "include/proxy-wasm/limits.h"
 #include "include/proxy-wasm/wasm.h"
+#include "src/epoch.h"
 
 namespace proxy_wasm {
 
+enum class SharedDataEvictionPolicy {
+  None, // Reject updates exceeding the limit.
+  Lru,  // Evict the least recently used keys to make room for updates.
+  Ttl,  // Expire keys 'ttl' after they were last set, and evict expired keys to make room.
+};
+
+struct SharedDataLimits {
+  // Maximum size of the keys and values stored by a single vm_id.
+  uint64_t max_bytes = PROXY_WASM_HOST_SHARED_DATA_MAX_BYTES_PER_VM_ID;
+  SharedDataEvictionPolicy eviction_policy = SharedDataEvictionPolicy::None;
+  std::chrono::milliseconds ttl{0};
+};
+
+struct SharedDataStats {
+  uint64_t bytes = 0;
+  uint64_t keys = 0;
+  uint64_t evictions = 0;
+};
+
 class SharedData {
 public:
   SharedData(bool register_vm_id_callback = true);
+  ~SharedData();
   WasmResult get(std::string_view vm_id, std::string_view key,
                  std::pair<std::string, uint32_t> *result);
+  // Returns a reference to the immutable value, without copying it.
+  WasmResult get(std::string_view vm_id, std::string_view key, SharedDataValuePtr *result);
+  // Looks up several keys at once, looking up the vm_id only once. Keys which are not found are
+  // returned as nullptr.
+  void get(std::string_view vm_id, const std::vector<std::string_view> &keys,
+           std::vector<SharedDataValuePtr> *result);
   WasmResult keys(std::string_view vm_id, std::vector<std::string> *result);
   WasmResult set(std::string_view vm_id, std::string_view key, std::string_view value,
                  uint32_t cas);
@@ -32,20 +67,153 @@ public:
                     std::pair<std::string, uint32_t> *result);
   void deleteByVmId(std::string_view vm_id);
 
+  // Limits and eviction policy for the data stored by 'vm_id'. set() returns
+  // WasmResult::InternalFailure (the ABI doesn't have a "resource exhausted" status) when an
+  // update would exceed the limit and no (or not enough) keys could be evicted. Keys to evict are
+  // chosen among a few sampled keys, so LRU eviction is approximate once a vm_id holds more keys.
+  // Returns WasmResult::BadArgument for the TTL policy without a positive TTL.
+  WasmResult setLimits(std::string_view vm_id, const SharedDataLimits &limits);
+  SharedDataStats getStats(std::string_view vm_id);
+
+  // Subscribe the root context 'context_id' of 'wasm' to changes of a key (or of all keys starting
+  // with a prefix). When a matching key is set or removed, onSharedDataChanged(token) is called on
+  // the context via call_on_thread. Notifications are coalesced until the pending one has been
+  // delivered.
+  uint32_t subscribe(std::string_view vm_id, std::string_view key, bool prefix,
+                     const WasmBase *wasm, uint32_t context_id,
+                     CallOnThreadFunction call_on_thread, std::string_view vm_key);
+  // Returns WasmResult::NotFound unless the subscription belongs to the given context.
+  WasmResult unsubscribe(std::string_view vm_id, const WasmBase *wasm, uint32_t context_id,
+                         uint32_t token);
+  // Cancels all the subscriptions of a root context, when it's destroyed.
+  void unsubscribeContext(std::string_view vm_id, const WasmBase *wasm, uint32_t context_id);
+
+  // Number of independently locked shards per vm_id. Keys are distributed across shards by hash.
+  static constexpr size_t kNumShards = 32;
+
 private:
+  struct Value : SharedDataValue {
+    Value(std::string data, uint32_t cas, int64_t expiration, bool track_access)
+        : SharedDataValue{std::move(data), cas}, expiration(expiration),
+          track_access(track_access), last_access(track_access ? now() : 0) {}
+
+    bool expired(int64_t time) const { return expiration != 0 && time >= expiration; }
+    // The access time is only written once it's stale by kAccessTimeResolution, so that frequently
+    // read values don't bounce their cache line between readers.
+    void touch(int64_t time) const {
+      if (track_access &&
+          time - last_access.load(std::memory_order_relaxed) > kAccessTimeResolution) {
+        last_access.store(time, std::memory_order_relaxed);
+      }
+    }
+
+    const int64_t expiration; // 0 if the value never expires.
+    const bool track_access;
+    mutable std::atomic<int64_t> last_access;
+  };
+  using ValuePtr = std::shared_ptr<const Value>;
+
+  // Entries are immutable: writers replace or unlink a node, and retire it to the shard's
+  // EpochRetireList, so that readers following the old links inside an EpochGuard can still use it.
+  struct Node;
+  // Chained hash table, whose buckets are indexed by hash bits not used to select the shard. It's
+  // replaced by a copy twice as large (and retired) once it holds more keys than buckets.
+  struct Table;
+
+  // Readers look up keys inside an EpochGuard without taking any lock. Writers serialize on the
+  // per-shard mutex and update the table in place, so that only the affected node is allocated.
+  struct alignas(64) Shard {
+    ~Shard();
+
+    const Node *find(std::string_view key, size_t hash) const;
+    // The following require the mutex to be held.
+    std::atomic<Node *> *findLink(std::string_view key, size_t hash);
+    void insert(Node *node);
+    void replace(std::atomic<Node *> *link, Node *node);
+    void unlink(std::atomic<Node *> *link);
+
+    std::mutex mutex;
+    std::atomic<Table *> table{nullptr};
+    size_t size = 0;
+    EpochRetireList retired;
+  };
+
+  // Keys, accounting and limits for a single vm_id.
+  struct VmData {
+    VmData() : limits(new SharedDataLimits) {}
+    ~VmData() { delete limits.load(); }
+
+    Shard &getShard(size_t hash) { return shards[hash % kNumShards]; }
+
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> keys{0};
+    std::atomic<uint64_t> evictions{0};
+    // Replaced (and retired) by setLimits(), so that writers read the limits without locking.
+    std::atomic<const SharedDataLimits *> limits;
+    std::array<Shard, kNumShards> shards;
+  };
+
+  // The map is only copied when a vm_id is added or deleted, under vm_data_mutex_. std::less<>
+  // allows lookups by std::string_view.
+  using VmMap = std::map<std::string, VmData *, std::less<>>;
+
+  struct Subscription {
+    std::string key;
+    bool prefix;
+    std::string vm_key;
+    // Only used to check the owner of the subscription, never dereferenced.
+    const WasmBase *wasm;
+    uint32_t context_id;
+    CallOnThreadFunction call_on_thread;
+    std::shared_ptr<std::atomic<bool>> pending;
+  };
+
+  WasmResult setValue(VmData &vm_data, std::string_view key, std::string_view value,
+                      uint32_t cas, uint64_t *needed_bytes);
+  WasmResult removeValue(VmData &vm_data, std::string_view key, uint32_t cas,
+                         std::pair<std::string, uint32_t> *result, bool allow_expired);
+  uint64_t evict(VmData &vm_data, std::string_view vm_id, uint64_t needed_bytes);
+  // Must be called inside an EpochGuard, which keeps the returned VmData alive.
+  VmData *getVmData(std::string_view vm_id, bool create);
+  void notifySubscribers(std::string_view vm_id, std::string_view key);
+  void deleteSubscriptionsByVmId(std::string_view vm_id);
+  uint32_t nextSubscriptionToken();
+
+  static size_t hashKey(std::string_view key) { return std::hash<std::string_view>()(key); }
+  // Must be called inside an EpochGuard, which keeps the returned value alive.
+  static const ValuePtr *find(VmData *vm_data, std::string_view key, int64_t time);
+
+  // Resolution of the access times used for LRU eviction, in nanoseconds.
+  static constexpr int64_t kAccessTimeResolution = 1000000;
+
+  static int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
   uint32_t nextCas() {
-    auto result = cas_;
-    cas_++;
-    if (cas_ == 0U) { // 0 is not a valid CAS value.
-      cas_++;
+    auto result = cas_.fetch_add(1);
+    if (result == 0U) { // 0 is not a valid CAS value.
+      result = cas_.fetch_add(1);
     }
     return result;
   }
 
-  // TODO: use std::shared_mutex in C++17.
-  std::mutex mutex_;
-  uint32_t cas_ = 1;
-  std::map<std::string, std::unordered_map<std::string, std::pair<std::string, uint32_t>>> data_;
+  std::atomic<uint32_t> cas_{1};
+
+  std::mutex vm_data_mutex_;
+  std::atomic<const VmMap *> vm_data_;
+  // Replaced maps, deleted VmData and replaced limits. Guarded by vm_data_mutex_.
+  EpochRetireList retired_;
+
+  std::mutex subscriptions_mutex_;
+  std::atomic<size_t> num_subscriptions_{0};
+  uint32_t next_subscription_token_ = 1;
+  // vm_id -> token -> subscription
+  std::unordered_map<std::string, std::map<uint32_t, Subscription>> subscriptions_;
+  // token -> vm_id
+  std::unordered_map<uint32_t, std::string> subscription_vm_ids_;
 };
 
 SharedData &getGlobalSharedData();
@@ -14,10 +14,10 @@
 
 #include "src/shared_queue.h"
 
-#include <deque>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -25,29 +25,175 @@
 
 namespace proxy_wasm {
 
+namespace {
+
+uint64_t roundUpCapacity(size_t capacity) {
+  uint64_t result = 2;
+  while (result < capacity) {
+    result <<= 1;
+  }
+  return result;
+}
+
+} // namespace
+
 SharedQueue &getGlobalSharedQueue() {
   static auto *ptr = new SharedQueue;
   return *ptr;
 }
 
-SharedQueue::SharedQueue(bool register_vm_id_callback) {
+SharedQueue::SharedQueue(bool register_vm_id_callback) : queues_(new QueueMap) {
   if (register_vm_id_callback) {
     registerVmIdHandleCallback([this](std::string_view vm_id) { this->deleteByVmId(vm_id); });
   }
 }
 
+SharedQueue::~SharedQueue() {
+  const auto *queues = queues_.load();
+  for (const auto &[token, queue] : *queues) {
+    delete queue;
+  }
+  delete queues;
+}
+
+SharedQueue::Ring::Ring(size_t capacity) : mask_(roundUpCapacity(capacity) - 1) {
+  slots_ = std::make_unique<Slot[]>(mask_ + 1);
+  for (uint64_t i = 0; i <= mask_; i++) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool SharedQueue::Ring::push(std::string_view value) {
+  auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+  Slot *slot;
+  while (true) {
+    slot = &slots_[pos & mask_];
+    auto sequence = slot->sequence.load(std::memory_order_acquire);
+    auto diff = static_cast<int64_t>(sequence - pos);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false; // Full.
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->data.assign(value.data(), value.size());
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool SharedQueue::Ring::pop(std::string *data) {
+  auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+  Slot *slot;
+  while (true) {
+    slot = &slots_[pos & mask_];
+    auto sequence = slot->sequence.load(std::memory_order_acquire);
+    auto diff = static_cast<int64_t>(sequence - (pos + 1));
+    if (diff == 0) {
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false; // Empty.
+    } else {
+      pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  if (slot->data.capacity() > kMaxRetainedBytes) {
+    *data = std::move(slot->data);
+    std::string().swap(slot->data);
+  } else {
+    data->assign(slot->data);
+  }
+  slot->sequence.store(pos + mask_ + 1, std::memory_order_release);
+  return true;
+}
+
+SharedQueue::Queue::Queue(const SharedQueueLimits &limits)
+    : ring(limits.capacity != 0 ? std::make_unique<Ring>(limits.capacity) : nullptr),
+      overflow_policy(limits.overflow_policy),
+      coalesce_notifications(limits.coalesce_notifications),
+      notification_pending(std::make_shared<std::atomic<bool>>(false)) {}
+
+bool SharedQueue::Queue::push(std::string_view value) {
+  if (ring) {
+    return ring->push(value);
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  items.emplace_back(value);
+  return true;
+}
+
+bool SharedQueue::Queue::pop(std::string *data) {
+  if (ring) {
+    return ring->pop(data);
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  if (items.empty()) {
+    return false;
+  }
+  *data = std::move(items.front());
+  items.pop_front();
+  return true;
+}
+
+void SharedQueue::setLimits(std::string_view vm_id, const SharedQueueLimits &limits) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  limits_[std::string(vm_id)] = limits;
+}
+
+void SharedQueue::setLimits(std::string_view vm_id, std::string_view queue_name,
+                            const SharedQueueLimits &limits) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  queue_limits_[std::string(vm_id)][std::string(queue_name)] = limits;
+}
+
+SharedQueueLimits SharedQueue::getLimits(std::string_view vm_id, std::string_view queue_name) {
+  auto vm_queue_limits = queue_limits_.find(std::string(vm_id));
+  if (vm_queue_limits != queue_limits_.end()) {
+    auto limits = vm_queue_limits->second.find(std::string(queue_name));
+    if (limits != vm_queue_limits->second.end()) {
+      return limits->second;
+    }
+  }
+  auto limits = limits_.find(std::string(vm_id));
+  return limits != limits_.end() ? limits->second : SharedQueueLimits();
+}
+
+SharedQueue::Queue *SharedQueue::findQueue(uint32_t token) const {
+  const auto *queues = queues_.load();
+  auto it = queues->find(token);
+  if (it == queues->end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
 void SharedQueue::deleteByVmId(std::string_view vm_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  limits_.erase(std::string(vm_id));
+  queue_limits_.erase(std::string(vm_id));
   auto queue_keys = vm_queue_keys_.find(std::string(vm_id));
   if (queue_keys != vm_queue_keys_.end()) {
+    const auto *queues = queues_.load();
+    auto *new_queues = new QueueMap(*queues);
     for (const auto &queue_key : queue_keys->second) {
       auto token = queue_tokens_.find(queue_key);
       if (token != queue_tokens_.end()) {
-        queues_.erase(token->second);
+        auto queue = new_queues->find(token->second);
+        if (queue != new_queues->end()) {
+          retired_.retire(queue->second);
+          new_queues->erase(queue);
+        }
         queue_tokens_.erase(token);
       }
     }
     vm_queue_keys_.erase(queue_keys);
+    queues_.store(new_queues);
+    retired_.retire(queues);
   }
 }
 
@@ -60,7 +206,8 @@ uint32_t SharedQueue::nextQueueToken() {
       continue; // 0 is an illegal token.
     }
 
-    if (queues_.find(token) == queues_.end()) {
+    const auto *queues = queues_.load();
+    if (queues->find(token) == queues->end()) {
       return token;
     }
   }
@@ -69,7 +216,7 @@ uint32_t SharedQueue::nextQueueToken() {
 uint32_t SharedQueue::registerQueue(std::string_view vm_id, std::string_view queue_name,
                                     uint32_t context_id, CallOnThreadFunction call_on_thread,
                                     std::string_view vm_key) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_lock<std::shared_mutex> lock(mutex_);
   auto key = std::make_pair(std::string(vm_id), std::string(queue_name));
   auto it = queue_tokens_.insert(std::make_pair(key, static_cast<uint32_t>(0)));
   if (it.second) {
@@ -87,16 +234,25 @@ uint32_t SharedQueue::registerQueue(std::string_view vm_id, std::string_view que
   }
 
   uint32_t token = it.first->second;
-  auto &q = queues_[token];
-  q.vm_key = std::string(vm_key);
-  q.context_id = context_id;
-  q.call_on_thread = std::move(call_on_thread);
-  // Preserve any existing data.
+  auto *consumer = new Consumer{std::string(vm_key), context_id, std::move(call_on_thread)};
+  const auto *queues = queues_.load();
+  auto queue = queues->find(token);
+  if (queue != queues->end()) {
+    // Preserve any existing data.
+    retired_.retire(queue->second->consumer.exchange(consumer));
+    return token;
+  }
+  auto *new_queue = new Queue(getLimits(vm_id, queue_name));
+  new_queue->consumer = consumer;
+  auto *new_queues = new QueueMap(*queues);
+  new_queues->emplace(token, new_queue);
+  queues_.store(new_queues);
+  retired_.retire(queues);
   return token;
 }
 
 uint32_t SharedQueue::resolveQueue(std::string_view vm_id, std::string_view queue_name) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::shared_lock<std::shared_mutex> lock(mutex_);
   auto key = std::make_pair(std::string(vm_id), std::string(queue_name));
   auto it = queue_tokens_.find(key);
   if (it != queue_tokens_.end()) {
@@ -106,40 +262,80 @@ uint32_t SharedQueue::resolveQueue(std::string_view vm_id, std::string_view queu
 }
 
 WasmResult SharedQueue::dequeue(uint32_t token, std::string *data) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  auto it = queues_.find(token);
-  if (it == queues_.end()) {
+  EpochGuard guard;
+  auto *queue = findQueue(token);
+  if (queue == nullptr) {
     return WasmResult::NotFound;
   }
-  if (it->second.queue.empty()) {
+  if (!queue->pop(data)) {
+    return WasmResult::Empty;
+  }
+  return WasmResult::Ok;
+}
+
+WasmResult SharedQueue::dequeue(uint32_t token, size_t max_items, size_t max_bytes,
+                                std::vector<std::string> *data) {
+  data->clear();
+  EpochGuard guard;
+  auto *queue = findQueue(token);
+  if (queue == nullptr) {
+    return WasmResult::NotFound;
+  }
+  size_t bytes = 0;
+  std::string item;
+  while (data->size() < max_items && bytes < max_bytes && queue->pop(&item)) {
+    bytes += item.size();
+    data->push_back(std::move(item));
+  }
+  if (data->empty()) {
     return WasmResult::Empty;
   }
-  *data = it->second.queue.front();
-  it->second.queue.pop_front();
   return WasmResult::Ok;
 }
 
 WasmResult SharedQueue::enqueue(uint32_t token, std::string_view value) {
-  std::string vm_key;
-  uint32_t context_id;
-  CallOnThreadFunction call_on_thread;
-
-  {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = queues_.find(token);
-    if (it == queues_.end()) {
-      return WasmResult::NotFound;
+  EpochGuard guard;
+  auto *queue = findQueue(token);
+  if (queue == nullptr) {
+    return WasmResult::NotFound;
+  }
+
+  if (!queue->push(value)) {
+    switch (queue->overflow_policy) {
+    case SharedQueueOverflowPolicy::Reject:
+      // The ABI doesn't have a "resource exhausted" status.
+      return WasmResult::InternalFailure;
+    case SharedQueueOverflowPolicy::DropNewest:
+      return WasmResult::Ok;
+    case SharedQueueOverflowPolicy::DropOldest: {
+      std::string oldest;
+      do {
+        queue->pop(&oldest);
+      } while (!queue->push(value));
+      break;
+    }
     }
-    Queue *target_queue = &(it->second);
-    vm_key = target_queue->vm_key;
-    context_id = target_queue->context_id;
-    call_on_thread = target_queue->call_on_thread;
-    target_queue->queue.emplace_back(value);
   }
 
-  call_on_thread([vm_key, context_id, token] {
+  // When coalescing notifications, the consumer drains the queue in onQueueReady, so there is no
+  // need to post another one until the pending notification has been delivered.
+  std::shared_ptr<PendingNotification> notification;
+  if (queue->coalesce_notifications) {
+    if (queue->notification_pending->exchange(true)) {
+      return WasmResult::Ok;
+    }
+    notification = std::make_shared<PendingNotification>(queue->notification_pending);
+  }
+
+  const auto *consumer = queue->consumer.load();
+  consumer->call_on_thread([vm_key = consumer->vm_key, context_id = consumer->context_id, token,
+                            notification = std::move(notification)] {
     // This code may or may not execute in another thread.
     // Make sure that the lock is no longer held here.
+    // Items enqueued from now on (including during onQueueReady) trigger a new notification.
+    if (notification) {
+      notification->clear();
+    }
     auto wasm = getThreadLocalWasm(vm_key);
     if (wasm) {
       auto *context = wasm->wasm()->getContext(context_id);
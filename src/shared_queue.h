@@ -14,35 +14,135 @@
 
 #pragma once
 
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <vector>
 
+#include "include/proxy-wasm/limits.h"
 #include "include/proxy-wasm/wasm.h"
+#include "src/epoch.h"
 
 namespace proxy_wasm {
 
+enum class SharedQueueOverflowPolicy {
+  Reject,     // Fail the enqueue.
+  DropNewest, // Discard the item being enqueued.
+  DropOldest, // Discard the oldest queued item to make room.
+};
+
+struct SharedQueueLimits {
+  // Maximum number of queued items, rounded up to a power of 2, or 0 for an unbounded queue.
+  size_t capacity = PROXY_WASM_HOST_SHARED_QUEUE_MAX_ITEMS;
+  SharedQueueOverflowPolicy overflow_policy = SharedQueueOverflowPolicy::Reject;
+  // Whether to post onQueueReady only when no notification is pending, rather than on every
+  // enqueue. Consumers must then drain the queue in onQueueReady.
+  bool coalesce_notifications = false;
+};
+
 class SharedQueue {
 public:
   SharedQueue(bool register_vm_id_callback = true);
+  ~SharedQueue();
+
+  // Limits for the queues registered by 'vm_id' from now on, unless they have their own limits.
+  // When a queue is full, enqueue() returns WasmResult::InternalFailure (the ABI doesn't have a
+  // "resource exhausted" status) with the Reject policy, and WasmResult::Ok otherwise.
+  void setLimits(std::string_view vm_id, const SharedQueueLimits &limits);
+  // Limits for the queue 'queue_name' of 'vm_id', if it's registered from now on.
+  void setLimits(std::string_view vm_id, std::string_view queue_name,
+                 const SharedQueueLimits &limits);
 
   uint32_t registerQueue(std::string_view vm_id, std::string_view queue_name, uint32_t context_id,
                          CallOnThreadFunction call_on_thread, std::string_view vm_key);
   uint32_t resolveQueue(std::string_view vm_id, std::string_view queue_name);
   WasmResult dequeue(uint32_t token, std::string *data);
+  // Dequeues up to 'max_items' items, stopping once their total size reaches 'max_bytes'.
+  WasmResult dequeue(uint32_t token, size_t max_items, size_t max_bytes,
+                     std::vector<std::string> *data);
   WasmResult enqueue(uint32_t token, std::string_view value);
 
   void deleteByVmId(std::string_view vm_id);
   uint32_t nextQueueToken();
 
 private:
-  struct Queue {
+  // Bounded lock-free ring buffer (Vyukov's bounded MPMC queue) with preallocated slots. Slots
+  // keep buffers up to kMaxRetainedBytes, so enqueuing such items usually doesn't allocate.
+  // Larger buffers are handed over to the consumer instead.
+  class Ring {
+  public:
+    explicit Ring(size_t capacity);
+
+    bool push(std::string_view value);
+    bool pop(std::string *data);
+
+  private:
+    static constexpr size_t kMaxRetainedBytes = 4096;
+
+    struct alignas(64) Slot {
+      std::atomic<uint64_t> sequence;
+      std::string data;
+    };
+
+    const uint64_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<uint64_t> enqueue_pos_{0};
+    alignas(64) std::atomic<uint64_t> dequeue_pos_{0};
+  };
+
+  // Replaced (and retired) when the queue is registered again, so that enqueue() reads it
+  // without locking.
+  struct Consumer {
     std::string vm_key;
     uint32_t context_id;
     CallOnThreadFunction call_on_thread;
-    std::deque<std::string> queue;
   };
 
-  // TODO: use std::shared_mutex in C++17.
-  std::mutex mutex_;
+  struct Queue {
+    explicit Queue(const SharedQueueLimits &limits);
+    ~Queue() { delete consumer.load(); }
+
+    bool push(std::string_view value);
+    bool pop(std::string *data);
+
+    std::atomic<const Consumer *> consumer{nullptr};
+    // Bounded queues use a ring, unbounded ones a deque guarded by the queue's own mutex.
+    const std::unique_ptr<Ring> ring;
+    std::mutex mutex;
+    std::deque<std::string> items;
+    const SharedQueueOverflowPolicy overflow_policy;
+    const bool coalesce_notifications;
+    // Whether onQueueReady has been posted to the consumer, but not delivered yet. Only used when
+    // coalescing notifications. It's shared with the notification, which may outlive the queue.
+    const std::shared_ptr<std::atomic<bool>> notification_pending;
+  };
+
+  // Clears the pending notification flag of a queue once the notification is delivered, or once
+  // call_on_thread drops it without running it.
+  struct PendingNotification {
+    explicit PendingNotification(std::shared_ptr<std::atomic<bool>> pending)
+        : pending(std::move(pending)) {}
+    ~PendingNotification() { clear(); }
+
+    void clear() {
+      if (!cleared.exchange(true)) {
+        *pending = false;
+      }
+    }
+
+    const std::shared_ptr<std::atomic<bool>> pending;
+    std::atomic<bool> cleared{false};
+  };
+
+  // Looks up the queue without locking. Must be called inside an EpochGuard, which keeps the
+  // returned queue alive, so enqueues to different queues never contend.
+  Queue *findQueue(uint32_t token) const;
+  // Must be called with mutex_ held.
+  SharedQueueLimits getLimits(std::string_view vm_id, std::string_view queue_name);
+
+  std::shared_mutex mutex_;
   uint32_t next_queue_token_ = 1;
 
   struct pair_hash {
@@ -57,8 +157,16 @@ private:
   std::unordered_map<std::string, QueueKeySet> vm_queue_keys_;
   // queue key -> token
   std::unordered_map<std::pair<std::string, std::string>, uint32_t, pair_hash> queue_tokens_;
-  // token -> queue
-  std::unordered_map<uint32_t, Queue> queues_;
+  // token -> queue. The map is only copied when a queue is added or deleted, under mutex_, and the
+  // old map and deleted queues are retired to retired_ (also guarded by mutex_).
+  using QueueMap = std::unordered_map<uint32_t, Queue *>;
+  std::atomic<const QueueMap *> queues_;
+  EpochRetireList retired_;
+  // vm_id -> limits
+  std::unordered_map<std::string, SharedQueueLimits> limits_;
+  // vm_id -> queue name -> limits
+  std::unordered_map<std::string, std::unordered_map<std::string, SharedQueueLimits>>
+      queue_limits_;
 };
 
 SharedQueue &getGlobalSharedQueue();
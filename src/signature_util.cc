@@ -55,7 +55,26 @@ template <size_t N> constexpr std::array<uint8_t, N> hex2pubkey(const char (&hex
 
 namespace proxy_wasm {
 
-bool SignatureUtil::verifySignature(std::string_view bytecode, std::string &message) {
+// The parameters are unused when PROXY_WASM_VERIFY_WITH_ED25519_PUBKEY isn't defined.
+bool SignatureUtil::verifySignature([[maybe_unused]] std::string_view bytecode,
+                                    [[maybe_unused]] std::string &message) {
+
+#ifdef PROXY_WASM_VERIFY_WITH_ED25519_PUBKEY
+
+  ModuleIndex index;
+  if (!BytecodeUtil::getModuleIndex(bytecode, index)) {
+    message = "Failed to parse corrupted Wasm module";
+    return false;
+  }
+  return verifySignature(index, message);
+
+#endif
+
+  return true;
+}
+
+bool SignatureUtil::verifySignature([[maybe_unused]] const ModuleIndex &index,
+                                    [[maybe_unused]] std::string &message) {
 
 #ifdef PROXY_WASM_VERIFY_WITH_ED25519_PUBKEY
 
@@ -63,8 +82,9 @@ bool SignatureUtil::verifySignature(std::string_view bytecode, std::string &mess
    * Ed25519 signature generated using https://github.com/jedisct1/wasmsign
    */
 
+  const auto bytecode = index.bytecode;
   std::string_view payload;
-  if (!BytecodeUtil::getCustomSection(bytecode, "signature_wasmsign", payload)) {
+  if (!BytecodeUtil::getCustomSection(index, "signature_wasmsign", payload)) {
     message = "Failed to parse corrupted Wasm module";
     return false;
   }
@@ -15,6 +15,8 @@
 
 #include "include/proxy-wasm/v8.h"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <iomanip>
 #include <memory>
@@ -37,12 +39,23 @@
 namespace proxy_wasm {
 namespace v8 {
 
+std::mutex compilation_mode_mutex;
+V8CompilationMode compilation_mode = V8CompilationMode::Optimized;
+bool engine_initialized = false;
+
 wasm::Engine *engine() {
   static std::once_flag init;
   static wasm::own<wasm::Engine> engine;
 
   std::call_once(init, []() {
-    ::v8::internal::v8_flags.liftoff = false;
+    std::lock_guard<std::mutex> guard(compilation_mode_mutex);
+    engine_initialized = true;
+    const bool tiered = compilation_mode != V8CompilationMode::Optimized;
+    ::v8::internal::v8_flags.liftoff = tiered;
+    ::v8::internal::v8_flags.wasm_tier_up = tiered;
+    ::v8::internal::v8_flags.wasm_dynamic_tiering = tiered;
+    ::v8::internal::v8_flags.wasm_lazy_compilation =
+        compilation_mode == V8CompilationMode::LazyTiered;
     ::v8::internal::v8_flags.wasm_max_mem_pages =
         PROXY_WASM_HOST_MAX_WASM_MEMORY_SIZE_BYTES / PROXY_WASM_HOST_WASM_MEMORY_PAGE_SIZE_BYTES;
     ::v8::V8::EnableWebAssemblyTrapHandler(true);
@@ -57,12 +70,45 @@ struct FuncData {
 
   std::string name_;
   wasm::own<wasm::Func> callback_;
+  // Creates 'callback_', which is only done for the host functions imported by the module.
+  wasm::own<wasm::Func> (*make_callback_)(wasm::Store *store, FuncData *data){};
   void *raw_func_{};
   WasmVm *vm_{};
 };
 
 using FuncDataPtr = std::unique_ptr<FuncData>;
 
+// Imports and exports of a module, resolved and type-checked when the base VM is linked, and
+// shared with its clones, which only need to instantiate them.
+struct ModuleBindings {
+  struct Import {
+    wasm::ExternKind kind;
+    std::string name;                      // "module.name" of the host function.
+    wasm::Limits limits{0};                // Limits of the memory or table.
+    wasm::ValKind element = wasm::FUNCREF; // Element type of the table.
+  };
+  struct Function {
+    size_t index;
+    std::vector<wasm::ValKind> params;
+    std::vector<wasm::ValKind> results;
+  };
+
+  std::vector<Import> imports;
+  std::unordered_map<std::string, Function> functions;
+  std::optional<size_t> memory;
+};
+
+class V8SharedModule : public SharedModule {
+public:
+  explicit V8SharedModule(wasm::own<wasm::Shared<wasm::Module>> module)
+      : module_(std::move(module)) {}
+
+  const wasm::Shared<wasm::Module> *get() const { return module_.get(); }
+
+private:
+  wasm::own<wasm::Shared<wasm::Module>> module_;
+};
+
 class V8 : public WasmVm {
 public:
   V8() = default;
@@ -73,6 +119,12 @@ public:
   bool load(std::string_view bytecode, std::string_view precompiled,
             const std::unordered_map<uint32_t, std::string> &function_names) override;
   std::string_view getPrecompiledSectionName() override;
+  // V8 rejects serialized modules from other versions or with different flags.
+  std::string_view getCompiledModuleVersion() override;
+  std::string getCompiledModule() override;
+  SharedModulePtr getSharedModule() override;
+  bool loadSharedModule(const SharedModulePtr &shared_module,
+                        const std::unordered_map<uint32_t, std::string> &function_names) override;
   bool link(std::string_view debug_name) override;
 
   Cloneable cloneable() override { return Cloneable::CompiledBytecode; }
@@ -81,6 +133,7 @@ public:
   uint64_t getMemorySize() override;
   std::optional<std::string_view> getMemory(uint64_t pointer, uint64_t size) override;
   bool setMemory(uint64_t pointer, uint64_t size, const void *data) override;
+  bool growMemory(uint64_t size) override;
   bool getWord(uint64_t pointer, Word *word) override;
   bool setWord(uint64_t pointer, Word word) override;
   size_t getWordSize() override { return sizeof(uint32_t); };
@@ -101,9 +154,14 @@ public:
 #undef _GET_MODULE_FUNCTION
 
   void terminate() override;
+  bool interrupt() override;
+  bool supportsInterrupt() override { return true; }
   bool usesWasmByteOrder() override { return true; }
 
 private:
+  // Allow calls into the VM again after interrupt().
+  void cancelInterrupt();
+
   wasm::own<wasm::Trap> trap(std::string message);
 
   std::string getFailMessage(std::string_view function_name, wasm::own<wasm::Trap> trap);
@@ -124,6 +182,10 @@ private:
   void getModuleFunctionImpl(std::string_view function_name,
                              std::function<R(ContextBase *, Args...)> *function);
 
+  bool resolveBindings();
+  const wasm::Func *getHostFunction(const std::string &name);
+  const ModuleBindings::Function *getModuleFunctionBinding(std::string_view function_name);
+
   wasm::own<wasm::Store> store_;
   wasm::own<wasm::Module> module_;
   wasm::own<wasm::Shared<wasm::Module>> shared_module_;
@@ -131,8 +193,9 @@ private:
   wasm::own<wasm::Memory> memory_;
   wasm::own<wasm::Table> table_;
 
+  std::shared_ptr<const ModuleBindings> bindings_;
   std::unordered_map<std::string, FuncDataPtr> host_functions_;
-  std::unordered_map<std::string, wasm::own<wasm::Func>> module_functions_;
+  std::vector<wasm::own<wasm::Func>> module_functions_; // Indexed by export.
   std::unordered_map<uint32_t, std::string> function_names_index_;
 };
 
@@ -216,6 +279,15 @@ static bool equalValTypes(const wasm::ownvec<wasm::ValType> &left,
   return true;
 }
 
+static std::vector<wasm::ValKind> getValKinds(const wasm::ownvec<wasm::ValType> &types) {
+  std::vector<wasm::ValKind> kinds;
+  kinds.reserve(types.size());
+  for (size_t i = 0; i < types.size(); i++) {
+    kinds.push_back(types[i]->kind());
+  }
+  return kinds;
+}
+
 // Template magic.
 
 template <typename T> struct ConvertWordType {
@@ -245,6 +317,11 @@ template <typename T> constexpr auto convertArgsTupleToValTypes() {
   return convertArgsTupleToValTypesImpl<T>(std::make_index_sequence<std::tuple_size<T>::value>());
 }
 
+template <typename... Args> bool equalValKinds(const std::vector<wasm::ValKind> &kinds) {
+  constexpr std::array<wasm::ValKind, sizeof...(Args)> expected = {convertArgToValKind<Args>()...};
+  return std::equal(kinds.begin(), kinds.end(), expected.begin(), expected.end());
+}
+
 template <typename T, typename U, std::size_t... I>
 constexpr T convertValTypesToArgsTupleImpl(const U &arr, std::index_sequence<I...> /*comptime*/) {
   return std::make_tuple(
@@ -294,6 +371,40 @@ bool V8::load(std::string_view bytecode, std::string_view precompiled,
   return true;
 }
 
+SharedModulePtr V8::getSharedModule() {
+  if (module_ == nullptr) {
+    return nullptr;
+  }
+  auto shared_module = module_->share();
+  if (shared_module == nullptr) {
+    return nullptr;
+  }
+  return std::make_shared<V8SharedModule>(std::move(shared_module));
+}
+
+bool V8::loadSharedModule(const SharedModulePtr &shared_module,
+                          const std::unordered_map<uint32_t, std::string> &function_names) {
+  store_ = wasm::Store::make(engine());
+  if (store_ == nullptr) {
+    return false;
+  }
+
+  module_ = wasm::Module::obtain(store_.get(),
+                                 static_cast<const V8SharedModule *>(shared_module.get())->get());
+  if (module_ == nullptr) {
+    return false;
+  }
+
+  shared_module_ = module_->share();
+  if (shared_module_ == nullptr) {
+    return false;
+  }
+
+  function_names_index_ = function_names;
+
+  return true;
+}
+
 std::unique_ptr<WasmVm> V8::clone() {
   assert(shared_module_ != nullptr);
 
@@ -318,6 +429,7 @@ std::unique_ptr<WasmVm> V8::clone() {
   }
   clone->integration().reset(integration_clone);
 
+  clone->bindings_ = bindings_;
   clone->function_names_index_ = function_names_index_;
 
   return clone;
@@ -339,53 +451,173 @@ std::string_view V8::getPrecompiledSectionName() {
   return name;
 }
 
-bool V8::link(std::string_view /*debug_name*/) {
-  assert(module_ != nullptr);
+std::string_view V8::getCompiledModuleVersion() {
+  static const auto version = [this] {
+    std::string version(getPrecompiledSectionName());
+    if (version.empty()) {
+      return version;
+    }
+    engine(); // Fixes the compilation mode.
+    switch (compilation_mode) {
+    case V8CompilationMode::Optimized:
+      return version;
+    case V8CompilationMode::Tiered:
+      return version + "_tiered";
+    case V8CompilationMode::LazyTiered:
+      return version + "_lazy_tiered";
+    }
+    return version;
+  }();
+  return version;
+}
 
-  const auto import_types = module_.get()->imports();
-  std::vector<const wasm::Extern *> imports;
+std::string V8::getCompiledModule() {
+  if (module_ == nullptr) {
+    return "";
+  }
+  auto vec = module_->serialize();
+  return std::string(vec.get(), vec.size());
+}
+
+bool V8::resolveBindings() {
+  auto bindings = std::make_shared<ModuleBindings>();
 
+  const auto import_types = module_.get()->imports();
   for (size_t i = 0; i < import_types.size(); i++) {
     std::string_view module(import_types[i]->module().get(), import_types[i]->module().size());
     std::string_view name(import_types[i]->name().get(), import_types[i]->name().size());
     const auto *import_type = import_types[i]->type();
+    ModuleBindings::Import import{import_type->kind(),
+                                  std::string(module) + "." + std::string(name)};
 
     switch (import_type->kind()) {
 
     case wasm::EXTERN_FUNC: {
-      auto it = host_functions_.find(std::string(module) + "." + std::string(name));
-      if (it == host_functions_.end()) {
+      const auto *func = getHostFunction(import.name);
+      if (func == nullptr) {
         fail(FailState::UnableToInitializeCode,
-             std::string("Failed to load Wasm module due to a missing import: ") +
-                 std::string(module) + "." + std::string(name));
+             "Failed to load Wasm module due to a missing import: " + import.name);
         return false;
       }
-      auto *func = it->second->callback_.get();
       if (!equalValTypes(import_type->func()->params(), func->type()->params()) ||
           !equalValTypes(import_type->func()->results(), func->type()->results())) {
         fail(FailState::UnableToInitializeCode,
-             std::string("Failed to load Wasm module due to an import type mismatch: ") +
-                 std::string(module) + "." + std::string(name) +
+             "Failed to load Wasm module due to an import type mismatch: " + import.name +
                  ", want: " + printValTypes(import_type->func()->params()) + " -> " +
                  printValTypes(import_type->func()->results()) +
                  ", but host exports: " + printValTypes(func->type()->params()) + " -> " +
                  printValTypes(func->type()->results()));
         return false;
       }
-      imports.push_back(func);
     } break;
 
     case wasm::EXTERN_GLOBAL: {
       // TODO(PiotrSikora): add support when/if needed.
       fail(FailState::UnableToInitializeCode,
-           "Failed to load Wasm module due to a missing import: " + std::string(module) + "." +
-               std::string(name));
+           "Failed to load Wasm module due to a missing import: " + import.name);
+      return false;
+    } break;
+
+    case wasm::EXTERN_MEMORY: {
+      import.limits = import_type->memory()->limits();
+    } break;
+
+    case wasm::EXTERN_TABLE: {
+      import.limits = import_type->table()->limits();
+      import.element = import_type->table()->element()->kind();
+    } break;
+    }
+
+    bindings->imports.push_back(std::move(import));
+  }
+
+  const auto export_types = module_.get()->exports();
+  for (size_t i = 0; i < export_types.size(); i++) {
+    std::string_view name(export_types[i]->name().get(), export_types[i]->name().size());
+    const auto *export_type = export_types[i]->type();
+
+    switch (export_type->kind()) {
+
+    case wasm::EXTERN_FUNC: {
+      bindings->functions.insert_or_assign(
+          std::string(name),
+          ModuleBindings::Function{i, getValKinds(export_type->func()->params()),
+                                   getValKinds(export_type->func()->results())});
+    } break;
+
+    case wasm::EXTERN_GLOBAL: {
+      // TODO(PiotrSikora): add support when/if needed.
+    } break;
+
+    case wasm::EXTERN_MEMORY: {
+      bindings->memory = i;
+    } break;
+
+    case wasm::EXTERN_TABLE: {
+      // TODO(PiotrSikora): add support when/if needed.
+    } break;
+    }
+  }
+
+  bindings_ = std::move(bindings);
+  return true;
+}
+
+const wasm::Func *V8::getHostFunction(const std::string &name) {
+  auto it = host_functions_.find(name);
+  if (it == host_functions_.end()) {
+    return nullptr;
+  }
+  auto *data = it->second.get();
+  if (data->callback_ == nullptr) {
+    data->callback_ = data->make_callback_(store_.get(), data);
+  }
+  return data->callback_.get();
+}
+
+const ModuleBindings::Function *V8::getModuleFunctionBinding(std::string_view function_name) {
+  if (bindings_ == nullptr) {
+    return nullptr;
+  }
+  auto it = bindings_->functions.find(std::string(function_name));
+  if (it == bindings_->functions.end() || it->second.index >= module_functions_.size()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+bool V8::link(std::string_view /*debug_name*/) {
+  assert(module_ != nullptr);
+
+  // Imports and exports are resolved once by the base VM, and reused by its clones.
+  if (bindings_ == nullptr && !resolveBindings()) {
+    return false;
+  }
+
+  std::vector<const wasm::Extern *> imports;
+  imports.reserve(bindings_->imports.size());
+
+  for (const auto &import : bindings_->imports) {
+    switch (import.kind) {
+
+    case wasm::EXTERN_FUNC: {
+      const auto *func = getHostFunction(import.name);
+      if (func == nullptr) {
+        fail(FailState::UnableToInitializeCode,
+             "Failed to load Wasm module due to a missing import: " + import.name);
+        return false;
+      }
+      imports.push_back(func);
+    } break;
+
+    case wasm::EXTERN_GLOBAL: {
+      // Rejected by resolveBindings().
       return false;
     } break;
 
     case wasm::EXTERN_MEMORY: {
       assert(memory_ == nullptr);
-      auto type = wasm::MemoryType::make(import_type->memory()->limits());
+      auto type = wasm::MemoryType::make(import.limits);
       if (type == nullptr) {
         return false;
       }
@@ -398,9 +630,7 @@ bool V8::link(std::string_view /*debug_name*/) {
 
     case wasm::EXTERN_TABLE: {
       assert(table_ == nullptr);
-      auto type =
-          wasm::TableType::make(wasm::ValType::make(import_type->table()->element()->kind()),
-                                import_type->table()->limits());
+      auto type = wasm::TableType::make(wasm::ValType::make(import.element), import.limits);
       if (type == nullptr) {
         return false;
       }
@@ -413,49 +643,24 @@ bool V8::link(std::string_view /*debug_name*/) {
     }
   }
 
-  if (import_types.size() != imports.size()) {
-    return false;
-  }
-
   instance_ = wasm::Instance::make(store_.get(), module_.get(), imports.data());
   if (instance_ == nullptr) {
     fail(FailState::UnableToInitializeCode, "Failed to create new Wasm instance");
     return false;
   }
 
-  const auto export_types = module_.get()->exports();
   const auto exports = instance_.get()->exports();
-  assert(export_types.size() == exports.size());
-
-  for (size_t i = 0; i < export_types.size(); i++) {
-    std::string_view name(export_types[i]->name().get(), export_types[i]->name().size());
-    const auto *export_type = export_types[i]->type();
-    auto *export_item = exports[i].get();
-    assert(export_type->kind() == export_item->kind());
-
-    switch (export_type->kind()) {
-
-    case wasm::EXTERN_FUNC: {
-      assert(export_item->func() != nullptr);
-      module_functions_.insert_or_assign(std::string(name), export_item->func()->copy());
-    } break;
-
-    case wasm::EXTERN_GLOBAL: {
-      // TODO(PiotrSikora): add support when/if needed.
-    } break;
-
-    case wasm::EXTERN_MEMORY: {
-      assert(export_item->memory() != nullptr);
-      assert(memory_ == nullptr);
-      memory_ = exports[i]->memory()->copy();
-      if (memory_ == nullptr) {
-        return false;
-      }
-    } break;
-
-    case wasm::EXTERN_TABLE: {
-      // TODO(PiotrSikora): add support when/if needed.
-    } break;
+  module_functions_.resize(exports.size());
+  for (const auto &it : bindings_->functions) {
+    const auto index = it.second.index;
+    assert(exports[index]->func() != nullptr);
+    module_functions_[index] = exports[index]->func()->copy();
+  }
+  if (bindings_->memory.has_value()) {
+    assert(memory_ == nullptr);
+    memory_ = exports[bindings_->memory.value()]->memory()->copy();
+    if (memory_ == nullptr) {
+      return false;
     }
   }
 
@@ -476,6 +681,16 @@ std::optional<std::string_view> V8::getMemory(uint64_t pointer, uint64_t size) {
   return std::string_view(memory_->data() + pointer, size);
 }
 
+bool V8::growMemory(uint64_t size) {
+  assert(memory_ != nullptr);
+  if (size <= memory_->data_size()) {
+    return true;
+  }
+  auto delta = (size - memory_->data_size() + PROXY_WASM_HOST_WASM_MEMORY_PAGE_SIZE_BYTES - 1) /
+               PROXY_WASM_HOST_WASM_MEMORY_PAGE_SIZE_BYTES;
+  return memory_->grow(static_cast<wasm::Memory::pages_t>(delta));
+}
+
 bool V8::setMemory(uint64_t pointer, uint64_t size, const void *data) {
   assert(memory_ != nullptr);
   // Make sure we're operating in a wasm32 memory space.
@@ -525,90 +740,92 @@ wasm::own<wasm::Trap> V8::trap(std::string message) {
 template <typename... Args>
 void V8::registerHostFunctionImpl(std::string_view module_name, std::string_view function_name,
                                   void (*function)(Args...)) {
-  auto data =
-      std::make_unique<FuncData>(std::string(module_name) + "." + std::string(function_name));
-  auto type = wasm::FuncType::make(convertArgsTupleToValTypes<std::tuple<Args...>>(),
-                                   convertArgsTupleToValTypes<std::tuple<>>());
-  auto func = wasm::Func::make(
-      store_.get(), type.get(),
-      [](void *data, const wasm::Val params[], wasm::Val /*results*/[]) -> wasm::own<wasm::Trap> {
-        auto *func_data = reinterpret_cast<FuncData *>(data);
-        const bool log = func_data->vm_->cmpLogLevel(LogLevel::trace);
-        if (log) {
-          func_data->vm_->integration()->trace("[vm->host] " + func_data->name_ + "(" +
-                                               printValues(params, sizeof...(Args)) + ")");
-        }
-        if (!func_data->vm_->isHostFunctionAllowed(func_data->name_)) {
-          return dynamic_cast<V8 *>(func_data->vm_)->trap("restricted_callback");
-        }
-        auto args = convertValTypesToArgsTuple<std::tuple<Args...>>(params);
-        auto function = reinterpret_cast<void (*)(Args...)>(func_data->raw_func_);
-        std::apply(function, args);
-        if (log) {
-          func_data->vm_->integration()->trace("[vm<-host] " + func_data->name_ + " return: void");
-        }
-        return nullptr;
-      },
-      data.get());
+  auto name = std::string(module_name) + "." + std::string(function_name);
+  auto data = std::make_unique<FuncData>(name);
+  data->make_callback_ = [](wasm::Store *store, FuncData *env) -> wasm::own<wasm::Func> {
+    static const auto type =
+        wasm::FuncType::make(convertArgsTupleToValTypes<std::tuple<Args...>>(),
+                             convertArgsTupleToValTypes<std::tuple<>>());
+    return wasm::Func::make(
+        store, type.get(),
+        [](void *data, const wasm::Val params[], wasm::Val /*results*/[]) -> wasm::own<wasm::Trap> {
+          auto *func_data = reinterpret_cast<FuncData *>(data);
+          const bool log = func_data->vm_->cmpLogLevel(LogLevel::trace);
+          if (log) {
+            func_data->vm_->integration()->trace("[vm->host] " + func_data->name_ + "(" +
+                                                 printValues(params, sizeof...(Args)) + ")");
+          }
+          if (!func_data->vm_->isHostFunctionAllowed(func_data->name_)) {
+            return dynamic_cast<V8 *>(func_data->vm_)->trap("restricted_callback");
+          }
+          auto args = convertValTypesToArgsTuple<std::tuple<Args...>>(params);
+          auto function = reinterpret_cast<void (*)(Args...)>(func_data->raw_func_);
+          std::apply(function, args);
+          if (log) {
+            func_data->vm_->integration()->trace("[vm<-host] " + func_data->name_ +
+                                                 " return: void");
+          }
+          return nullptr;
+        },
+        env);
+  };
 
   data->vm_ = this;
-  data->callback_ = std::move(func);
   data->raw_func_ = reinterpret_cast<void *>(function);
-  host_functions_.insert_or_assign(std::string(module_name) + "." + std::string(function_name),
-                                   std::move(data));
+  host_functions_.insert_or_assign(std::move(name), std::move(data));
 }
 
 template <typename R, typename... Args>
 void V8::registerHostFunctionImpl(std::string_view module_name, std::string_view function_name,
                                   R (*function)(Args...)) {
-  auto data =
-      std::make_unique<FuncData>(std::string(module_name) + "." + std::string(function_name));
-  auto type = wasm::FuncType::make(convertArgsTupleToValTypes<std::tuple<Args...>>(),
-                                   convertArgsTupleToValTypes<std::tuple<R>>());
-  auto func = wasm::Func::make(
-      store_.get(), type.get(),
-      [](void *data, const wasm::Val params[], wasm::Val results[]) -> wasm::own<wasm::Trap> {
-        auto *func_data = reinterpret_cast<FuncData *>(data);
-        const bool log = func_data->vm_->cmpLogLevel(LogLevel::trace);
-        if (log) {
-          func_data->vm_->integration()->trace("[vm->host] " + func_data->name_ + "(" +
-                                               printValues(params, sizeof...(Args)) + ")");
-        }
-        if (!func_data->vm_->isHostFunctionAllowed(func_data->name_)) {
-          return dynamic_cast<V8 *>(func_data->vm_)->trap("restricted_callback");
-        }
-        auto args = convertValTypesToArgsTuple<std::tuple<Args...>>(params);
-        auto function = reinterpret_cast<R (*)(Args...)>(func_data->raw_func_);
-        R rvalue = std::apply(function, args);
-        results[0] = makeVal(rvalue);
-        if (log) {
-          func_data->vm_->integration()->trace("[vm<-host] " + func_data->name_ +
-                                               " return: " + std::to_string(rvalue));
-        }
-        return nullptr;
-      },
-      data.get());
+  auto name = std::string(module_name) + "." + std::string(function_name);
+  auto data = std::make_unique<FuncData>(name);
+  data->make_callback_ = [](wasm::Store *store, FuncData *env) -> wasm::own<wasm::Func> {
+    static const auto type =
+        wasm::FuncType::make(convertArgsTupleToValTypes<std::tuple<Args...>>(),
+                             convertArgsTupleToValTypes<std::tuple<R>>());
+    return wasm::Func::make(
+        store, type.get(),
+        [](void *data, const wasm::Val params[], wasm::Val results[]) -> wasm::own<wasm::Trap> {
+          auto *func_data = reinterpret_cast<FuncData *>(data);
+          const bool log = func_data->vm_->cmpLogLevel(LogLevel::trace);
+          if (log) {
+            func_data->vm_->integration()->trace("[vm->host] " + func_data->name_ + "(" +
+                                                 printValues(params, sizeof...(Args)) + ")");
+          }
+          if (!func_data->vm_->isHostFunctionAllowed(func_data->name_)) {
+            return dynamic_cast<V8 *>(func_data->vm_)->trap("restricted_callback");
+          }
+          auto args = convertValTypesToArgsTuple<std::tuple<Args...>>(params);
+          auto function = reinterpret_cast<R (*)(Args...)>(func_data->raw_func_);
+          R rvalue = std::apply(function, args);
+          results[0] = makeVal(rvalue);
+          if (log) {
+            func_data->vm_->integration()->trace("[vm<-host] " + func_data->name_ +
+                                                 " return: " + std::to_string(rvalue));
+          }
+          return nullptr;
+        },
+        env);
+  };
 
   data->vm_ = this;
-  data->callback_ = std::move(func);
   data->raw_func_ = reinterpret_cast<void *>(function);
-  host_functions_.insert_or_assign(std::string(module_name) + "." + std::string(function_name),
-                                   std::move(data));
+  host_functions_.insert_or_assign(std::move(name), std::move(data));
 }
 
 template <typename... Args>
 void V8::getModuleFunctionImpl(std::string_view function_name,
                                std::function<void(ContextBase *, Args...)> *function) {
-  auto it = module_functions_.find(std::string(function_name));
-  if (it == module_functions_.end()) {
+  const auto *binding = getModuleFunctionBinding(function_name);
+  if (binding == nullptr) {
     *function = nullptr;
     return;
   }
-  const wasm::Func *func = it->second.get();
-  auto arg_valtypes = convertArgsTupleToValTypes<std::tuple<Args...>>();
-  auto result_valtypes = convertArgsTupleToValTypes<std::tuple<>>();
-  if (!equalValTypes(func->type()->params(), arg_valtypes) ||
-      !equalValTypes(func->type()->results(), result_valtypes)) {
+  const wasm::Func *func = module_functions_[binding->index].get();
+  if (!equalValKinds<Args...>(binding->params) || !equalValKinds<>(binding->results)) {
+    auto arg_valtypes = convertArgsTupleToValTypes<std::tuple<Args...>>();
+    auto result_valtypes = convertArgsTupleToValTypes<std::tuple<>>();
     fail(FailState::UnableToInitializeCode,
          "Bad function signature for: " + std::string(function_name) +
              ", want: " + printValTypes(arg_valtypes) + " -> " + printValTypes(result_valtypes) +
@@ -620,6 +837,7 @@ void V8::getModuleFunctionImpl(std::string_view function_name,
   *function = [func, function_name, this](ContextBase *context, Args... args) -> void {
     const bool log = cmpLogLevel(LogLevel::trace);
     SaveRestoreContext saved_context(context);
+    ExecutionDeadline deadline(this);
     wasm::own<wasm::Trap> trap = nullptr;
 
     // Workaround for MSVC++ not supporting zero-sized arrays.
@@ -637,6 +855,12 @@ void V8::getModuleFunctionImpl(std::string_view function_name,
       trap = func->call(nullptr, nullptr);
     }
 
+    if (deadline.disarm()) {
+      cancelInterrupt();
+      fail(FailState::RuntimeError,
+           "Function: " + std::string(function_name) + " failed: execution timeout exceeded");
+      return;
+    }
     if (trap) {
       fail(FailState::RuntimeError, getFailMessage(std::string(function_name), std::move(trap)));
       return;
@@ -650,16 +874,15 @@ void V8::getModuleFunctionImpl(std::string_view function_name,
 template <typename R, typename... Args>
 void V8::getModuleFunctionImpl(std::string_view function_name,
                                std::function<R(ContextBase *, Args...)> *function) {
-  auto it = module_functions_.find(std::string(function_name));
-  if (it == module_functions_.end()) {
+  const auto *binding = getModuleFunctionBinding(function_name);
+  if (binding == nullptr) {
     *function = nullptr;
     return;
   }
-  const wasm::Func *func = it->second.get();
-  auto arg_valtypes = convertArgsTupleToValTypes<std::tuple<Args...>>();
-  auto result_valtypes = convertArgsTupleToValTypes<std::tuple<R>>();
-  if (!equalValTypes(func->type()->params(), arg_valtypes) ||
-      !equalValTypes(func->type()->results(), result_valtypes)) {
+  const wasm::Func *func = module_functions_[binding->index].get();
+  if (!equalValKinds<Args...>(binding->params) || !equalValKinds<R>(binding->results)) {
+    auto arg_valtypes = convertArgsTupleToValTypes<std::tuple<Args...>>();
+    auto result_valtypes = convertArgsTupleToValTypes<std::tuple<R>>();
     fail(FailState::UnableToInitializeCode,
          "Bad function signature for: " + std::string(function_name) +
              ", want: " + printValTypes(arg_valtypes) + " -> " + printValTypes(result_valtypes) +
@@ -671,6 +894,7 @@ void V8::getModuleFunctionImpl(std::string_view function_name,
   *function = [func, function_name, this](ContextBase *context, Args... args) -> R {
     const bool log = cmpLogLevel(LogLevel::trace);
     SaveRestoreContext saved_context(context);
+    ExecutionDeadline deadline(this);
     wasm::Val results[1];
     wasm::own<wasm::Trap> trap = nullptr;
 
@@ -689,6 +913,12 @@ void V8::getModuleFunctionImpl(std::string_view function_name,
       trap = func->call(nullptr, results);
     }
 
+    if (deadline.disarm()) {
+      cancelInterrupt();
+      fail(FailState::RuntimeError,
+           "Function: " + std::string(function_name) + " failed: execution timeout exceeded");
+      return R{};
+    }
     if (trap) {
       fail(FailState::RuntimeError, getFailMessage(std::string(function_name), std::move(trap)));
       return R{};
@@ -711,6 +941,18 @@ void V8::terminate() {
   }
 }
 
+bool V8::interrupt() {
+  auto *store_impl = reinterpret_cast<wasm::StoreImpl *>(store_.get());
+  // TerminateExecution() may be called from any thread.
+  store_impl->isolate()->TerminateExecution();
+  return true;
+}
+
+void V8::cancelInterrupt() {
+  auto *store_impl = reinterpret_cast<wasm::StoreImpl *>(store_.get());
+  store_impl->isolate()->CancelTerminateExecution();
+}
+
 std::string V8::getFailMessage(std::string_view function_name, wasm::own<wasm::Trap> trap) {
   auto message = "Function: " + std::string(function_name) + " failed: ";
   message += std::string(trap->message().get(), trap->message().size());
@@ -744,6 +986,15 @@ std::string V8::getFailMessage(std::string_view function_name, wasm::own<wasm::T
 
 } // namespace v8
 
+bool setV8CompilationMode(V8CompilationMode mode) {
+  std::lock_guard<std::mutex> guard(v8::compilation_mode_mutex);
+  if (v8::engine_initialized) {
+    return mode == v8::compilation_mode;
+  }
+  v8::compilation_mode = mode;
+  return true;
+}
+
 std::unique_ptr<WasmVm> createV8Vm() { return std::make_unique<v8::V8>(); }
 
 } // namespace proxy_wasm
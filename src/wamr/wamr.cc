@@ -14,6 +14,7 @@
 // limitations under the License.
 
 #include "include/proxy-wasm/wamr.h"
+#include "include/proxy-wasm/limits.h"
 #include "include/proxy-wasm/wasm_vm.h"
 
 #include <array>
@@ -21,7 +22,9 @@
 #include <cstring>
 #include <iomanip>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
 #include <string_view>
@@ -31,6 +34,7 @@
 
 #include "src/wamr/types.h"
 #include "wasm_c_api.h"
+#include "wasm_export.h"
 
 namespace proxy_wasm {
 namespace wamr {
@@ -51,22 +55,69 @@ wasm_engine_t *engine() {
   return engine.get();
 }
 
+RunningMode toRunningMode(WamrRunningMode mode) {
+  switch (mode) {
+  case WamrRunningMode::Default:
+    return Mode_Default;
+  case WamrRunningMode::Interpreter:
+    return Mode_Interp;
+  case WamrRunningMode::FastJit:
+    return Mode_Fast_JIT;
+  case WamrRunningMode::LlvmJit:
+    return Mode_LLVM_JIT;
+  }
+  return Mode_Default;
+}
+
+// WAMR only has a process-wide default running mode, which is applied to instances when they are
+// created (the per-instance mode can't be set through the Wasm C API). Instances in the current
+// default mode are created concurrently, holding the lock shared, while changing the default mode
+// requires holding it exclusively.
+std::shared_mutex running_mode_mutex;
+RunningMode default_running_mode = Mode_Default; // Guarded by `running_mode_mutex`.
+
+#if defined(__linux__) && defined(__x86_64__)
+#define WAMR_AOT_PLATFORM "linux_x86_64"
+#elif defined(__linux__) && defined(__aarch64__)
+#define WAMR_AOT_PLATFORM "linux_aarch64"
+#else
+#define WAMR_AOT_PLATFORM ""
+#endif
+
+class WamrSharedModule : public SharedModule {
+public:
+  explicit WamrSharedModule(WasmSharedModulePtr module) : module_(std::move(module)) {}
+
+  const wasm_shared_module_t *get() const { return module_.get(); }
+
+private:
+  WasmSharedModulePtr module_;
+};
+
 class Wamr : public WasmVm {
 public:
-  Wamr() = default;
+  explicit Wamr(WamrRunningMode running_mode) : running_mode_(running_mode) {}
 
   std::string_view getEngineName() override { return "wamr"; }
-  std::string_view getPrecompiledSectionName() override { return ""; }
+  // Modules precompiled with wamrc for this platform.
+  std::string_view getPrecompiledSectionName() override;
+  // WAMR can't precompile modules itself, but the compiled module cache can supply modules
+  // precompiled with wamrc.
+  std::string_view getCompiledModuleVersion() override { return getPrecompiledSectionName(); }
 
   Cloneable cloneable() override { return Cloneable::CompiledBytecode; }
   std::unique_ptr<WasmVm> clone() override;
 
   bool load(std::string_view bytecode, std::string_view precompiled,
             const std::unordered_map<uint32_t, std::string> &function_names) override;
+  SharedModulePtr getSharedModule() override;
+  bool loadSharedModule(const SharedModulePtr &shared_module,
+                        const std::unordered_map<uint32_t, std::string> &function_names) override;
   bool link(std::string_view debug_name) override;
   uint64_t getMemorySize() override;
   std::optional<std::string_view> getMemory(uint64_t pointer, uint64_t size) override;
   bool setMemory(uint64_t pointer, uint64_t size, const void *data) override;
+  bool growMemory(uint64_t size) override;
   bool getWord(uint64_t pointer, Word *word) override;
   bool setWord(uint64_t pointer, Word word) override;
   size_t getWordSize() override { return sizeof(uint32_t); };
@@ -87,6 +138,9 @@ public:
 #undef _GET_MODULE_FUNCTION
 
   void terminate() override {}
+  // WAMR's wasm-c-api doesn't expose the module instance needed by wasm_runtime_terminate(), so
+  // calls exceeding their deadline are only stopped at their next host function call.
+  bool supportsInterrupt() override { return false; }
   bool usesWasmByteOrder() override { return true; }
 
 private:
@@ -106,6 +160,11 @@ private:
   void getModuleFunctionImpl(std::string_view function_name,
                              std::function<R(ContextBase *, Args...)> *function);
 
+  // Trap returned by host functions to stop the call into the VM.
+  wasm_trap_t *newTrap(std::string_view message);
+
+  const WamrRunningMode running_mode_;
+
   WasmStorePtr store_;
   WasmModulePtr module_;
   WasmSharedModulePtr shared_module_;
@@ -118,19 +177,74 @@ private:
   std::unordered_map<std::string, WasmFuncPtr> module_functions_;
 };
 
-bool Wamr::load(std::string_view bytecode, std::string_view /*precompiled*/,
+std::string_view Wamr::getPrecompiledSectionName() {
+  static const auto name =
+      sizeof(WAMR_AOT_PLATFORM) - 1 > 0 ? std::string("precompiled_wamr_aot_") + WAMR_AOT_PLATFORM
+                                        : "";
+  return name;
+}
+
+static WasmModulePtr newModule(wasm_store_t *store, std::string_view binary) {
+  wasm_byte_vec_t vec = {.size = binary.size(),
+                         .data = (char *)binary.data(),
+                         .num_elems = binary.size(),
+                         .size_of_elem = sizeof(byte_t),
+                         .lock = nullptr};
+  return wasm_module_new(store, &vec);
+}
+
+bool Wamr::load(std::string_view bytecode, std::string_view precompiled,
                 const std::unordered_map<uint32_t, std::string> & /*function_names*/) {
   store_ = wasm_store_new(engine());
   if (store_ == nullptr) {
     return false;
   }
 
-  wasm_byte_vec_t binary = {.size = bytecode.size(),
-                            .data = (char *)bytecode.data(),
-                            .num_elems = bytecode.size(),
-                            .size_of_elem = sizeof(byte_t),
-                            .lock = nullptr};
-  module_ = wasm_module_new(store_.get(), &binary);
+  // wasm_module_new() accepts both bytecode and AOT modules. AOT modules are rejected when WAMR
+  // was built without AOT support or when they were compiled by another version of wamrc, in
+  // which case the bytecode is used instead.
+  if (!precompiled.empty()) {
+    module_ = newModule(store_.get(), precompiled);
+    if (module_ == nullptr) {
+      integration()->trace("Failed to load the WAMR AOT module, using the bytecode instead");
+    }
+  }
+  if (module_ == nullptr) {
+    module_ = newModule(store_.get(), bytecode);
+  }
+  if (module_ == nullptr) {
+    return false;
+  }
+
+  shared_module_ = wasm_module_share(module_.get());
+  if (shared_module_ == nullptr) {
+    return false;
+  }
+
+  return true;
+}
+
+SharedModulePtr Wamr::getSharedModule() {
+  if (module_ == nullptr) {
+    return nullptr;
+  }
+  auto shared_module = WasmSharedModulePtr(wasm_module_share(module_.get()));
+  if (shared_module == nullptr) {
+    return nullptr;
+  }
+  return std::make_shared<WamrSharedModule>(std::move(shared_module));
+}
+
+bool Wamr::loadSharedModule(
+    const SharedModulePtr &shared_module,
+    const std::unordered_map<uint32_t, std::string> & /*function_names*/) {
+  store_ = wasm_store_new(engine());
+  if (store_ == nullptr) {
+    return false;
+  }
+
+  module_ = wasm_module_obtain(store_.get(),
+                               static_cast<const WamrSharedModule *>(shared_module.get())->get());
   if (module_ == nullptr) {
     return false;
   }
@@ -146,7 +260,7 @@ bool Wamr::load(std::string_view bytecode, std::string_view /*precompiled*/,
 std::unique_ptr<WasmVm> Wamr::clone() {
   assert(module_ != nullptr);
 
-  auto vm = std::make_unique<Wamr>();
+  auto vm = std::make_unique<Wamr>(running_mode_);
   if (vm == nullptr) {
     return nullptr;
   }
@@ -339,7 +453,27 @@ bool Wamr::link(std::string_view /*debug_name*/) {
   }
 
   wasm_extern_vec_t imports_vec = {imports.size(), imports.data(), imports.size()};
-  instance_ = wasm_instance_new(store_.get(), module_.get(), &imports_vec, nullptr);
+  const auto running_mode = toRunningMode(running_mode_);
+  bool instantiated = false;
+  {
+    std::shared_lock<std::shared_mutex> shared_lock(running_mode_mutex);
+    if (running_mode == default_running_mode) {
+      instance_ = wasm_instance_new(store_.get(), module_.get(), &imports_vec, nullptr);
+      instantiated = true;
+    }
+  }
+  if (!instantiated) {
+    std::unique_lock<std::shared_mutex> lock(running_mode_mutex);
+    if (running_mode != default_running_mode) {
+      if (!wasm_runtime_set_default_running_mode(running_mode)) {
+        fail(FailState::UnableToInitializeCode,
+             "WAMR was built without the requested running mode");
+        return false;
+      }
+      default_running_mode = running_mode;
+    }
+    instance_ = wasm_instance_new(store_.get(), module_.get(), &imports_vec, nullptr);
+  }
   if (instance_ == nullptr) {
     fail(FailState::UnableToInitializeCode, "Failed to create new Wasm instance");
     return false;
@@ -390,6 +524,17 @@ std::optional<std::string_view> Wamr::getMemory(uint64_t pointer, uint64_t size)
   return std::string_view(wasm_memory_data(memory_.get()) + pointer, size);
 }
 
+bool Wamr::growMemory(uint64_t size) {
+  assert(memory_ != nullptr);
+  auto current_size = wasm_memory_data_size(memory_.get());
+  if (size <= current_size) {
+    return true;
+  }
+  auto delta = (size - current_size + PROXY_WASM_HOST_WASM_MEMORY_PAGE_SIZE_BYTES - 1) /
+               PROXY_WASM_HOST_WASM_MEMORY_PAGE_SIZE_BYTES;
+  return wasm_memory_grow(memory_.get(), static_cast<wasm_memory_pages_t>(delta));
+}
+
 bool Wamr::setMemory(uint64_t pointer, uint64_t size, const void *data) {
   assert(memory_ != nullptr);
   if (pointer + size > wasm_memory_data_size(memory_.get())) {
@@ -508,6 +653,14 @@ template <typename T> WasmFunctypePtr newWasmNewFuncType() {
   return wasm_functype_new(&params, &results);
 }
 
+wasm_trap_t *Wamr::newTrap(std::string_view message) {
+  // Trap messages are read as NULL-terminated strings.
+  std::string data(message);
+  WasmByteVec vec;
+  wasm_byte_vec_new(vec.get(), data.size() + 1, data.c_str());
+  return wasm_trap_new(store_.get(), vec.get());
+}
+
 template <typename... Args>
 void Wamr::registerHostFunctionImpl(std::string_view module_name, std::string_view function_name,
                                     void (*function)(Args...)) {
@@ -524,6 +677,9 @@ void Wamr::registerHostFunctionImpl(std::string_view module_name, std::string_vi
           func_data->vm_->integration()->trace("[vm->host] " + func_data->name_ + "(" +
                                                printValues(params) + ")");
         }
+        if (ExecutionDeadline::exceeded()) {
+          return static_cast<Wamr *>(func_data->vm_)->newTrap("execution timeout exceeded");
+        }
         auto args = convertValTypesToArgsTuple<std::tuple<Args...>>(
             params, std::make_index_sequence<sizeof...(Args)>{});
         auto fn = reinterpret_cast<void (*)(Args...)>(func_data->raw_func_);
@@ -557,6 +713,9 @@ void Wamr::registerHostFunctionImpl(std::string_view module_name, std::string_vi
           func_data->vm_->integration()->trace("[vm->host] " + func_data->name_ + "(" +
                                                printValues(params) + ")");
         }
+        if (ExecutionDeadline::exceeded()) {
+          return static_cast<Wamr *>(func_data->vm_)->newTrap("execution timeout exceeded");
+        }
         auto args = convertValTypesToArgsTuple<std::tuple<Args...>>(
             params, std::make_index_sequence<sizeof...(Args)>{});
         auto fn = reinterpret_cast<R (*)(Args...)>(func_data->raw_func_);
@@ -614,7 +773,13 @@ void Wamr::getModuleFunctionImpl(std::string_view function_name,
                            ")");
     }
     SaveRestoreContext saved_context(context);
+    ExecutionDeadline deadline(this);
     WasmTrapPtr trap{wasm_func_call(func, &params, &results)};
+    if (deadline.disarm()) {
+      fail(FailState::RuntimeError,
+           "Function: " + std::string(function_name) + " failed: execution timeout exceeded");
+      return;
+    }
     if (trap) {
       WasmByteVec error_message;
       wasm_trap_message(trap.get(), error_message.get());
@@ -664,7 +829,13 @@ void Wamr::getModuleFunctionImpl(std::string_view function_name,
                            ")");
     }
     SaveRestoreContext saved_context(context);
+    ExecutionDeadline deadline(this);
     WasmTrapPtr trap{wasm_func_call(func, &params, &results)};
+    if (deadline.disarm()) {
+      fail(FailState::RuntimeError,
+           "Function: " + std::string(function_name) + " failed: execution timeout exceeded");
+      return R{};
+    }
     if (trap) {
       WasmByteVec error_message;
       wasm_trap_message(trap.get(), error_message.get());
@@ -684,6 +855,15 @@ void Wamr::getModuleFunctionImpl(std::string_view function_name,
 
 } // namespace wamr
 
-std::unique_ptr<WasmVm> createWamrVm() { return std::make_unique<wamr::Wamr>(); }
+bool isWamrRunningModeSupported(WamrRunningMode mode) {
+  wamr::engine(); // Initializes the runtime.
+  return wasm_runtime_is_running_mode_supported(wamr::toRunningMode(mode));
+}
+
+std::unique_ptr<WasmVm> createWamrVm() { return createWamrVm(WamrRunningMode::Default); }
+
+std::unique_ptr<WasmVm> createWamrVm(WamrRunningMode mode) {
+  return std::make_unique<wamr::Wamr>(mode);
+}
 
 } // namespace proxy_wasm
@@ -20,21 +20,41 @@
 
 #include <algorithm>
 #include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <future>
 #include <limits>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <queue>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 
 #include "include/proxy-wasm/bytecode_util.h"
+#include "include/proxy-wasm/compiled_module_cache.h"
+#include "include/proxy-wasm/limits.h"
 #include "include/proxy-wasm/signature_util.h"
 #include "include/proxy-wasm/vm_id_handle.h"
 #include "src/hash.h"
 
 namespace proxy_wasm {
 
+// Results of parsing the bytecode in WasmBase::load(), shared by base Wasm instances loading the
+// same code (e.g. with different vm_ids), so that it's only parsed once.
+struct ParsedModule {
+  WasmBytecodePtr bytecode;
+  ModuleIndex index; // Points into 'bytecode'.
+  WasmBytecodePtr stripped;
+  AbiVersion abi_version = AbiVersion::Unknown;
+  std::unordered_map<uint32_t, std::string> function_names;
+  std::string signature_message;
+  // Whether the linear memory holds all of the state of the module once it's started.
+  bool memory_snapshot_safe = false;
+};
+
 namespace {
 
 // Map from Wasm key to the thread-local Wasm instance.
@@ -47,6 +67,25 @@ thread_local std::unordered_map<std::string, std::weak_ptr<PluginHandleBase>> lo
 // Plugin key queue to track stale entries in `local_plugins`.
 thread_local std::queue<std::string> local_plugins_keys;
 
+// VM created by the last successful canary on this thread, already started and configured for
+// `plugin_key`, with its timers paused. It's handed off as the thread-local VM if the next
+// getOrCreateThreadLocalPlugin() call on this thread is for the same base VM, and discarded
+// otherwise, so that it doesn't keep a VM (and its base VM) alive. Engine instances may be bound to
+// the thread which created them, so it can't be handed off to another thread.
+struct CanaryWasm {
+  std::weak_ptr<WasmHandleBase> base_handle;
+  std::string plugin_key;
+  std::shared_ptr<WasmHandleBase> wasm_handle;
+};
+thread_local CanaryWasm parked_canary_wasm;
+// Set on the createWasmAsync() pool threads, which never create thread-local VMs, so canary VMs
+// created there are discarded instead of being parked.
+thread_local bool on_create_wasm_pool = false;
+
+// Map from swap key to the plugin made active on this thread by swapThreadLocalPlugins(). Unlike
+// the caches above, it owns the handles.
+thread_local std::unordered_map<std::string, std::shared_ptr<PluginHandleBase>> active_plugins;
+
 // Check no more than `MAX_LOCAL_CACHE_GC_CHUNK_SIZE` cache entries at a time during stale entries
 // cleanup.
 const size_t MAX_LOCAL_CACHE_GC_CHUNK_SIZE = 64;
@@ -54,6 +93,266 @@ const size_t MAX_LOCAL_CACHE_GC_CHUNK_SIZE = 64;
 // Map from Wasm Key to the base Wasm instance, using a pointer to avoid the initialization fiasco.
 std::mutex base_wasms_mutex;
 std::unordered_map<std::string, std::weak_ptr<WasmHandleBase>> *base_wasms = nullptr;
+// Map from Wasm Key to the base Wasm instance being created (guarded by `base_wasms_mutex`).
+// Concurrent createWasm() calls for the same key wait for it instead of creating another instance.
+std::unordered_map<std::string, std::shared_future<std::shared_ptr<WasmHandleBase>>>
+    *pending_base_wasms = nullptr;
+
+// Bounded pool of threads used by createWasmAsync(). Threads are started on demand, up to
+// `max_threads`, and are never stopped, so the pool is intentionally leaked.
+class CreateWasmThreadPool {
+public:
+  explicit CreateWasmThreadPool(size_t max_threads) : max_threads_(max_threads) {}
+
+  void post(std::function<void()> task) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    tasks_.push_back(std::move(task));
+    if (idle_threads_ == 0 && num_threads_ < max_threads_) {
+      num_threads_++;
+      std::thread([this] { run(); }).detach();
+    } else {
+      cv_.notify_one();
+    }
+  }
+
+private:
+  void run() {
+    on_create_wasm_pool = true;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      idle_threads_++;
+      cv_.wait(lock, [this] { return !tasks_.empty(); });
+      idle_threads_--;
+      auto task = std::move(tasks_.front());
+      tasks_.pop_front();
+      lock.unlock();
+      task();
+      lock.lock();
+    }
+  }
+
+  const size_t max_threads_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  size_t num_threads_ = 0;
+  size_t idle_threads_ = 0;
+};
+
+CreateWasmThreadPool &getCreateWasmThreadPool() {
+  static auto *pool = new CreateWasmThreadPool(std::max<size_t>(
+      1, std::min<size_t>(PROXY_WASM_HOST_MAX_CREATE_WASM_THREADS,
+                          std::thread::hardware_concurrency())));
+  return *pool;
+}
+
+void dropCanaryWasm() {
+  if (parked_canary_wasm.wasm_handle) {
+    parked_canary_wasm.wasm_handle->kill();
+  }
+  parked_canary_wasm = CanaryWasm{};
+}
+
+// Drop the parked canary VM unless it was created for 'vm_key'. It's dropped regardless once it's
+// the last reference to its base VM.
+void dropCanaryWasmUnlessFor(std::string_view vm_key) {
+  if (!parked_canary_wasm.wasm_handle) {
+    return;
+  }
+  if (parked_canary_wasm.base_handle.use_count() <= 1 ||
+      parked_canary_wasm.wasm_handle->wasm()->vm_key() != vm_key) {
+    dropCanaryWasm();
+  }
+}
+
+void cacheCanaryWasm(const std::shared_ptr<WasmHandleBase> &base_handle,
+                     const std::string &plugin_key, std::shared_ptr<WasmHandleBase> wasm_handle) {
+  dropCanaryWasm();
+  if (on_create_wasm_pool) {
+    wasm_handle->kill();
+    return;
+  }
+  wasm_handle->wasm()->pauseTimers();
+  parked_canary_wasm = CanaryWasm{base_handle, plugin_key, std::move(wasm_handle)};
+}
+
+std::shared_ptr<WasmHandleBase> takeCanaryWasm(const std::shared_ptr<WasmHandleBase> &base_handle,
+                                               std::string *plugin_key) {
+  if (!parked_canary_wasm.wasm_handle) {
+    return nullptr;
+  }
+  auto canary = std::move(parked_canary_wasm);
+  parked_canary_wasm = CanaryWasm{};
+  if (canary.base_handle.lock() != base_handle || canary.wasm_handle->wasm()->isFailed()) {
+    canary.wasm_handle->kill();
+    return nullptr;
+  }
+  canary.wasm_handle->wasm()->resumeTimers();
+  *plugin_key = std::move(canary.plugin_key);
+  return std::move(canary.wasm_handle);
+}
+
+// Map from engine + hash of the bytecode to the module compiled by a base Wasm instance,
+// using a pointer to avoid the initialization fiasco. Modules are owned by the base Wasm instances
+// using them, so entries expire once the last one is destroyed.
+std::mutex shared_modules_mutex;
+std::unordered_map<std::string, std::weak_ptr<SharedModule>> *shared_modules = nullptr;
+
+SharedModulePtr getSharedModule(const std::string &key) {
+  std::lock_guard<std::mutex> guard(shared_modules_mutex);
+  if (shared_modules == nullptr) {
+    return nullptr;
+  }
+  auto it = shared_modules->find(key);
+  if (it == shared_modules->end()) {
+    return nullptr;
+  }
+  auto shared_module = it->second.lock();
+  if (!shared_module) {
+    shared_modules->erase(it);
+  }
+  return shared_module;
+}
+
+void putSharedModule(const std::string &key, const SharedModulePtr &shared_module) {
+  std::lock_guard<std::mutex> guard(shared_modules_mutex);
+  if (shared_modules == nullptr) {
+    shared_modules = new std::remove_reference<decltype(*shared_modules)>::type;
+  }
+  for (auto it = shared_modules->begin(); it != shared_modules->end();) {
+    if (it->second.expired()) {
+      it = shared_modules->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  (*shared_modules)[key] = shared_module;
+}
+
+// Map from the hash of the bytecode to the results of parsing it in WasmBase::load(), using a
+// pointer to avoid the initialization fiasco. Parsed modules are owned by the base Wasm instances
+// which loaded them, so entries expire once the last one is destroyed.
+std::mutex parsed_modules_mutex;
+std::unordered_map<std::string, std::weak_ptr<const ParsedModule>> *parsed_modules = nullptr;
+
+// Returns nullptr and sets 'message' on failure.
+std::shared_ptr<const ParsedModule> parseModule(const WasmBytecodePtr &bytecode,
+                                                std::string &message) {
+  auto parsed_module = std::make_shared<ParsedModule>();
+  parsed_module->bytecode = bytecode;
+  auto &index = parsed_module->index;
+  if (!BytecodeUtil::getModuleIndex(*bytecode, index)) {
+    message = "Failed to parse corrupted Wasm module";
+    return nullptr;
+  }
+
+  // Verify signature.
+  if (!SignatureUtil::verifySignature(index, parsed_module->signature_message)) {
+    message = parsed_module->signature_message;
+    return nullptr;
+  }
+
+  // Get ABI version from the module.
+  BytecodeUtil::getAbiVersion(index, parsed_module->abi_version);
+  if (parsed_module->abi_version == AbiVersion::Unknown) {
+    message = "Missing or unknown Proxy-Wasm ABI version";
+    return nullptr;
+  }
+
+  // Get function names from the module.
+  if (!BytecodeUtil::getFunctionNameIndex(index, parsed_module->function_names)) {
+    message = "Failed to parse corrupted Wasm module";
+    return nullptr;
+  }
+
+  // The stack pointer is the only mutable global which is restored when _initialize/main return.
+  std::vector<std::string_view> mutable_globals;
+  parsed_module->memory_snapshot_safe =
+      BytecodeUtil::getMutableGlobals(index, mutable_globals) &&
+      std::all_of(mutable_globals.begin(), mutable_globals.end(),
+                  [](std::string_view name) { return name == "__stack_pointer"; });
+
+  BytecodeUtil::getStrippedSource(bytecode, index, parsed_module->stripped);
+  return parsed_module;
+}
+
+std::shared_ptr<const ParsedModule> getParsedModule(const std::string &key) {
+  std::lock_guard<std::mutex> guard(parsed_modules_mutex);
+  if (parsed_modules == nullptr) {
+    return nullptr;
+  }
+  auto it = parsed_modules->find(key);
+  if (it == parsed_modules->end()) {
+    return nullptr;
+  }
+  auto parsed_module = it->second.lock();
+  if (!parsed_module) {
+    parsed_modules->erase(it);
+  }
+  return parsed_module;
+}
+
+void putParsedModule(const std::string &key,
+                     const std::shared_ptr<const ParsedModule> &parsed_module) {
+  std::lock_guard<std::mutex> guard(parsed_modules_mutex);
+  if (parsed_modules == nullptr) {
+    parsed_modules = new std::remove_reference<decltype(*parsed_modules)>::type;
+  }
+  for (auto it = parsed_modules->begin(); it != parsed_modules->end();) {
+    if (it->second.expired()) {
+      it = parsed_modules->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  (*parsed_modules)[key] = parsed_module;
+}
+
+// Map from code buffers to the hashes of their contents, so that each buffer is hashed only once,
+// however many times its vm_key is computed or it is loaded, using a pointer to avoid the
+// initialization fiasco. Entries expire with their buffers.
+struct CodeHash {
+  std::weak_ptr<const std::string_view> code;
+  std::string hash;
+};
+std::mutex code_hashes_mutex;
+std::unordered_map<const std::string_view *, CodeHash> *code_hashes = nullptr;
+
+void putCodeHash(const WasmBytecodePtr &code, const std::string &hash);
+
+std::string getCodeHash(const WasmBytecodePtr &code) {
+  {
+    std::lock_guard<std::mutex> guard(code_hashes_mutex);
+    if (code_hashes != nullptr) {
+      auto it = code_hashes->find(code.get());
+      // Check that the entry is for this buffer, and not for one previously at the same address.
+      if (it != code_hashes->end() && !it->second.code.owner_before(code) &&
+          !code.owner_before(it->second.code)) {
+        return it->second.hash;
+      }
+    }
+  }
+
+  // Hash without holding the lock, since it can take a while for large modules.
+  auto hash = Sha256String({*code});
+  putCodeHash(code, hash);
+  return hash;
+}
+
+void putCodeHash(const WasmBytecodePtr &code, const std::string &hash) {
+  std::lock_guard<std::mutex> guard(code_hashes_mutex);
+  if (code_hashes == nullptr) {
+    code_hashes = new std::remove_reference<decltype(*code_hashes)>::type;
+  }
+  for (auto it = code_hashes->begin(); it != code_hashes->end();) {
+    if (it->second.code.expired()) {
+      it = code_hashes->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  (*code_hashes)[code.get()] = CodeHash{code, hash};
+}
 
 void cacheLocalWasm(const std::string &key, const std::shared_ptr<WasmHandleBase> &wasm_handle) {
   local_wasms[key] = wasm_handle;
@@ -89,9 +388,59 @@ void removeStaleLocalCacheEntries(std::unordered_map<std::string, std::weak_ptr<
 
 } // namespace
 
+WasmBytecodeStream::WasmBytecodeStream(size_t expected_size)
+    : hasher_(std::make_unique<Sha256Hasher>()) {
+  bytecode_.reserve(expected_size);
+}
+
+WasmBytecodeStream::~WasmBytecodeStream() = default;
+
+bool WasmBytecodeStream::append(std::string_view chunk) {
+  if (failed_) {
+    return false;
+  }
+  hasher_->update(chunk);
+  bytecode_.append(chunk);
+  if (next_section_ == 8 && !BytecodeUtil::checkWasmHeader(bytecode_)) {
+    failed_ = true;
+    return false;
+  }
+  // Validate the sections which have been completely received.
+  while (next_section_ < bytecode_.size()) {
+    ModuleIndex index;
+    size_t section_size = 0;
+    if (!BytecodeUtil::parseSection(std::string_view(bytecode_).substr(next_section_), index,
+                                    section_size)) {
+      failed_ = true;
+      return false;
+    }
+    if (section_size == 0) {
+      break;
+    }
+    next_section_ += section_size;
+  }
+  return true;
+}
+
+WasmBytecodePtr WasmBytecodeStream::finish() {
+  if (failed_ || next_section_ != bytecode_.size()) {
+    failed_ = true;
+    return nullptr;
+  }
+  failed_ = true;
+  auto code = BytecodeUtil::makeBytecode(std::move(bytecode_));
+  putCodeHash(code, hasher_->finish());
+  return code;
+}
+
 std::string makeVmKey(std::string_view vm_id, std::string_view vm_configuration,
                       std::string_view code) {
-  return Sha256String({vm_id, "||", vm_configuration, "||", code});
+  return Sha256String({vm_id, "||", vm_configuration, "||", Sha256String({code})});
+}
+
+std::string makeVmKey(std::string_view vm_id, std::string_view vm_configuration,
+                      const WasmBytecodePtr &code) {
+  return Sha256String({vm_id, "||", vm_configuration, "||", getCodeHash(code)});
 }
 
 class WasmBase::ShutdownHandle {
@@ -221,6 +570,7 @@ WasmBase::WasmBase(const std::shared_ptr<WasmHandleBase> &base_wasm_handle,
   if (!wasm_vm_) {
     failed_ = FailState::UnableToCreateVm;
   } else {
+    wasm_vm_->setExecutionTimeout(base_wasm_handle->wasm()->wasm_vm()->executionTimeout());
     wasm_vm_->addFailCallback([this](FailState fail_state) { failed_ = fail_state; });
   }
 }
@@ -246,12 +596,17 @@ WasmBase::~WasmBase() {
 }
 
 bool WasmBase::load(const std::string &code, bool allow_precompiled) {
+  return load(BytecodeUtil::makeBytecode(code), allow_precompiled);
+}
+
+bool WasmBase::load(const WasmBytecodePtr &bytecode, bool allow_precompiled) {
   assert(!started_from_.has_value());
 
   if (!wasm_vm_) {
     return false;
   }
 
+  const std::string_view code = *bytecode;
   if (wasm_vm_->getEngineName() == "null") {
     auto ok = wasm_vm_->load(code, {}, {});
     if (!ok) {
@@ -262,31 +617,23 @@ bool WasmBase::load(const std::string &code, bool allow_precompiled) {
     return true;
   }
 
-  // Verify signature.
-  std::string message;
-  if (!SignatureUtil::verifySignature(code, message)) {
-    fail(FailState::UnableToInitializeCode, message);
-    return false;
-  }
-  if (!message.empty()) {
-    wasm_vm_->integration()->trace(message);
-  }
-
-  // Get ABI version from the module.
-  if (!BytecodeUtil::getAbiVersion(code, abi_version_)) {
-    fail(FailState::UnableToInitializeCode, "Failed to parse corrupted Wasm module");
-    return false;
-  }
-  if (abi_version_ == AbiVersion::Unknown) {
-    fail(FailState::UnableToInitializeCode, "Missing or unknown Proxy-Wasm ABI version");
-    return false;
+  // Parse the module, unless another base VM has already loaded the same code.
+  const auto code_hash = getCodeHash(bytecode);
+  parsed_module_ = getParsedModule(code_hash);
+  if (!parsed_module_) {
+    std::string message;
+    parsed_module_ = parseModule(bytecode, message);
+    if (!parsed_module_) {
+      fail(FailState::UnableToInitializeCode, message);
+      return false;
+    }
+    putParsedModule(code_hash, parsed_module_);
   }
-
-  // Get function names from the module.
-  if (!BytecodeUtil::getFunctionNameIndex(code, function_names_)) {
-    fail(FailState::UnableToInitializeCode, "Failed to parse corrupted Wasm module");
-    return false;
+  if (!parsed_module_->signature_message.empty()) {
+    wasm_vm_->integration()->trace(parsed_module_->signature_message);
   }
+  abi_version_ = parsed_module_->abi_version;
+  function_names_ = parsed_module_->function_names;
 
   std::string_view precompiled = {};
 
@@ -294,35 +641,90 @@ bool WasmBase::load(const std::string &code, bool allow_precompiled) {
     // Check if precompiled module exists.
     const auto section_name = wasm_vm_->getPrecompiledSectionName();
     if (!section_name.empty()) {
-      if (!BytecodeUtil::getCustomSection(code, section_name, precompiled)) {
-        fail(FailState::UnableToInitializeCode, "Failed to parse corrupted Wasm module");
-        return false;
-      }
+      BytecodeUtil::getCustomSection(parsed_module_->index, section_name, precompiled);
     }
   }
 
   // Get original bytecode (possibly stripped).
-  std::string stripped;
-  if (!BytecodeUtil::getStrippedSource(code, stripped)) {
-    fail(FailState::UnableToInitializeCode, "Failed to parse corrupted Wasm module");
-    return false;
+  const auto &stripped = parsed_module_->stripped;
+
+  auto cache = getCompiledModuleCache();
+  const auto compiled_module_version = wasm_vm_->getCompiledModuleVersion();
+  if (cache && precompiled.empty() && !compiled_module_version.empty() && !vm_key_.empty()) {
+    compiled_module_cache_key_ = Sha256String(
+        {wasm_vm_->getEngineName(), "||", compiled_module_version, "||", vm_key_});
   }
 
-  auto ok = wasm_vm_->load(stripped, precompiled, function_names_);
+  // Use the module compiled by another base VM for the same bytecode, if any.
+  const auto shared_module_key = std::string(wasm_vm_->getEngineName()) + "||" + code_hash;
+  shared_module_ = getSharedModule(shared_module_key);
+  if (shared_module_ && wasm_vm_->loadSharedModule(shared_module_, function_names_)) {
+    return true;
+  }
+  shared_module_.reset();
+
+  // Use the compiled module from the previous run, if any.
+  const auto &cache_key = compiled_module_cache_key_;
+  CompiledModulePtr cached;
+  if (!cache_key.empty()) {
+    cached = cache->get(cache_key);
+    if (cached) {
+      precompiled = *cached;
+    }
+  }
+
+  auto ok = wasm_vm_->load(*stripped, precompiled, function_names_);
+  if (!ok && cached) {
+    // The cached module is stale or corrupted, compile the bytecode instead.
+    wasm_vm_->integration()->trace("Failed to load cached compiled module, recompiling");
+    precompiled = {};
+    cached.reset();
+    ok = wasm_vm_->load(*stripped, precompiled, function_names_);
+  }
   if (!ok) {
     fail(FailState::UnableToInitializeCode, "Failed to load Wasm bytecode");
     return false;
   }
 
+  if (!cache_key.empty() && !cached) {
+    auto compiled_module = wasm_vm_->getCompiledModule();
+    if (!compiled_module.empty()) {
+      cache->put(cache_key, compiled_module);
+    }
+  }
+
+  shared_module_ = wasm_vm_->getSharedModule();
+  if (shared_module_) {
+    putSharedModule(shared_module_key, shared_module_);
+  }
+
   // Store for future use in non-cloneable Wasm engines.
   if (wasm_vm_->cloneable() == Cloneable::NotCloneable) {
     module_bytecode_ = stripped;
     module_precompiled_ = precompiled;
+    if (cached) {
+      module_precompiled_storage_ = std::move(cached);
+    } else if (!precompiled.empty()) {
+      module_precompiled_storage_ = parsed_module_->bytecode;
+    }
   }
 
   return true;
 }
 
+bool WasmBase::updateCompiledModuleCache() {
+  auto cache = getCompiledModuleCache();
+  if (!cache || compiled_module_cache_key_.empty() || !wasm_vm_) {
+    return false;
+  }
+  auto compiled_module = wasm_vm_->getCompiledModule();
+  if (compiled_module.empty()) {
+    return false;
+  }
+  cache->put(compiled_module_cache_key_, compiled_module);
+  return true;
+}
+
 bool WasmBase::initialize() {
   if (!wasm_vm_) {
     return false;
@@ -354,12 +756,45 @@ bool WasmBase::initialize() {
 
   if (started_from_ != Cloneable::InstantiatedModule) {
     // Base VM was already started, so don't try to start cloned VMs again.
-    startVm(vm_context_.get());
+    if (!restoreMemorySnapshot()) {
+      startVm(vm_context_.get());
+    }
+  }
+  if (!started_from_.has_value() && memory_snapshot_enabled_ && !isFailed()) {
+    captureMemorySnapshot();
   }
 
   return !isFailed();
 }
 
+void WasmBase::captureMemorySnapshot() {
+  if (wasm_vm_->getEngineName() == "null") {
+    return;
+  }
+  if (!parsed_module_ || !parsed_module_->memory_snapshot_safe) {
+    // Cloned VMs are started instead.
+    wasm_vm_->integration()->trace(
+        "Not capturing a memory snapshot, the module keeps state in mutable globals");
+    return;
+  }
+  auto memory = wasm_vm_->getMemory(0, wasm_vm_->getMemorySize());
+  if (memory) {
+    memory_snapshot_ = std::string(memory.value());
+  }
+}
+
+bool WasmBase::restoreMemorySnapshot() {
+  if (!base_wasm_handle_) {
+    return false;
+  }
+  const auto &snapshot = base_wasm_handle_->wasm()->memorySnapshot();
+  if (snapshot.empty() || !wasm_vm_->growMemory(snapshot.size()) ||
+      wasm_vm_->getMemorySize() != snapshot.size()) {
+    return false;
+  }
+  return wasm_vm_->setMemory(0, snapshot.size(), snapshot.data());
+}
+
 ContextBase *WasmBase::getRootContext(const std::shared_ptr<PluginBase> &plugin,
                                       bool allow_closed) {
   auto it = root_contexts_.find(plugin->key());
@@ -375,6 +810,34 @@ ContextBase *WasmBase::getRootContext(const std::shared_ptr<PluginBase> &plugin,
   return nullptr;
 }
 
+void WasmBase::pauseTimers() {
+  if (timers_paused_) {
+    return;
+  }
+  timers_paused_ = true;
+  paused_timer_period_.clear();
+  for (const auto &[root_context_id, period] : timer_period_) {
+    if (period.count() > 0) {
+      paused_timer_period_[root_context_id] = period;
+    }
+  }
+  for (const auto &[root_context_id, period] : paused_timer_period_) {
+    setTimerPeriod(root_context_id, std::chrono::milliseconds(0));
+  }
+}
+
+void WasmBase::resumeTimers() {
+  if (!timers_paused_) {
+    return;
+  }
+  timers_paused_ = false;
+  for (const auto &[root_context_id, period] : paused_timer_period_) {
+    timer_period_[root_context_id] = period;
+    setTimerPeriod(root_context_id, period);
+  }
+  paused_timer_period_.clear();
+}
+
 void WasmBase::startVm(ContextBase *root_context) {
   // wasi_snapshot_preview1.clock_time_get
   wasm_vm_->setRestrictedCallback(
@@ -490,6 +953,7 @@ void WasmBase::finishShutdown() {
 
 bool WasmHandleBase::canary(const std::shared_ptr<PluginBase> &plugin,
                             const WasmHandleCloneFactory &clone_factory) {
+  std::lock_guard<std::mutex> guard(canary_mutex_);
   if (this->wasm() == nullptr) {
     return false;
   }
@@ -518,22 +982,50 @@ bool WasmHandleBase::canary(const std::shared_ptr<PluginBase> &plugin,
     plugin_canary_cache_[plugin->key()] = false;
     return false;
   }
-  configuration_canary_handle->kill();
   plugin_canary_cache_[plugin->key()] = true;
+  cacheCanaryWasm(shared_from_this(), plugin->key(), std::move(configuration_canary_handle));
   return true;
 }
 
-std::shared_ptr<WasmHandleBase> createWasm(const std::string &vm_key, const std::string &code,
-                                           const std::shared_ptr<PluginBase> &plugin,
-                                           const WasmHandleFactory &factory,
-                                           const WasmHandleCloneFactory &clone_factory,
-                                           bool allow_precompiled) {
+static std::shared_ptr<WasmHandleBase> createBaseWasm(const std::string &vm_key,
+                                                      const WasmBytecodePtr &code,
+                                                      const WasmHandleFactory &factory,
+                                                      bool allow_precompiled) {
+  auto wasm_handle = factory(vm_key);
+  if (!wasm_handle) {
+    return nullptr;
+  }
+  if (!wasm_handle->wasm()->load(code, allow_precompiled)) {
+    wasm_handle->wasm()->fail(FailState::UnableToInitializeCode, "Failed to load Wasm code");
+    return nullptr;
+  }
+  if (!wasm_handle->wasm()->initialize()) {
+    wasm_handle->wasm()->fail(FailState::UnableToInitializeCode, "Failed to initialize Wasm code");
+    return nullptr;
+  }
+  return wasm_handle;
+}
+
+// 'get_code' is only called when the base VM has to be created, so that the code isn't copied
+// when it already exists.
+static std::shared_ptr<WasmHandleBase>
+getOrCreateBaseWasm(const std::string &vm_key, const std::function<WasmBytecodePtr()> &get_code,
+                    const std::shared_ptr<PluginBase> &plugin, const WasmHandleFactory &factory,
+                    const WasmHandleCloneFactory &clone_factory, bool allow_precompiled) {
+  // A canary VM parked for another VM won't be handed off anymore.
+  dropCanaryWasmUnlessFor(vm_key);
   std::shared_ptr<WasmHandleBase> wasm_handle;
+  std::shared_future<std::shared_ptr<WasmHandleBase>> pending_wasm_handle;
+  std::promise<std::shared_ptr<WasmHandleBase>> promise;
+  bool create = false;
   {
     std::lock_guard<std::mutex> guard(base_wasms_mutex);
     if (base_wasms == nullptr) {
       base_wasms = new std::remove_reference<decltype(*base_wasms)>::type;
     }
+    if (pending_base_wasms == nullptr) {
+      pending_base_wasms = new std::remove_reference<decltype(*pending_base_wasms)>::type;
+    }
     auto it = base_wasms->find(vm_key);
     if (it != base_wasms->end()) {
       wasm_handle = it->second.lock();
@@ -542,22 +1034,37 @@ std::shared_ptr<WasmHandleBase> createWasm(const std::string &vm_key, const std:
       }
     }
     if (!wasm_handle) {
-      // If no cached base_wasm, creates a new base_wasm, loads the code and initializes it.
-      wasm_handle = factory(vm_key);
-      if (!wasm_handle) {
-        return nullptr;
+      auto pending_it = pending_base_wasms->find(vm_key);
+      if (pending_it != pending_base_wasms->end()) {
+        pending_wasm_handle = pending_it->second;
+      } else {
+        create = true;
+        (*pending_base_wasms)[vm_key] = promise.get_future().share();
       }
-      if (!wasm_handle->wasm()->load(code, allow_precompiled)) {
-        wasm_handle->wasm()->fail(FailState::UnableToInitializeCode, "Failed to load Wasm code");
-        return nullptr;
+    }
+  }
+
+  if (create) {
+    // If no cached base_wasm, creates a new base_wasm, loads the code and initializes it without
+    // holding the lock, so that base_wasms with different keys can be created in parallel.
+    wasm_handle = createBaseWasm(vm_key, get_code(), factory, allow_precompiled);
+    {
+      std::lock_guard<std::mutex> guard(base_wasms_mutex);
+      if (base_wasms == nullptr) {
+        base_wasms = new std::remove_reference<decltype(*base_wasms)>::type;
       }
-      if (!wasm_handle->wasm()->initialize()) {
-        wasm_handle->wasm()->fail(FailState::UnableToInitializeCode,
-                                  "Failed to initialize Wasm code");
-        return nullptr;
+      if (wasm_handle) {
+        (*base_wasms)[vm_key] = wasm_handle;
       }
-      (*base_wasms)[vm_key] = wasm_handle;
+      pending_base_wasms->erase(vm_key);
     }
+    promise.set_value(wasm_handle);
+  } else if (pending_wasm_handle.valid()) {
+    // Another caller is creating the base_wasm for the same key, wait for it.
+    wasm_handle = pending_wasm_handle.get();
+  }
+  if (!wasm_handle) {
+    return nullptr;
   }
 
   // Either creating new one or reusing the existing one, apply canary for each plugin.
@@ -565,7 +1072,45 @@ std::shared_ptr<WasmHandleBase> createWasm(const std::string &vm_key, const std:
     return nullptr;
   }
   return wasm_handle;
-};
+}
+
+std::shared_ptr<WasmHandleBase> createWasm(const std::string &vm_key, const std::string &code,
+                                           const std::shared_ptr<PluginBase> &plugin,
+                                           const WasmHandleFactory &factory,
+                                           const WasmHandleCloneFactory &clone_factory,
+                                           bool allow_precompiled) {
+  return getOrCreateBaseWasm(
+      vm_key, [&code] { return BytecodeUtil::makeBytecode(code); }, plugin, factory,
+      clone_factory, allow_precompiled);
+}
+
+std::shared_ptr<WasmHandleBase> createWasm(const std::string &vm_key, const WasmBytecodePtr &code,
+                                           const std::shared_ptr<PluginBase> &plugin,
+                                           const WasmHandleFactory &factory,
+                                           const WasmHandleCloneFactory &clone_factory,
+                                           bool allow_precompiled) {
+  return getOrCreateBaseWasm(
+      vm_key, [&code] { return code; }, plugin, factory, clone_factory, allow_precompiled);
+}
+
+void createWasmAsync(std::string vm_key, std::string code, std::shared_ptr<PluginBase> plugin,
+                     WasmHandleFactory factory, WasmHandleCloneFactory clone_factory,
+                     bool allow_precompiled, CreateWasmCallback callback) {
+  createWasmAsync(std::move(vm_key), BytecodeUtil::makeBytecode(std::move(code)),
+                  std::move(plugin), std::move(factory), std::move(clone_factory),
+                  allow_precompiled, std::move(callback));
+}
+
+void createWasmAsync(std::string vm_key, WasmBytecodePtr code, std::shared_ptr<PluginBase> plugin,
+                     WasmHandleFactory factory, WasmHandleCloneFactory clone_factory,
+                     bool allow_precompiled, CreateWasmCallback callback) {
+  getCreateWasmThreadPool().post([vm_key = std::move(vm_key), code = std::move(code),
+                                  plugin = std::move(plugin), factory = std::move(factory),
+                                  clone_factory = std::move(clone_factory), allow_precompiled,
+                                  callback = std::move(callback)] {
+    callback(createWasm(vm_key, code, plugin, factory, clone_factory, allow_precompiled));
+  });
+}
 
 std::shared_ptr<WasmHandleBase> getThreadLocalWasm(std::string_view vm_key) {
   auto it = local_wasms.find(std::string(vm_key));
@@ -580,30 +1125,39 @@ std::shared_ptr<WasmHandleBase> getThreadLocalWasm(std::string_view vm_key) {
   return nullptr;
 }
 
+// If the thread-local VM is the canary VM, 'canary_plugin_key' is set to the key of the plugin
+// which has already been started and configured in it.
 static std::shared_ptr<WasmHandleBase>
 getOrCreateThreadLocalWasm(const std::shared_ptr<WasmHandleBase> &base_handle,
-                           const WasmHandleCloneFactory &clone_factory) {
+                           const WasmHandleCloneFactory &clone_factory,
+                           std::string *canary_plugin_key) {
   std::string vm_key(base_handle->wasm()->vm_key());
   // Get existing thread-local WasmVM.
   auto it = local_wasms.find(vm_key);
   if (it != local_wasms.end()) {
     auto wasm_handle = it->second.lock();
     if (wasm_handle) {
+      dropCanaryWasm();
       return wasm_handle;
     }
     local_wasms.erase(it);
   }
   removeStaleLocalCacheEntries(local_wasms, local_wasms_keys);
-  // Create and initialize new thread-local WasmVM.
-  auto wasm_handle = clone_factory(base_handle);
+  // Reuse the canary VM created on this thread, if any.
+  auto wasm_handle = takeCanaryWasm(base_handle, canary_plugin_key);
   if (!wasm_handle) {
-    base_handle->wasm()->fail(FailState::UnableToCloneVm, "Failed to clone Base Wasm");
-    return nullptr;
-  }
+    // Create and initialize new thread-local WasmVM.
+    wasm_handle = clone_factory(base_handle);
+    if (!wasm_handle) {
+      base_handle->wasm()->fail(FailState::UnableToCloneVm, "Failed to clone Base Wasm");
+      return nullptr;
+    }
 
-  if (!wasm_handle->wasm()->initialize()) {
-    base_handle->wasm()->fail(FailState::UnableToInitializeCode, "Failed to initialize Wasm code");
-    return nullptr;
+    if (!wasm_handle->wasm()->initialize()) {
+      base_handle->wasm()->fail(FailState::UnableToInitializeCode,
+                                "Failed to initialize Wasm code");
+      return nullptr;
+    }
   }
   cacheLocalWasm(vm_key, wasm_handle);
   wasm_handle->wasm()->wasm_vm()->addFailCallback([vm_key](proxy_wasm::FailState fail_state) {
@@ -621,31 +1175,38 @@ std::shared_ptr<PluginHandleBase> getOrCreateThreadLocalPlugin(
     const std::shared_ptr<WasmHandleBase> &base_handle, const std::shared_ptr<PluginBase> &plugin,
     const WasmHandleCloneFactory &clone_factory, const PluginHandleFactory &plugin_factory) {
   std::string key(std::string(base_handle->wasm()->vm_key()) + "||" + plugin->key());
+  // The canary VM parked on this thread is only handed off to this call, and only if it's for the
+  // same base VM.
+  dropCanaryWasmUnlessFor(base_handle->wasm()->vm_key());
   // Get existing thread-local Plugin handle.
   auto it = local_plugins.find(key);
   if (it != local_plugins.end()) {
     auto plugin_handle = it->second.lock();
     if (plugin_handle) {
+      dropCanaryWasm();
       return plugin_handle;
     }
     local_plugins.erase(it);
   }
   removeStaleLocalCacheEntries(local_plugins, local_plugins_keys);
   // Get thread-local WasmVM.
-  auto wasm_handle = getOrCreateThreadLocalWasm(base_handle, clone_factory);
+  std::string canary_plugin_key;
+  auto wasm_handle = getOrCreateThreadLocalWasm(base_handle, clone_factory, &canary_plugin_key);
   if (!wasm_handle) {
     return nullptr;
   }
-  // Create and initialize new thread-local Plugin.
-  auto *plugin_context = wasm_handle->wasm()->start(plugin);
-  if (plugin_context == nullptr) {
-    base_handle->wasm()->fail(FailState::StartFailed, "Failed to start thread-local Wasm");
-    return nullptr;
-  }
-  if (!wasm_handle->wasm()->configure(plugin_context, plugin)) {
-    base_handle->wasm()->fail(FailState::ConfigureFailed,
-                              "Failed to configure thread-local Wasm plugin");
-    return nullptr;
+  // Create and initialize new thread-local Plugin, unless the canary already did.
+  if (canary_plugin_key != plugin->key()) {
+    auto *plugin_context = wasm_handle->wasm()->start(plugin);
+    if (plugin_context == nullptr) {
+      base_handle->wasm()->fail(FailState::StartFailed, "Failed to start thread-local Wasm");
+      return nullptr;
+    }
+    if (!wasm_handle->wasm()->configure(plugin_context, plugin)) {
+      base_handle->wasm()->fail(FailState::ConfigureFailed,
+                                "Failed to configure thread-local Wasm plugin");
+      return nullptr;
+    }
   }
   auto plugin_handle = plugin_factory(wasm_handle, plugin);
   cacheLocalPlugin(key, plugin_handle);
@@ -660,9 +1221,166 @@ std::shared_ptr<PluginHandleBase> getOrCreateThreadLocalPlugin(
   return plugin_handle;
 }
 
+void warmUpThreadLocalPlugins(const std::shared_ptr<WasmHandleBase> &base_handle,
+                              const std::shared_ptr<PluginBase> &plugin,
+                              const WasmHandleCloneFactory &clone_factory,
+                              const PluginHandleFactory &plugin_factory,
+                              const std::vector<CallOnThreadFunction> &workers,
+                              WarmUpWorkerCallback on_worker, WarmUpDoneCallback on_done) {
+  struct WarmUpState {
+    std::mutex mutex;
+    std::vector<bool> ready;
+    size_t remaining;
+    WarmUpWorkerCallback on_worker;
+    WarmUpDoneCallback on_done;
+  };
+  auto state = std::make_shared<WarmUpState>();
+  state->ready.resize(workers.size());
+  state->remaining = workers.size();
+  state->on_worker = std::move(on_worker);
+  state->on_done = std::move(on_done);
+  if (workers.empty()) {
+    if (state->on_done) {
+      state->on_done(state->ready);
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i]([state, i, base_handle, plugin, clone_factory, plugin_factory] {
+      auto plugin_handle =
+          getOrCreateThreadLocalPlugin(base_handle, plugin, clone_factory, plugin_factory);
+      auto ready = plugin_handle != nullptr;
+      if (state->on_worker) {
+        state->on_worker(i, std::move(plugin_handle));
+      }
+      {
+        std::lock_guard<std::mutex> guard(state->mutex);
+        state->ready[i] = ready;
+        if (--state->remaining != 0) {
+          return;
+        }
+      }
+      if (state->on_done) {
+        state->on_done(state->ready);
+      }
+    });
+  }
+}
+
+void swapThreadLocalPlugins(std::string swap_key, std::string vm_key, WasmBytecodePtr code,
+                            std::shared_ptr<PluginBase> plugin, WasmHandleFactory factory,
+                            WasmHandleCloneFactory clone_factory,
+                            PluginHandleFactory plugin_factory, bool allow_precompiled,
+                            std::vector<CallOnThreadFunction> workers,
+                            PluginSwapCallback on_progress) {
+  struct SwapState {
+    std::mutex mutex;
+    std::string swap_key;
+    std::vector<CallOnThreadFunction> workers;
+    // Pre-warmed handles, each only accessed on the thread of its worker.
+    std::vector<std::shared_ptr<PluginHandleBase>> plugin_handles;
+    PluginSwapProgress progress;
+    PluginSwapCallback on_progress;
+
+    // Must be called with 'mutex' held, so that progress is reported in order.
+    void report() {
+      if (on_progress) {
+        on_progress(progress);
+      }
+    }
+  };
+  auto state = std::make_shared<SwapState>();
+  state->swap_key = std::move(swap_key);
+  state->workers = std::move(workers);
+  state->plugin_handles.resize(state->workers.size());
+  state->progress.workers = state->workers.size();
+  state->on_progress = std::move(on_progress);
+  {
+    std::lock_guard<std::mutex> guard(state->mutex);
+    state->report();
+  }
+
+  auto on_worker = [state](size_t worker, std::shared_ptr<PluginHandleBase> plugin_handle) {
+    if (!plugin_handle) {
+      return;
+    }
+    state->plugin_handles[worker] = std::move(plugin_handle);
+    std::lock_guard<std::mutex> guard(state->mutex);
+    state->progress.workers_warmed_up++;
+    state->report();
+  };
+
+  auto on_done = [state](const std::vector<bool> &ready) {
+    auto all_ready = std::all_of(ready.begin(), ready.end(), [](bool r) { return r; });
+    {
+      std::lock_guard<std::mutex> guard(state->mutex);
+      state->progress.stage = all_ready ? PluginSwapStage::Swapping : PluginSwapStage::Failed;
+      state->report();
+      if (all_ready && state->workers.empty()) {
+        state->progress.stage = PluginSwapStage::Done;
+        state->report();
+      }
+    }
+    for (size_t i = 0; i < state->workers.size(); i++) {
+      if (!all_ready) {
+        // Release the pre-warmed handles on the threads owning their VMs.
+        if (ready[i]) {
+          state->workers[i]([state, i] { state->plugin_handles[i].reset(); });
+        }
+        continue;
+      }
+      state->workers[i]([state, i] {
+        auto &active_plugin = active_plugins[state->swap_key];
+        // The old handle is released after the swap, so that it drains in the background.
+        auto old_plugin = std::move(active_plugin);
+        active_plugin = std::move(state->plugin_handles[i]);
+        old_plugin.reset();
+        std::lock_guard<std::mutex> guard(state->mutex);
+        if (++state->progress.workers_swapped == state->workers.size()) {
+          state->progress.stage = PluginSwapStage::Done;
+        }
+        state->report();
+      });
+    }
+  };
+
+  getCreateWasmThreadPool().post([state, vm_key = std::move(vm_key), code = std::move(code),
+                                  plugin = std::move(plugin), factory = std::move(factory),
+                                  clone_factory = std::move(clone_factory),
+                                  plugin_factory = std::move(plugin_factory), allow_precompiled,
+                                  on_worker = std::move(on_worker),
+                                  on_done = std::move(on_done)] {
+    auto base_handle = createWasm(vm_key, code, plugin, factory, clone_factory, allow_precompiled);
+    {
+      std::lock_guard<std::mutex> guard(state->mutex);
+      state->progress.stage = base_handle ? PluginSwapStage::WarmingUp : PluginSwapStage::Failed;
+      state->report();
+    }
+    if (base_handle) {
+      warmUpThreadLocalPlugins(base_handle, plugin, clone_factory, plugin_factory, state->workers,
+                               on_worker, on_done);
+    }
+  });
+}
+
+std::shared_ptr<PluginHandleBase> getThreadLocalActivePlugin(std::string_view swap_key) {
+  auto it = active_plugins.find(std::string(swap_key));
+  if (it == active_plugins.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+void removeThreadLocalActivePlugin(std::string_view swap_key) {
+  active_plugins.erase(std::string(swap_key));
+}
+
 void clearWasmCachesForTesting() {
+  active_plugins.clear();
   local_plugins.clear();
   local_wasms.clear();
+  dropCanaryWasm();
   std::lock_guard<std::mutex> guard(base_wasms_mutex);
   if (base_wasms != nullptr) {
     delete base_wasms;
@@ -14,6 +14,7 @@
 // limitations under the License.
 
 #include "include/proxy-wasm/wasmedge.h"
+#include "include/proxy-wasm/limits.h"
 #include "include/proxy-wasm/wasm_vm.h"
 #include "src/wasmedge/types.h"
 
@@ -221,30 +222,57 @@ struct HostModuleData {
 
 using HostModuleDataPtr = std::unique_ptr<HostModuleData>;
 
+// Parsed and validated module. It's only read when instantiating it, so it's shared by all the VMs
+// loading the same bytecode.
+using ASTModulePtr = std::shared_ptr<WasmEdge_ASTModuleContext>;
+
+class WasmEdgeSharedModule : public SharedModule {
+public:
+  explicit WasmEdgeSharedModule(ASTModulePtr ast_module) : ast_module_(std::move(ast_module)) {}
+
+  const ASTModulePtr &get() const { return ast_module_; }
+
+private:
+  ASTModulePtr ast_module_;
+};
+
+#if defined(__linux__) && defined(__x86_64__)
+#define WASMEDGE_AOT_PLATFORM "linux_x86_64"
+#elif defined(__linux__) && defined(__aarch64__)
+#define WASMEDGE_AOT_PLATFORM "linux_aarch64"
+#else
+#define WASMEDGE_AOT_PLATFORM ""
+#endif
+
 class WasmEdge : public WasmVm {
 public:
   WasmEdge() {
-    loader_ = WasmEdge_LoaderCreate(nullptr);
-    validator_ = WasmEdge_ValidatorCreate(nullptr);
     executor_ = WasmEdge_ExecutorCreate(nullptr, nullptr);
     store_ = nullptr;
-    ast_module_ = nullptr;
     module_ = nullptr;
     memory_ = nullptr;
   }
 
   std::string_view getEngineName() override { return "wasmedge"; }
-  std::string_view getPrecompiledSectionName() override { return ""; }
+  // Modules compiled by wasmedgec (in the universal Wasm format) for this platform.
+  std::string_view getPrecompiledSectionName() override;
+  // WasmEdge can't compile modules itself, but the compiled module cache can supply modules
+  // compiled by wasmedgec.
+  std::string_view getCompiledModuleVersion() override { return getPrecompiledSectionName(); }
 
-  Cloneable cloneable() override { return Cloneable::NotCloneable; }
-  std::unique_ptr<WasmVm> clone() override { return nullptr; }
+  Cloneable cloneable() override { return Cloneable::CompiledBytecode; }
+  std::unique_ptr<WasmVm> clone() override;
 
   bool load(std::string_view bytecode, std::string_view precompiled,
             const std::unordered_map<uint32_t, std::string> &function_names) override;
+  SharedModulePtr getSharedModule() override;
+  bool loadSharedModule(const SharedModulePtr &shared_module,
+                        const std::unordered_map<uint32_t, std::string> &function_names) override;
   bool link(std::string_view debug_name) override;
   uint64_t getMemorySize() override;
   std::optional<std::string_view> getMemory(uint64_t pointer, uint64_t size) override;
   bool setMemory(uint64_t pointer, uint64_t size, const void *data) override;
+  bool growMemory(uint64_t size) override;
   bool getWord(uint64_t pointer, Word *word) override;
   bool setWord(uint64_t pointer, Word word) override;
   size_t getWordSize() override { return sizeof(uint32_t); };
@@ -281,13 +309,19 @@ private:
                              std::function<R(ContextBase *, Args...)> *function);
 
   void terminate() override {}
+  // WasmEdge can only cancel asynchronous invocations, which run on another thread (where host
+  // functions can't reach the calling context), so calls exceeding their deadline are only
+  // stopped at their next host function call.
+  bool supportsInterrupt() override { return false; }
   bool usesWasmByteOrder() override { return true; }
 
-  WasmEdgeLoaderPtr loader_;
-  WasmEdgeValidatorPtr validator_;
+  // Parses and validates 'binary', which is either bytecode or a module compiled by wasmedgec.
+  ASTModulePtr parseModule(std::string_view binary);
+
   WasmEdgeExecutorPtr executor_;
   WasmEdgeStorePtr store_;
-  WasmEdgeASTModulePtr ast_module_;
+  // Destroyed after the instance.
+  ASTModulePtr ast_module_;
   WasmEdgeModulePtr module_;
   WasmEdge_MemoryInstanceContext *memory_;
 
@@ -296,21 +330,79 @@ private:
   std::unordered_set<std::string> module_functions_;
 };
 
-bool WasmEdge::load(std::string_view bytecode, std::string_view /*precompiled*/,
-                    const std::unordered_map<uint32_t, std::string> & /*function_names*/) {
+std::string_view WasmEdge::getPrecompiledSectionName() {
+  static const auto name = sizeof(WASMEDGE_AOT_PLATFORM) - 1 > 0
+                               ? std::string("precompiled_wasmedge_aot_") + WASMEDGE_AOT_PLATFORM
+                               : "";
+  return name;
+}
+
+ASTModulePtr WasmEdge::parseModule(std::string_view binary) {
+  WasmEdgeLoaderPtr loader = WasmEdge_LoaderCreate(nullptr);
+  WasmEdgeValidatorPtr validator = WasmEdge_ValidatorCreate(nullptr);
+  if (loader == nullptr || validator == nullptr) {
+    return nullptr;
+  }
   WasmEdge_ASTModuleContext *mod = nullptr;
   WasmEdge_Result res = WasmEdge_LoaderParseFromBuffer(
-      loader_.get(), &mod, reinterpret_cast<const uint8_t *>(bytecode.data()), bytecode.size());
+      loader.get(), &mod, reinterpret_cast<const uint8_t *>(binary.data()), binary.size());
   if (!WasmEdge_ResultOK(res)) {
-    return false;
+    return nullptr;
   }
-  res = WasmEdge_ValidatorValidate(validator_.get(), mod);
+  WasmEdgeASTModulePtr ast_module = mod;
+  res = WasmEdge_ValidatorValidate(validator.get(), ast_module.get());
   if (!WasmEdge_ResultOK(res)) {
-    WasmEdge_ASTModuleDelete(mod);
-    return false;
+    return nullptr;
   }
-  ast_module_ = mod;
-  return true;
+  return ASTModulePtr(ast_module.release(), WasmEdge_ASTModuleDelete);
+}
+
+bool WasmEdge::load(std::string_view bytecode, std::string_view precompiled,
+                    const std::unordered_map<uint32_t, std::string> & /*function_names*/) {
+  // Modules compiled by wasmedgec are rejected by other versions of WasmEdge, in which case the
+  // bytecode is used instead.
+  if (!precompiled.empty()) {
+    ast_module_ = parseModule(precompiled);
+    if (ast_module_ == nullptr) {
+      integration()->trace("Failed to load the WasmEdge AOT module, using the bytecode instead");
+    }
+  }
+  if (ast_module_ == nullptr) {
+    ast_module_ = parseModule(bytecode);
+  }
+  return ast_module_ != nullptr;
+}
+
+SharedModulePtr WasmEdge::getSharedModule() {
+  if (ast_module_ == nullptr) {
+    return nullptr;
+  }
+  return std::make_shared<WasmEdgeSharedModule>(ast_module_);
+}
+
+bool WasmEdge::loadSharedModule(
+    const SharedModulePtr &shared_module,
+    const std::unordered_map<uint32_t, std::string> & /*function_names*/) {
+  ast_module_ = static_cast<const WasmEdgeSharedModule *>(shared_module.get())->get();
+  return ast_module_ != nullptr;
+}
+
+std::unique_ptr<WasmVm> WasmEdge::clone() {
+  assert(ast_module_ != nullptr);
+
+  auto vm = std::make_unique<WasmEdge>();
+  if (vm == nullptr || vm->executor_ == nullptr) {
+    return nullptr;
+  }
+  vm->ast_module_ = ast_module_;
+
+  auto *integration_clone = integration()->clone();
+  if (integration_clone == nullptr) {
+    return nullptr;
+  }
+  vm->integration().reset(integration_clone);
+
+  return vm;
 }
 
 bool WasmEdge::link(std::string_view /*debug_name*/) {
@@ -378,6 +470,20 @@ std::optional<std::string_view> WasmEdge::getMemory(uint64_t pointer, uint64_t s
   return std::string_view(ptr, size);
 }
 
+bool WasmEdge::growMemory(uint64_t size) {
+  if (memory_ == nullptr) {
+    return false;
+  }
+  auto current_size = getMemorySize();
+  if (size <= current_size) {
+    return true;
+  }
+  auto delta = (size - current_size + PROXY_WASM_HOST_WASM_MEMORY_PAGE_SIZE_BYTES - 1) /
+               PROXY_WASM_HOST_WASM_MEMORY_PAGE_SIZE_BYTES;
+  return WasmEdge_ResultOK(
+      WasmEdge_MemoryInstanceGrowPage(memory_, static_cast<uint32_t>(delta)));
+}
+
 bool WasmEdge::setMemory(uint64_t pointer, uint64_t size, const void *data) {
   auto res = WasmEdge_MemoryInstanceSetData(memory_, reinterpret_cast<const uint8_t *>(data),
                                             pointer, size);
@@ -427,6 +533,9 @@ void WasmEdge::registerHostFunctionImpl(std::string_view module_name,
                                            func_data->name_ + "(" +
                                            printValues(Params, sizeof...(Args)) + ")");
     }
+    if (ExecutionDeadline::exceeded()) {
+      return WasmEdge_Result_Terminate;
+    }
     auto args = convValTypesToArgsTuple<std::tuple<Args...>>(Params);
     auto fn = reinterpret_cast<void (*)(Args...)>(func_data->raw_func_);
     std::apply(fn, args);
@@ -473,6 +582,9 @@ void WasmEdge::registerHostFunctionImpl(std::string_view module_name,
                                            func_data->name_ + "(" +
                                            printValues(Params, sizeof...(Args)) + ")");
     }
+    if (ExecutionDeadline::exceeded()) {
+      return WasmEdge_Result_Terminate;
+    }
     auto args = convValTypesToArgsTuple<std::tuple<Args...>>(Params);
     auto fn = reinterpret_cast<R (*)(Args...)>(func_data->raw_func_);
     R res = std::apply(fn, args);
@@ -538,8 +650,14 @@ void WasmEdge::getModuleFunctionImpl(std::string_view function_name,
                            printValues(params, sizeof...(Args)) + ")");
     }
     SaveRestoreContext saved_context(context);
+    ExecutionDeadline deadline(this);
     WasmEdge_Result res =
         WasmEdge_ExecutorInvoke(executor_.get(), func_cxt, params, sizeof...(Args), nullptr, 0);
+    if (deadline.disarm()) {
+      fail(FailState::RuntimeError,
+           "Function: " + std::string(function_name) + " failed: execution timeout exceeded");
+      return;
+    }
     if (!WasmEdge_ResultOK(res)) {
       fail(FailState::RuntimeError, "Function: " + std::string(function_name) +
                                         " failed: " + WasmEdge_ResultGetMessage(res));
@@ -592,8 +710,14 @@ void WasmEdge::getModuleFunctionImpl(std::string_view function_name,
                            printValues(params, sizeof...(Args)) + ")");
     }
     SaveRestoreContext saved_context(context);
+    ExecutionDeadline deadline(this);
     WasmEdge_Result res =
         WasmEdge_ExecutorInvoke(executor_.get(), func_cxt, params, sizeof...(Args), results, 1);
+    if (deadline.disarm()) {
+      fail(FailState::RuntimeError,
+           "Function: " + std::string(function_name) + " failed: execution timeout exceeded");
+      return R{};
+    }
     if (!WasmEdge_ResultOK(res)) {
       fail(FailState::RuntimeError, "Function: " + std::string(function_name) +
                                         " failed: " + WasmEdge_ResultGetMessage(res));
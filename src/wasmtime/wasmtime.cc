@@ -13,10 +13,14 @@
 // limitations under the License.
 
 #include "include/proxy-wasm/wasmtime.h"
+#include "include/proxy-wasm/limits.h"
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <chrono>
 #include <cstring>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <string>
@@ -26,7 +30,7 @@
 
 #include "src/wasmtime/types.h"
 
-#include "include/wasm.h"
+#include "wasmtime.h"
 
 namespace proxy_wasm {
 namespace wasmtime {
@@ -35,16 +39,99 @@ struct HostFuncData {
   HostFuncData(std::string name) : name_(std::move(name)) {}
 
   std::string name_;
-  WasmFuncPtr callback_;
+  std::optional<wasmtime_func_t> callback_;
+  // Creates 'callback_', which is only done for the host functions imported by the module.
+  wasmtime_func_t (*make_callback_)(wasmtime_context_t *context, HostFuncData *data){};
   void *raw_func_{};
   WasmVm *vm_{};
 };
 
 using HostFuncDataPtr = std::unique_ptr<HostFuncData>;
 
+// Imports and exports of a module, resolved and type-checked when the base VM is linked, and
+// shared with its clones, which only need to instantiate them.
+struct ModuleBindings {
+  struct Import {
+    wasm_externkind_t kind;
+    std::string name;                      // "module.name" of the host function.
+    wasm_limits_t limits{};                // Limits of the memory or table.
+    wasm_valkind_t element = WASM_FUNCREF; // Element type of the table.
+  };
+  struct Function {
+    size_t index;
+    std::vector<wasm_valkind_t> params;
+    std::vector<wasm_valkind_t> results;
+  };
+
+  std::vector<Import> imports;
+  std::unordered_map<std::string, Function> functions;
+  std::optional<size_t> memory;
+};
+
+// Epoch deadline of stores which aren't executing a call with an execution timeout. The epoch of
+// the engine is advanced by the execution watchdog, so it's never reached.
+constexpr uint64_t NO_EPOCH_DEADLINE = std::numeric_limits<uint64_t>::max() / 2;
+
+// The engine is shared by all VMs. Its epoch is advanced by the execution watchdog, which can run
+// until exit, so it's intentionally leaked.
 wasm_engine_t *engine() {
-  static const auto engine = WasmEnginePtr(wasm_engine_new());
-  return engine.get();
+  static wasm_engine_t *const engine = [] {
+    wasm_config_t *config = wasm_config_new();
+    wasmtime_config_epoch_interruption_set(config, true);
+    wasm_engine_t *engine = wasm_engine_new_with_config(config); // Takes ownership of 'config'.
+    ExecutionDeadline::addWatchdogTick([engine] { wasmtime_engine_increment_epoch(engine); });
+    return engine;
+  }();
+  return engine;
+}
+
+// Sets the epoch deadline of the store for the duration of the outermost call with an execution
+// timeout, so that Wasmtime traps the call once the watchdog observes that the timeout expired.
+class EpochDeadline {
+public:
+  EpochDeadline(wasmtime_context_t *context, const ExecutionDeadline &deadline,
+                std::chrono::milliseconds timeout)
+      : context_(deadline.armed() ? context : nullptr) {
+    if (context_ != nullptr) {
+      // The first tick can happen right away, hence the extra one.
+      constexpr auto interval = PROXY_WASM_HOST_EXECUTION_WATCHDOG_INTERVAL_MS;
+      const uint64_t ticks = (timeout.count() + interval - 1) / interval + 1;
+      wasmtime_context_set_epoch_deadline(context_, ticks);
+    }
+  }
+  ~EpochDeadline() {
+    if (context_ != nullptr) {
+      wasmtime_context_set_epoch_deadline(context_, NO_EPOCH_DEADLINE);
+    }
+  }
+  EpochDeadline(const EpochDeadline &) = delete;
+  EpochDeadline &operator=(const EpochDeadline &) = delete;
+
+private:
+  wasmtime_context_t *context_;
+};
+
+// Modules are compiled for the engine and can be instantiated in any of its stores.
+class WasmtimeSharedModule : public SharedModule {
+public:
+  explicit WasmtimeSharedModule(WasmtimeModulePtr module) : module_(std::move(module)) {}
+
+  wasmtime_module_t *get() const { return module_.get(); }
+
+private:
+  WasmtimeModulePtr module_;
+};
+
+static std::string getErrorMessage(const wasmtime_error_t *error) {
+  WasmByteVec message;
+  wasmtime_error_message(error, message.get());
+  return std::string(message.get()->data, message.get()->size);
+}
+
+static std::string getTrapMessage(const wasm_trap_t *trap) {
+  WasmByteVec message;
+  wasm_trap_message(trap, message.get());
+  return std::string(message.get()->data); // NULL-terminated
 }
 
 class Wasmtime : public WasmVm {
@@ -54,6 +141,12 @@ public:
   std::string_view getEngineName() override { return "wasmtime"; }
   Cloneable cloneable() override { return Cloneable::CompiledBytecode; }
   std::string_view getPrecompiledSectionName() override { return ""; }
+  // Wasmtime rejects serialized modules from other versions or with a different configuration.
+  std::string_view getCompiledModuleVersion() override { return "wasmtime-epoch"; }
+  std::string getCompiledModule() override;
+  SharedModulePtr getSharedModule() override;
+  bool loadSharedModule(const SharedModulePtr &shared_module,
+                        const std::unordered_map<uint32_t, std::string> &function_names) override;
 
   bool load(std::string_view bytecode, std::string_view precompiled,
             const std::unordered_map<uint32_t, std::string> &function_names) override;
@@ -62,6 +155,7 @@ public:
   uint64_t getMemorySize() override;
   std::optional<std::string_view> getMemory(uint64_t pointer, uint64_t size) override;
   bool setMemory(uint64_t pointer, uint64_t size, const void *data) override;
+  bool growMemory(uint64_t size) override;
   bool getWord(uint64_t pointer, Word *word) override;
   bool setWord(uint64_t pointer, Word word) override;
   size_t getWordSize() override { return sizeof(uint32_t); };
@@ -98,56 +192,114 @@ private:
                              std::function<R(ContextBase *, Args...)> *function);
 
   void terminate() override {}
+  // Calls are interrupted by their epoch deadline (see EpochDeadline).
+  bool interrupt() override { return true; }
+  bool supportsInterrupt() override { return true; }
   bool usesWasmByteOrder() override { return true; }
 
-  WasmStorePtr store_;
-  WasmModulePtr module_;
-  WasmSharedModulePtr shared_module_;
-  WasmInstancePtr instance_;
-  WasmMemoryPtr memory_;
-  WasmTablePtr table_;
+  bool newStore();
+  bool resolveBindings();
+  const wasmtime_func_t *getHostFunction(const std::string &name);
+  const ModuleBindings::Function *getModuleFunctionBinding(std::string_view function_name);
+  std::string getFunctionTypeString(const wasmtime_func_t &func);
+
+  uint8_t *memoryData() { return wasmtime_memory_data(context_, &memory_.value()); }
+  size_t memoryDataSize() { return wasmtime_memory_data_size(context_, &memory_.value()); }
+
+  WasmtimeStorePtr store_;
+  wasmtime_context_t *context_ = nullptr; // Owned by 'store_'.
+  WasmtimeModulePtr module_;
 
+  // Owned by 'store_'.
+  wasmtime_instance_t instance_{};
+  std::optional<wasmtime_memory_t> memory_;
+
+  std::shared_ptr<const ModuleBindings> bindings_;
   std::unordered_map<std::string, HostFuncDataPtr> host_functions_;
-  std::unordered_map<std::string, WasmFuncPtr> module_functions_;
+  std::vector<wasmtime_func_t> module_functions_; // Indexed by export, owned by 'store_'.
 };
 
-bool Wasmtime::load(std::string_view bytecode, std::string_view /*precompiled*/,
-                    const std::unordered_map<uint32_t, std::string> & /*function_names*/) {
-  store_ = wasm_store_new(engine());
+bool Wasmtime::newStore() {
+  store_ = wasmtime_store_new(engine(), nullptr, nullptr);
   if (store_ == nullptr) {
     return false;
   }
+  context_ = wasmtime_store_context(store_.get());
+  wasmtime_context_set_epoch_deadline(context_, NO_EPOCH_DEADLINE);
+  return true;
+}
 
+bool Wasmtime::load(std::string_view bytecode, std::string_view precompiled,
+                    const std::unordered_map<uint32_t, std::string> & /*function_names*/) {
+  if (!newStore()) {
+    return false;
+  }
+
+  wasmtime_module_t *module = nullptr;
+  WasmtimeErrorPtr error;
+  if (!precompiled.empty()) {
+    error = wasmtime_module_deserialize(engine(),
+                                        reinterpret_cast<const uint8_t *>(precompiled.data()),
+                                        precompiled.size(), &module);
+  } else {
+    error = wasmtime_module_new(engine(), reinterpret_cast<const uint8_t *>(bytecode.data()),
+                                bytecode.size(), &module);
+  }
+  if (error != nullptr) {
+    fail(FailState::UnableToInitializeCode,
+         "Failed to load Wasm module: " + getErrorMessage(error.get()));
+    return false;
+  }
+  module_ = module;
+
+  return true;
+}
+
+std::string Wasmtime::getCompiledModule() {
+  if (module_ == nullptr) {
+    return "";
+  }
   WasmByteVec vec;
-  wasm_byte_vec_new(vec.get(), bytecode.size(), bytecode.data());
+  WasmtimeErrorPtr error = wasmtime_module_serialize(module_.get(), vec.get());
+  if (error != nullptr) {
+    return "";
+  }
+  return std::string(vec.get()->data, vec.get()->size);
+}
 
-  module_ = wasm_module_new(store_.get(), vec.get());
+SharedModulePtr Wasmtime::getSharedModule() {
   if (module_ == nullptr) {
-    return false;
+    return nullptr;
   }
+  return std::make_shared<WasmtimeSharedModule>(wasmtime_module_clone(module_.get()));
+}
 
-  shared_module_ = wasm_module_share(module_.get());
-  if (shared_module_ == nullptr) {
+bool Wasmtime::loadSharedModule(
+    const SharedModulePtr &shared_module,
+    const std::unordered_map<uint32_t, std::string> & /*function_names*/) {
+  if (!newStore()) {
     return false;
   }
 
-  return true;
+  const auto *module = static_cast<const WasmtimeSharedModule *>(shared_module.get());
+  module_ = wasmtime_module_clone(module->get());
+  return module_ != nullptr;
 }
 
 std::unique_ptr<WasmVm> Wasmtime::clone() {
-  assert(shared_module_ != nullptr);
+  assert(module_ != nullptr);
 
   auto clone = std::make_unique<Wasmtime>();
   if (clone == nullptr) {
     return nullptr;
   }
 
-  clone->store_ = wasm_store_new(engine());
-  if (clone->store_ == nullptr) {
+  if (!clone->newStore()) {
     return nullptr;
   }
 
-  clone->module_ = wasm_module_obtain(clone->store_.get(), shared_module_.get());
+  // Clones share the compiled code and only get a new store, in which link() instantiates it.
+  clone->module_ = wasmtime_module_clone(module_.get());
   if (clone->module_ == nullptr) {
     return nullptr;
   }
@@ -158,6 +310,8 @@ std::unique_ptr<WasmVm> Wasmtime::clone() {
   }
   clone->integration().reset(integration_clone);
 
+  clone->bindings_ = bindings_;
+
   return clone;
 }
 
@@ -175,32 +329,41 @@ static bool equalValTypes(const wasm_valtype_vec_t *left, const wasm_valtype_vec
   return true;
 }
 
-static std::string printValue(const wasm_val_t &value) {
+static std::vector<wasm_valkind_t> getValKinds(const wasm_valtype_vec_t *types) {
+  std::vector<wasm_valkind_t> kinds;
+  kinds.reserve(types->size);
+  for (size_t i = 0; i < types->size; i++) {
+    kinds.push_back(wasm_valtype_kind(types->data[i]));
+  }
+  return kinds;
+}
+
+static std::string printValue(const wasmtime_val_t &value) {
   switch (value.kind) {
-  case WASM_I32:
+  case WASMTIME_I32:
     return std::to_string(value.of.i32);
-  case WASM_I64:
+  case WASMTIME_I64:
     return std::to_string(value.of.i64);
-  case WASM_F32:
+  case WASMTIME_F32:
     return std::to_string(value.of.f32);
-  case WASM_F64:
+  case WASMTIME_F64:
     return std::to_string(value.of.f64);
   default:
     return "unknown";
   }
 }
 
-static std::string printValues(const wasm_val_vec_t *values) {
-  if (values->size == 0) {
+static std::string printValues(const wasmtime_val_t *values, size_t size) {
+  if (size == 0) {
     return "";
   }
 
   std::string s;
-  for (size_t i = 0; i < values->size; i++) {
+  for (size_t i = 0; i < size; i++) {
     if (i != 0U) {
       s.append(", ");
     }
-    s.append(printValue(values->data[i]));
+    s.append(printValue(values[i]));
   }
   return s;
 }
@@ -240,13 +403,12 @@ static std::string printValTypes(const wasm_valtype_vec_t *types) {
   return s;
 }
 
-bool Wasmtime::link(std::string_view /*debug_name*/) {
-  assert(module_ != nullptr);
+bool Wasmtime::resolveBindings() {
+  auto bindings = std::make_shared<ModuleBindings>();
 
   WasmImporttypeVec import_types;
-  wasm_module_imports(module_.get(), import_types.get());
+  wasmtime_module_imports(module_.get(), import_types.get());
 
-  std::vector<wasm_extern_t *> imports;
   for (size_t i = 0; i < import_types.get()->size; i++) {
     const wasm_name_t *module_name_ptr = wasm_importtype_module(import_types.get()->data[i]);
     const wasm_name_t *name_ptr = wasm_importtype_name(import_types.get()->data[i]);
@@ -255,180 +417,301 @@ bool Wasmtime::link(std::string_view /*debug_name*/) {
     std::string_view module_name(module_name_ptr->data, module_name_ptr->size);
     std::string_view name(name_ptr->data, name_ptr->size);
     assert(name_ptr->size > 0);
-    switch (wasm_externtype_kind(extern_type)) {
+    ModuleBindings::Import import{wasm_externtype_kind(extern_type),
+                                  std::string(module_name) + "." + std::string(name)};
+
+    switch (import.kind) {
     case WASM_EXTERN_FUNC: {
-      auto it = host_functions_.find(std::string(module_name) + "." + std::string(name));
-      if (it == host_functions_.end()) {
+      auto *func = getHostFunction(import.name);
+      if (func == nullptr) {
         fail(FailState::UnableToInitializeCode,
-             std::string("Failed to load Wasm module due to a missing import: ") +
-                 std::string(module_name) + "." + std::string(name));
+             "Failed to load Wasm module due to a missing import: " + import.name);
         return false;
       }
 
-      auto *func = it->second->callback_.get();
       const wasm_functype_t *exp_type = wasm_externtype_as_functype_const(extern_type);
-      WasmFunctypePtr actual_type = wasm_func_type(it->second->callback_.get());
+      WasmFunctypePtr actual_type = wasmtime_func_type(context_, func);
       if (!equalValTypes(wasm_functype_params(exp_type), wasm_functype_params(actual_type.get())) ||
           !equalValTypes(wasm_functype_results(exp_type),
                          wasm_functype_results(actual_type.get()))) {
         fail(
             FailState::UnableToInitializeCode,
-            std::string("Failed to load Wasm module due to an import type mismatch for function ") +
-                std::string(module_name) + "." + std::string(name) +
-                ", want: " + printValTypes(wasm_functype_params(exp_type)) + " -> " +
+            "Failed to load Wasm module due to an import type mismatch for function " +
+                import.name + ", want: " + printValTypes(wasm_functype_params(exp_type)) + " -> " +
                 printValTypes(wasm_functype_results(exp_type)) +
                 ", but host exports: " + printValTypes(wasm_functype_params(actual_type.get())) +
                 " -> " + printValTypes(wasm_functype_results(actual_type.get())));
         return false;
       }
-      imports.push_back(wasm_func_as_extern(func));
     } break;
     case WASM_EXTERN_GLOBAL: {
       // TODO(mathetake): add support when/if needed.
       fail(FailState::UnableToInitializeCode,
-           "Failed to load Wasm module due to a missing import: " + std::string(module_name) + "." +
-               std::string(name));
+           "Failed to load Wasm module due to a missing import: " + import.name);
       return false;
     } break;
     case WASM_EXTERN_MEMORY: {
-      assert(memory_ == nullptr);
       const wasm_memorytype_t *memory_type =
           wasm_externtype_as_memorytype_const(extern_type); // owned by `extern_type`
       if (memory_type == nullptr) {
         return false;
       }
-      memory_ = wasm_memory_new(store_.get(), memory_type);
-      if (memory_ == nullptr) {
-        return false;
-      }
-      imports.push_back(wasm_memory_as_extern(memory_.get()));
+      import.limits = *wasm_memorytype_limits(memory_type);
     } break;
     case WASM_EXTERN_TABLE: {
-      assert(table_ == nullptr);
       const wasm_tabletype_t *table_type =
           wasm_externtype_as_tabletype_const(extern_type); // owned by `extern_type`
       if (table_type == nullptr) {
         return false;
       }
-      table_ = wasm_table_new(store_.get(), table_type, nullptr);
-      if (table_ == nullptr) {
-        return false;
-      }
-      imports.push_back(wasm_table_as_extern(table_.get()));
+      import.limits = *wasm_tabletype_limits(table_type);
+      import.element = wasm_valtype_kind(wasm_tabletype_element(table_type));
     } break;
     }
+
+    bindings->imports.push_back(std::move(import));
   }
 
-  if (import_types.get()->size != imports.size()) {
-    return false;
+  WasmExportTypeVec export_types;
+  wasmtime_module_exports(module_.get(), export_types.get());
+
+  for (size_t i = 0; i < export_types.get()->size; i++) {
+    const wasm_externtype_t *extern_type = wasm_exporttype_type(export_types.get()->data[i]);
+    const wasm_name_t *name_ptr = wasm_exporttype_name(export_types.get()->data[i]);
+
+    switch (wasm_externtype_kind(extern_type)) {
+    case WASM_EXTERN_FUNC: {
+      const wasm_functype_t *func_type = wasm_externtype_as_functype_const(extern_type);
+      bindings->functions.insert_or_assign(
+          std::string(name_ptr->data, name_ptr->size),
+          ModuleBindings::Function{i, getValKinds(wasm_functype_params(func_type)),
+                                   getValKinds(wasm_functype_results(func_type))});
+    } break;
+    case WASM_EXTERN_GLOBAL: {
+      // TODO(mathetake): add support when/if needed.
+    } break;
+    case WASM_EXTERN_MEMORY: {
+      bindings->memory = i;
+    } break;
+    case WASM_EXTERN_TABLE: {
+      // TODO(mathetake): add support when/if needed.
+    } break;
+    }
   }
 
-  wasm_extern_vec_t imports_vec = {imports.size(), imports.data()};
-  instance_ = wasm_instance_new(store_.get(), module_.get(), &imports_vec, nullptr);
-  if (instance_ == nullptr) {
-    fail(FailState::UnableToInitializeCode, "Failed to create new Wasm instance");
-    return false;
+  bindings_ = std::move(bindings);
+  return true;
+}
+
+const wasmtime_func_t *Wasmtime::getHostFunction(const std::string &name) {
+  auto it = host_functions_.find(name);
+  if (it == host_functions_.end()) {
+    return nullptr;
   }
+  auto *data = it->second.get();
+  if (!data->callback_.has_value()) {
+    data->callback_ = data->make_callback_(context_, data);
+  }
+  return &data->callback_.value();
+}
 
-  WasmExportTypeVec export_types;
-  wasm_module_exports(module_.get(), export_types.get());
+const ModuleBindings::Function *
+Wasmtime::getModuleFunctionBinding(std::string_view function_name) {
+  if (bindings_ == nullptr) {
+    return nullptr;
+  }
+  auto it = bindings_->functions.find(std::string(function_name));
+  if (it == bindings_->functions.end() || it->second.index >= module_functions_.size()) {
+    return nullptr;
+  }
+  return &it->second;
+}
 
-  WasmExternVec exports;
-  wasm_instance_exports(instance_.get(), exports.get());
+std::string Wasmtime::getFunctionTypeString(const wasmtime_func_t &func) {
+  WasmFunctypePtr func_type = wasmtime_func_type(context_, &func);
+  return printValTypes(wasm_functype_params(func_type.get())) + " -> " +
+         printValTypes(wasm_functype_results(func_type.get()));
+}
 
-  for (size_t i = 0; i < export_types.get()->size; i++) {
-    const wasm_externtype_t *exp_extern_type = wasm_exporttype_type(export_types.get()->data[i]);
-    wasm_extern_t *actual_extern = exports.get()->data[i];
+bool Wasmtime::link(std::string_view /*debug_name*/) {
+  assert(module_ != nullptr);
+
+  // Imports and exports are resolved once by the base VM, and reused by its clones.
+  if (bindings_ == nullptr && !resolveBindings()) {
+    return false;
+  }
 
-    wasm_externkind_t kind = wasm_extern_kind(actual_extern);
-    assert(kind == wasm_externtype_kind(exp_extern_type));
-    switch (kind) {
+  std::vector<wasmtime_extern_t> imports;
+  imports.reserve(bindings_->imports.size());
+  for (const auto &import : bindings_->imports) {
+    wasmtime_extern_t item{};
+    switch (import.kind) {
     case WASM_EXTERN_FUNC: {
-      WasmFuncPtr func = wasm_func_copy(wasm_extern_as_func(actual_extern));
-      const wasm_name_t *name_ptr = wasm_exporttype_name(export_types.get()->data[i]);
-      module_functions_.insert_or_assign(std::string(name_ptr->data, name_ptr->size),
-                                         std::move(func));
+      const auto *func = getHostFunction(import.name);
+      if (func == nullptr) {
+        fail(FailState::UnableToInitializeCode,
+             "Failed to load Wasm module due to a missing import: " + import.name);
+        return false;
+      }
+      item.kind = WASMTIME_EXTERN_FUNC;
+      item.of.func = *func;
     } break;
     case WASM_EXTERN_GLOBAL: {
-      // TODO(mathetake): add support when/if needed.
+      // Rejected by resolveBindings().
+      return false;
     } break;
     case WASM_EXTERN_MEMORY: {
-      assert(memory_ == nullptr);
-      memory_ = wasm_memory_copy(wasm_extern_as_memory(actual_extern));
-      if (memory_ == nullptr) {
+      assert(!memory_.has_value());
+      WasmMemorytypePtr memory_type = wasm_memorytype_new(&import.limits);
+      if (memory_type == nullptr) {
         return false;
       }
+      item.kind = WASMTIME_EXTERN_MEMORY;
+      WasmtimeErrorPtr error = wasmtime_memory_new(context_, memory_type.get(), &item.of.memory);
+      if (error != nullptr) {
+        fail(FailState::UnableToInitializeCode,
+             "Failed to create Wasm memory: " + getErrorMessage(error.get()));
+        return false;
+      }
+      memory_ = item.of.memory;
     } break;
     case WASM_EXTERN_TABLE: {
-      // TODO(mathetake): add support when/if needed.
+      WasmTabletypePtr table_type =
+          wasm_tabletype_new(wasm_valtype_new(import.element), &import.limits);
+      if (table_type == nullptr) {
+        return false;
+      }
+      wasmtime_val_t init{}; // null funcref (store_id 0) or externref.
+      init.kind = import.element == WASM_FUNCREF ? WASMTIME_FUNCREF : WASMTIME_EXTERNREF;
+      item.kind = WASMTIME_EXTERN_TABLE;
+      WasmtimeErrorPtr error =
+          wasmtime_table_new(context_, table_type.get(), &init, &item.of.table);
+      if (error != nullptr) {
+        fail(FailState::UnableToInitializeCode,
+             "Failed to create Wasm table: " + getErrorMessage(error.get()));
+        return false;
+      }
     } break;
     }
+    imports.push_back(item);
   }
+
+  wasm_trap_t *trap_ptr = nullptr;
+  WasmtimeErrorPtr error = wasmtime_instance_new(context_, module_.get(), imports.data(),
+                                                 imports.size(), &instance_, &trap_ptr);
+  WasmTrapPtr trap(trap_ptr);
+  if (error != nullptr || trap != nullptr) {
+    fail(FailState::UnableToInitializeCode,
+         "Failed to create new Wasm instance: " +
+             (error != nullptr ? getErrorMessage(error.get()) : getTrapMessage(trap.get())));
+    return false;
+  }
+
+  for (const auto &it : bindings_->functions) {
+    const auto index = it.second.index;
+    if (index >= module_functions_.size()) {
+      module_functions_.resize(index + 1);
+    }
+    wasmtime_extern_t item;
+    char *name = nullptr;
+    size_t name_len = 0;
+    if (!wasmtime_instance_export_nth(context_, &instance_, index, &name, &name_len, &item) ||
+        item.kind != WASMTIME_EXTERN_FUNC) {
+      return false;
+    }
+    module_functions_[index] = item.of.func;
+  }
+  if (bindings_->memory.has_value()) {
+    assert(!memory_.has_value());
+    wasmtime_extern_t item;
+    char *name = nullptr;
+    size_t name_len = 0;
+    if (!wasmtime_instance_export_nth(context_, &instance_, bindings_->memory.value(), &name,
+                                      &name_len, &item) ||
+        item.kind != WASMTIME_EXTERN_MEMORY) {
+      return false;
+    }
+    memory_ = item.of.memory;
+  }
+
   return true;
 }
 
-uint64_t Wasmtime::getMemorySize() { return wasm_memory_data_size(memory_.get()); }
+uint64_t Wasmtime::getMemorySize() { return memoryDataSize(); }
 
 std::optional<std::string_view> Wasmtime::getMemory(uint64_t pointer, uint64_t size) {
-  assert(memory_ != nullptr);
-  if (pointer + size > wasm_memory_data_size(memory_.get())) {
+  assert(memory_.has_value());
+  if (pointer + size > memoryDataSize()) {
     return std::nullopt;
   }
-  return std::string_view(wasm_memory_data(memory_.get()) + pointer, size);
+  return std::string_view(reinterpret_cast<char *>(memoryData()) + pointer, size);
+}
+
+bool Wasmtime::growMemory(uint64_t size) {
+  assert(memory_.has_value());
+  auto current_size = memoryDataSize();
+  if (size <= current_size) {
+    return true;
+  }
+  auto delta = (size - current_size + PROXY_WASM_HOST_WASM_MEMORY_PAGE_SIZE_BYTES - 1) /
+               PROXY_WASM_HOST_WASM_MEMORY_PAGE_SIZE_BYTES;
+  uint64_t previous_pages = 0;
+  WasmtimeErrorPtr error = wasmtime_memory_grow(context_, &memory_.value(), delta, &previous_pages);
+  return error == nullptr;
 }
 
 bool Wasmtime::setMemory(uint64_t pointer, uint64_t size, const void *data) {
-  assert(memory_ != nullptr);
-  if (pointer + size > wasm_memory_data_size(memory_.get())) {
+  assert(memory_.has_value());
+  if (pointer + size > memoryDataSize()) {
     return false;
   }
-  ::memcpy(wasm_memory_data(memory_.get()) + pointer, data, size);
+  ::memcpy(memoryData() + pointer, data, size);
   return true;
 }
 
 bool Wasmtime::getWord(uint64_t pointer, Word *word) {
-  assert(memory_ != nullptr);
+  assert(memory_.has_value());
   constexpr auto size = sizeof(uint32_t);
-  if (pointer + size > wasm_memory_data_size(memory_.get())) {
+  if (pointer + size > memoryDataSize()) {
     return false;
   }
 
   uint32_t word32;
-  ::memcpy(&word32, wasm_memory_data(memory_.get()) + pointer, size);
+  ::memcpy(&word32, memoryData() + pointer, size);
   word->u64_ = wasmtoh(word32, true);
   return true;
 }
 
 bool Wasmtime::setWord(uint64_t pointer, Word word) {
   constexpr auto size = sizeof(uint32_t);
-  if (pointer + size > wasm_memory_data_size(memory_.get())) {
+  if (pointer + size > memoryDataSize()) {
     return false;
   }
   uint32_t word32 = htowasm(word.u32(), true);
-  ::memcpy(wasm_memory_data(memory_.get()) + pointer, &word32, size);
+  ::memcpy(memoryData() + pointer, &word32, size);
   return true;
 }
 
-template <typename T> void assignVal(T t, wasm_val_t &val);
-template <> void assignVal<Word>(Word t, wasm_val_t &val) {
-  val.kind = WASM_I32;
+template <typename T> void assignVal(T t, wasmtime_val_t &val);
+template <> void assignVal<Word>(Word t, wasmtime_val_t &val) {
+  val.kind = WASMTIME_I32;
   val.of.i32 = static_cast<int32_t>(t.u64_);
 }
-template <> void assignVal(uint32_t t, wasm_val_t &val) {
-  val.kind = WASM_I32;
+template <> void assignVal(uint32_t t, wasmtime_val_t &val) {
+  val.kind = WASMTIME_I32;
   val.of.i32 = static_cast<int32_t>(t);
 }
-template <> void assignVal(uint64_t t, wasm_val_t &val) {
-  val.kind = WASM_I64;
+template <> void assignVal(uint64_t t, wasmtime_val_t &val) {
+  val.kind = WASMTIME_I64;
   val.of.i64 = static_cast<int64_t>(t);
 }
-template <> void assignVal(double t, wasm_val_t &val) {
-  val.kind = WASM_F64;
+template <> void assignVal(double t, wasmtime_val_t &val) {
+  val.kind = WASMTIME_F64;
   val.of.f64 = t;
 }
 
-template <typename T> wasm_val_t makeVal(T t) {
-  wasm_val_t val{};
+template <typename T> wasmtime_val_t makeVal(T t) {
+  wasmtime_val_t val{};
   assignVal(t, val);
   return val;
 }
@@ -440,6 +723,18 @@ template <> struct ConvertWordType<Word> {
   using type = uint32_t; // NOLINT(readability-identifier-naming)
 };
 
+template <typename T> constexpr wasm_valkind_t convertArgToValKind();
+template <> constexpr wasm_valkind_t convertArgToValKind<Word>() { return WASM_I32; };
+template <> constexpr wasm_valkind_t convertArgToValKind<uint32_t>() { return WASM_I32; };
+template <> constexpr wasm_valkind_t convertArgToValKind<int64_t>() { return WASM_I64; };
+template <> constexpr wasm_valkind_t convertArgToValKind<uint64_t>() { return WASM_I64; };
+template <> constexpr wasm_valkind_t convertArgToValKind<double>() { return WASM_F64; };
+
+template <typename... Args> bool equalValKinds(const std::vector<wasm_valkind_t> &kinds) {
+  constexpr std::array<wasm_valkind_t, sizeof...(Args)> expected = {convertArgToValKind<Args>()...};
+  return std::equal(kinds.begin(), kinds.end(), expected.begin(), expected.end());
+}
+
 template <typename T> auto convertArgToValTypePtr();
 template <> auto convertArgToValTypePtr<Word>() { return wasm_valtype_new_i32(); };
 template <> auto convertArgToValTypePtr<uint32_t>() { return wasm_valtype_new_i32(); };
@@ -447,22 +742,25 @@ template <> auto convertArgToValTypePtr<int64_t>() { return wasm_valtype_new_i64
 template <> auto convertArgToValTypePtr<uint64_t>() { return wasm_valtype_new_i64(); };
 template <> auto convertArgToValTypePtr<double>() { return wasm_valtype_new_f64(); };
 
-template <typename T> T convertValueTypeToArg(wasm_val_t val);
-template <> uint32_t convertValueTypeToArg<uint32_t>(wasm_val_t val) {
+template <typename T> T convertValueTypeToArg(const wasmtime_val_t &val);
+template <> uint32_t convertValueTypeToArg<uint32_t>(const wasmtime_val_t &val) {
   return static_cast<uint32_t>(val.of.i32);
 }
-template <> Word convertValueTypeToArg<Word>(wasm_val_t val) { return val.of.i32; }
-template <> int64_t convertValueTypeToArg<int64_t>(wasm_val_t val) { return val.of.i64; }
-template <> uint64_t convertValueTypeToArg<uint64_t>(wasm_val_t val) {
+template <> Word convertValueTypeToArg<Word>(const wasmtime_val_t &val) { return val.of.i32; }
+template <> int64_t convertValueTypeToArg<int64_t>(const wasmtime_val_t &val) {
+  return val.of.i64;
+}
+template <> uint64_t convertValueTypeToArg<uint64_t>(const wasmtime_val_t &val) {
   return static_cast<uint64_t>(val.of.i64);
 }
-template <> double convertValueTypeToArg<double>(wasm_val_t val) { return val.of.f64; }
+template <> double convertValueTypeToArg<double>(const wasmtime_val_t &val) { return val.of.f64; }
 
-template <typename T, typename U, std::size_t... I>
-constexpr T convertValTypesToArgsTuple(const U &vec, std::index_sequence<I...> /*comptime*/) {
+template <typename T, std::size_t... I>
+constexpr T convertValTypesToArgsTuple(const wasmtime_val_t *values,
+                                       std::index_sequence<I...> /*comptime*/) {
   return std::make_tuple(
       convertValueTypeToArg<typename ConvertWordType<std::tuple_element_t<I, T>>::type>(
-          vec->data[I])...);
+          values[I])...);
 }
 
 template <typename T, std::size_t... I>
@@ -498,128 +796,131 @@ template <typename T> WasmFunctypePtr newWasmNewFuncType() {
 template <typename... Args>
 void Wasmtime::registerHostFunctionImpl(std::string_view module_name,
                                         std::string_view function_name, void (*function)(Args...)) {
-  auto data =
-      std::make_unique<HostFuncData>(std::string(module_name) + "." + std::string(function_name));
-
-  WasmFunctypePtr type = newWasmNewFuncType<std::tuple<Args...>>();
-  WasmFuncPtr func = wasm_func_new_with_env(
-      store_.get(), type.get(),
-      [](void *data, const wasm_val_vec_t *params, wasm_val_vec_t * /*results*/) -> wasm_trap_t * {
-        auto *func_data = reinterpret_cast<HostFuncData *>(data);
-        const bool log = func_data->vm_->cmpLogLevel(LogLevel::trace);
-        if (log) {
-          func_data->vm_->integration()->trace("[vm->host] " + func_data->name_ + "(" +
-                                               printValues(params) + ")");
-        }
-        auto args = convertValTypesToArgsTuple<std::tuple<Args...>>(
-            params, std::make_index_sequence<sizeof...(Args)>{});
-        auto fn = reinterpret_cast<void (*)(Args...)>(func_data->raw_func_);
-        std::apply(fn, args);
-        if (log) {
-          func_data->vm_->integration()->trace("[vm<-host] " + func_data->name_ + " return: void");
-        }
-        return nullptr;
-      },
-      data.get(), nullptr);
+  auto name = std::string(module_name) + "." + std::string(function_name);
+  auto data = std::make_unique<HostFuncData>(name);
+  data->make_callback_ = [](wasmtime_context_t *context, HostFuncData *env) -> wasmtime_func_t {
+    static const WasmFunctypePtr type = newWasmNewFuncType<std::tuple<Args...>>();
+    wasmtime_func_t func;
+    wasmtime_func_new(
+        context, type.get(),
+        [](void *data, wasmtime_caller_t * /*caller*/, const wasmtime_val_t *params,
+           size_t nparams, wasmtime_val_t * /*results*/, size_t /*nresults*/) -> wasm_trap_t * {
+          auto *func_data = reinterpret_cast<HostFuncData *>(data);
+          const bool log = func_data->vm_->cmpLogLevel(LogLevel::trace);
+          if (log) {
+            func_data->vm_->integration()->trace("[vm->host] " + func_data->name_ + "(" +
+                                                 printValues(params, nparams) + ")");
+          }
+          auto args = convertValTypesToArgsTuple<std::tuple<Args...>>(
+              params, std::make_index_sequence<sizeof...(Args)>{});
+          auto fn = reinterpret_cast<void (*)(Args...)>(func_data->raw_func_);
+          std::apply(fn, args);
+          if (log) {
+            func_data->vm_->integration()->trace("[vm<-host] " + func_data->name_ +
+                                                 " return: void");
+          }
+          return nullptr;
+        },
+        env, nullptr, &func);
+    return func;
+  };
 
   data->vm_ = this;
-  data->callback_ = std::move(func);
   data->raw_func_ = reinterpret_cast<void *>(function);
-  host_functions_.insert_or_assign(std::string(module_name) + "." + std::string(function_name),
-                                   std::move(data));
+  host_functions_.insert_or_assign(std::move(name), std::move(data));
 };
 
 template <typename R, typename... Args>
 void Wasmtime::registerHostFunctionImpl(std::string_view module_name,
                                         std::string_view function_name, R (*function)(Args...)) {
-  auto data =
-      std::make_unique<HostFuncData>(std::string(module_name) + "." + std::string(function_name));
-  WasmFunctypePtr type = newWasmNewFuncType<R, std::tuple<Args...>>();
-  WasmFuncPtr func = wasm_func_new_with_env(
-      store_.get(), type.get(),
-      [](void *data, const wasm_val_vec_t *params, wasm_val_vec_t *results) -> wasm_trap_t * {
-        auto *func_data = reinterpret_cast<HostFuncData *>(data);
-        const bool log = func_data->vm_->cmpLogLevel(LogLevel::trace);
-        if (log) {
-          func_data->vm_->integration()->trace("[vm->host] " + func_data->name_ + "(" +
-                                               printValues(params) + ")");
-        }
-        auto args = convertValTypesToArgsTuple<std::tuple<Args...>>(
-            params, std::make_index_sequence<sizeof...(Args)>{});
-        auto fn = reinterpret_cast<R (*)(Args...)>(func_data->raw_func_);
-        R res = std::apply(fn, args);
-        assignVal<R>(res, results->data[0]);
-        if (log) {
-          func_data->vm_->integration()->trace("[vm<-host] " + func_data->name_ +
-                                               " return: " + std::to_string(res));
-        }
-        return nullptr;
-      },
-      data.get(), nullptr);
+  auto name = std::string(module_name) + "." + std::string(function_name);
+  auto data = std::make_unique<HostFuncData>(name);
+  data->make_callback_ = [](wasmtime_context_t *context, HostFuncData *env) -> wasmtime_func_t {
+    static const WasmFunctypePtr type = newWasmNewFuncType<R, std::tuple<Args...>>();
+    wasmtime_func_t func;
+    wasmtime_func_new(
+        context, type.get(),
+        [](void *data, wasmtime_caller_t * /*caller*/, const wasmtime_val_t *params,
+           size_t nparams, wasmtime_val_t *results, size_t /*nresults*/) -> wasm_trap_t * {
+          auto *func_data = reinterpret_cast<HostFuncData *>(data);
+          const bool log = func_data->vm_->cmpLogLevel(LogLevel::trace);
+          if (log) {
+            func_data->vm_->integration()->trace("[vm->host] " + func_data->name_ + "(" +
+                                                 printValues(params, nparams) + ")");
+          }
+          auto args = convertValTypesToArgsTuple<std::tuple<Args...>>(
+              params, std::make_index_sequence<sizeof...(Args)>{});
+          auto fn = reinterpret_cast<R (*)(Args...)>(func_data->raw_func_);
+          R res = std::apply(fn, args);
+          assignVal<R>(res, results[0]);
+          if (log) {
+            func_data->vm_->integration()->trace("[vm<-host] " + func_data->name_ +
+                                                 " return: " + std::to_string(res));
+          }
+          return nullptr;
+        },
+        env, nullptr, &func);
+    return func;
+  };
 
   data->vm_ = this;
-  data->callback_ = std::move(func);
   data->raw_func_ = reinterpret_cast<void *>(function);
-  host_functions_.insert_or_assign(std::string(module_name) + "." + std::string(function_name),
-                                   std::move(data));
+  host_functions_.insert_or_assign(std::move(name), std::move(data));
 };
 
 template <typename... Args>
 void Wasmtime::getModuleFunctionImpl(std::string_view function_name,
                                      std::function<void(ContextBase *, Args...)> *function) {
 
-  auto it = module_functions_.find(std::string(function_name));
-  if (it == module_functions_.end()) {
+  const auto *binding = getModuleFunctionBinding(function_name);
+  if (binding == nullptr) {
     *function = nullptr;
     return;
   }
+  const wasmtime_func_t func = module_functions_[binding->index];
 
-  WasmValtypeVec exp_args;
-  WasmValtypeVec exp_returns;
-  convertArgsTupleToValTypes<std::tuple<Args...>>(exp_args.get());
-  convertArgsTupleToValTypes<std::tuple<>>(exp_returns.get());
-  wasm_func_t *func = it->second.get();
-  WasmFunctypePtr func_type = wasm_func_type(func);
-
-  if (!equalValTypes(wasm_functype_params(func_type.get()), exp_args.get()) ||
-      !equalValTypes(wasm_functype_results(func_type.get()), exp_returns.get())) {
+  if (!equalValKinds<Args...>(binding->params) || !equalValKinds<>(binding->results)) {
+    WasmValtypeVec exp_args;
+    WasmValtypeVec exp_returns;
+    convertArgsTupleToValTypes<std::tuple<Args...>>(exp_args.get());
+    convertArgsTupleToValTypes<std::tuple<>>(exp_returns.get());
     fail(FailState::UnableToInitializeCode,
-         "Bad function signature for: " + std::string(function_name) + ", want: " +
-             printValTypes(exp_args.get()) + " -> " + printValTypes(exp_returns.get()) +
-             ", but the module exports: " + printValTypes(wasm_functype_params(func_type.get())) +
-             " -> " + printValTypes(wasm_functype_results(func_type.get())));
+         "Bad function signature for: " + std::string(function_name) +
+             ", want: " + printValTypes(exp_args.get()) + " -> " +
+             printValTypes(exp_returns.get()) +
+             ", but the module exports: " + getFunctionTypeString(func));
     return;
   }
 
   *function = [func, function_name, this](ContextBase *context, Args... args) -> void {
     const bool log = cmpLogLevel(LogLevel::trace);
     SaveRestoreContext saved_context(context);
-    wasm_val_vec_t results = WASM_EMPTY_VEC;
-    WasmTrapPtr trap;
-
-    // Workaround for MSVC++ not supporting zero-sized arrays.
-    if constexpr (sizeof...(args) > 0) {
-      wasm_val_t params_arr[] = {makeVal(args)...};
-      wasm_val_vec_t params = WASM_ARRAY_VEC(params_arr);
-      if (log) {
-        integration()->trace("[host->vm] " + std::string(function_name) + "(" +
-                             printValues(&params) + ")");
-      }
-      trap.reset(wasm_func_call(func, &params, &results));
-    } else {
-      wasm_val_vec_t params = WASM_EMPTY_VEC;
-      if (log) {
-        integration()->trace("[host->vm] " + std::string(function_name) + "()");
-      }
-      trap.reset(wasm_func_call(func, &params, &results));
+    ExecutionDeadline deadline(this);
+    // Arguments are passed on the stack, without allocating a vector per call.
+    const std::array<wasmtime_val_t, sizeof...(Args)> params = {makeVal(args)...};
+    if (log) {
+      integration()->trace("[host->vm] " + std::string(function_name) + "(" +
+                           printValues(params.data(), params.size()) + ")");
+    }
+
+    wasm_trap_t *trap_ptr = nullptr;
+    WasmtimeErrorPtr error;
+    {
+      EpochDeadline epoch_deadline(context_, deadline, executionTimeout());
+      error = wasmtime_func_call(context_, &func, params.data(), params.size(), nullptr, 0,
+                                 &trap_ptr);
     }
+    WasmTrapPtr trap(trap_ptr);
 
-    if (trap) {
-      WasmByteVec error_message;
-      wasm_trap_message(trap.get(), error_message.get());
-      std::string message(error_message.get()->data); // NULL-terminated
+    if (deadline.disarm()) {
+      fail(FailState::RuntimeError,
+           "Function: " + std::string(function_name) + " failed: execution timeout exceeded");
+      return;
+    }
+    if (error != nullptr || trap != nullptr) {
       fail(FailState::RuntimeError,
-           "Function: " + std::string(function_name) + " failed: " + message);
+           "Function: " + std::string(function_name) + " failed: " +
+               (error != nullptr ? getErrorMessage(error.get()) : getTrapMessage(trap.get())));
       return;
     }
     if (log) {
@@ -631,60 +932,59 @@ void Wasmtime::getModuleFunctionImpl(std::string_view function_name,
 template <typename R, typename... Args>
 void Wasmtime::getModuleFunctionImpl(std::string_view function_name,
                                      std::function<R(ContextBase *, Args...)> *function) {
-  auto it = module_functions_.find(std::string(function_name));
-  if (it == module_functions_.end()) {
+  const auto *binding = getModuleFunctionBinding(function_name);
+  if (binding == nullptr) {
     *function = nullptr;
     return;
   }
-  WasmValtypeVec exp_args;
-  WasmValtypeVec exp_returns;
-  convertArgsTupleToValTypes<std::tuple<Args...>>(exp_args.get());
-  convertArgsTupleToValTypes<std::tuple<R>>(exp_returns.get());
-  wasm_func_t *func = it->second.get();
-  WasmFunctypePtr func_type = wasm_func_type(func);
-  if (!equalValTypes(wasm_functype_params(func_type.get()), exp_args.get()) ||
-      !equalValTypes(wasm_functype_results(func_type.get()), exp_returns.get())) {
+  const wasmtime_func_t func = module_functions_[binding->index];
+
+  if (!equalValKinds<Args...>(binding->params) || !equalValKinds<R>(binding->results)) {
+    WasmValtypeVec exp_args;
+    WasmValtypeVec exp_returns;
+    convertArgsTupleToValTypes<std::tuple<Args...>>(exp_args.get());
+    convertArgsTupleToValTypes<std::tuple<R>>(exp_returns.get());
     fail(FailState::UnableToInitializeCode,
-         "Bad function signature for: " + std::string(function_name) + ", want: " +
-             printValTypes(exp_args.get()) + " -> " + printValTypes(exp_returns.get()) +
-             ", but the module exports: " + printValTypes(wasm_functype_params(func_type.get())) +
-             " -> " + printValTypes(wasm_functype_results(func_type.get())));
+         "Bad function signature for: " + std::string(function_name) +
+             ", want: " + printValTypes(exp_args.get()) + " -> " +
+             printValTypes(exp_returns.get()) +
+             ", but the module exports: " + getFunctionTypeString(func));
     return;
   }
 
   *function = [func, function_name, this](ContextBase *context, Args... args) -> R {
     const bool log = cmpLogLevel(LogLevel::trace);
     SaveRestoreContext saved_context(context);
-    wasm_val_t results_arr[1];
-    wasm_val_vec_t results = WASM_ARRAY_VEC(results_arr);
-    WasmTrapPtr trap;
-
-    // Workaround for MSVC++ not supporting zero-sized arrays.
-    if constexpr (sizeof...(args) > 0) {
-      wasm_val_t params_arr[] = {makeVal(args)...};
-      wasm_val_vec_t params = WASM_ARRAY_VEC(params_arr);
-      if (log) {
-        integration()->trace("[host->vm] " + std::string(function_name) + "(" +
-                             printValues(&params) + ")");
-      }
-      trap.reset(wasm_func_call(func, &params, &results));
-    } else {
-      wasm_val_vec_t params = WASM_EMPTY_VEC;
-      if (log) {
-        integration()->trace("[host->vm] " + std::string(function_name) + "()");
-      }
-      trap.reset(wasm_func_call(func, &params, &results));
+    ExecutionDeadline deadline(this);
+    // Arguments and results are passed on the stack, without allocating a vector per call.
+    const std::array<wasmtime_val_t, sizeof...(Args)> params = {makeVal(args)...};
+    std::array<wasmtime_val_t, 1> results{};
+    if (log) {
+      integration()->trace("[host->vm] " + std::string(function_name) + "(" +
+                           printValues(params.data(), params.size()) + ")");
     }
 
-    if (trap) {
-      WasmByteVec error_message;
-      wasm_trap_message(trap.get(), error_message.get());
-      std::string message(error_message.get()->data); // NULL-terminated
+    wasm_trap_t *trap_ptr = nullptr;
+    WasmtimeErrorPtr error;
+    {
+      EpochDeadline epoch_deadline(context_, deadline, executionTimeout());
+      error = wasmtime_func_call(context_, &func, params.data(), params.size(), results.data(),
+                                 results.size(), &trap_ptr);
+    }
+    WasmTrapPtr trap(trap_ptr);
+
+    if (deadline.disarm()) {
+      fail(FailState::RuntimeError,
+           "Function: " + std::string(function_name) + " failed: execution timeout exceeded");
+      return R{};
+    }
+    if (error != nullptr || trap != nullptr) {
       fail(FailState::RuntimeError,
-           "Function: " + std::string(function_name) + " failed: " + message);
+           "Function: " + std::string(function_name) + " failed: " +
+               (error != nullptr ? getErrorMessage(error.get()) : getTrapMessage(trap.get())));
       return R{};
     }
-    R ret = convertValueTypeToArg<R>(results.data[0]);
+    R ret = convertValueTypeToArg<R>(results[0]);
     if (log) {
       integration()->trace("[host<-vm] " + std::string(function_name) +
                            " return: " + std::to_string(ret));
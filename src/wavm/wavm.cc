@@ -88,12 +88,17 @@ namespace {
   do {                                                                                             \
     try {                                                                                          \
       SaveRestoreContext _saved_context(static_cast<ContextBase *>(_context));                     \
+      ExecutionDeadline _deadline(_wavm);                                                          \
       WAVM::Runtime::catchRuntimeExceptions(                                                       \
           [&] { _x; },                                                                             \
           [&](WAVM::Runtime::Exception *exception) {                                               \
             _wavm->fail(FailState::RuntimeError, getFailMessage(function_name, exception));        \
             throw std::exception();                                                                \
           });                                                                                      \
+      if (_deadline.disarm()) {                                                                    \
+        _wavm->fail(FailState::RuntimeError, "Function: " + std::string(function_name) +           \
+                                                 " failed: execution timeout exceeded");           \
+      }                                                                                            \
     } catch (...) {                                                                                \
     }                                                                                              \
   } while (0)
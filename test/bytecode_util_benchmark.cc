@@ -0,0 +1,173 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "include/proxy-wasm/bytecode_util.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "benchmark/benchmark.h"
+
+namespace proxy_wasm {
+namespace {
+
+// Measures the time needed to parse a large (~32MB, similar to Go and .NET plugins) module when
+// loading it, either with one pass over the bytecode per query or with a single ModuleIndex.
+constexpr uint32_t kNumFunctions = 50000;
+constexpr size_t kFunctionBodySize = 640;
+
+void appendVarint(std::string &out, uint32_t value) {
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    if (value != 0) {
+      byte |= 0x80;
+    }
+    out.push_back(static_cast<char>(byte));
+  } while (value != 0);
+}
+
+void appendSection(std::string &out, uint8_t id, const std::string &contents) {
+  out.push_back(static_cast<char>(id));
+  appendVarint(out, contents.size());
+  out.append(contents);
+}
+
+void appendName(std::string &out, const std::string &name) {
+  appendVarint(out, name.size());
+  out.append(name);
+}
+
+std::string makeLargeModule() {
+  std::string module = {0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00};
+  appendSection(module, 1 /* type */, {0x01, 0x60, 0x00, 0x00});
+
+  std::string functions;
+  appendVarint(functions, kNumFunctions);
+  for (uint32_t i = 0; i < kNumFunctions; i++) {
+    functions.push_back(0x00);
+  }
+  appendSection(module, 3 /* function */, functions);
+
+  std::string exports;
+  appendVarint(exports, kNumFunctions + 1);
+  appendName(exports, "proxy_abi_version_0_2_0");
+  exports.push_back(0x00);
+  appendVarint(exports, 0);
+  for (uint32_t i = 0; i < kNumFunctions; i++) {
+    appendName(exports, "function_" + std::to_string(i));
+    exports.push_back(0x00);
+    appendVarint(exports, i);
+  }
+  appendSection(module, 7 /* export */, exports);
+
+  std::string code;
+  appendVarint(code, kNumFunctions);
+  std::string body(kFunctionBodySize - 1, 0x01 /* nop */);
+  body.push_back(0x0b /* end */);
+  for (uint32_t i = 0; i < kNumFunctions; i++) {
+    appendVarint(code, body.size() + 1);
+    code.push_back(0x00 /* no locals */);
+    code.append(body);
+  }
+  appendSection(module, 10 /* code */, code);
+
+  std::string function_names;
+  appendVarint(function_names, kNumFunctions);
+  for (uint32_t i = 0; i < kNumFunctions; i++) {
+    auto name = "f" + std::to_string(i);
+    appendVarint(function_names, i);
+    appendName(function_names, "_ZN9benchmark" + std::to_string(name.size()) + name + "Ev");
+  }
+  std::string names;
+  appendName(names, "name");
+  names.push_back(0x01 /* function names */);
+  appendVarint(names, function_names.size());
+  names.append(function_names);
+  appendSection(module, 0 /* custom */, names);
+
+  return module;
+}
+
+const std::string &largeModule() {
+  static const auto *module = new std::string(makeLargeModule());
+  return *module;
+}
+
+// The queries run by WasmBase::load(), each parsing the bytecode from the start.
+void BM_LoadWithPerQueryPasses(benchmark::State &state) {
+  const auto &module = largeModule();
+  for (auto _ : state) {
+    std::string_view section;
+    AbiVersion abi_version;
+    std::unordered_map<uint32_t, std::string> function_names;
+    std::string stripped;
+    if (!BytecodeUtil::getCustomSection(module, "signature_wasmsign", section) ||
+        !BytecodeUtil::getAbiVersion(module, abi_version) ||
+        abi_version != AbiVersion::ProxyWasm_0_2_0 ||
+        !BytecodeUtil::getFunctionNameIndex(module, function_names) ||
+        function_names.size() != kNumFunctions ||
+        !BytecodeUtil::getCustomSection(module, "precompiled_test", section) ||
+        !BytecodeUtil::getStrippedSource(module, stripped)) {
+      state.SkipWithError("Failed to parse the module");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * module.size());
+}
+
+// The same queries, sharing a single ModuleIndex.
+void BM_LoadWithModuleIndex(benchmark::State &state) {
+  const auto &module = largeModule();
+  for (auto _ : state) {
+    ModuleIndex index;
+    std::string_view section;
+    AbiVersion abi_version;
+    std::unordered_map<uint32_t, std::string> function_names;
+    std::string stripped;
+    if (!BytecodeUtil::getModuleIndex(module, index) ||
+        !BytecodeUtil::getCustomSection(index, "signature_wasmsign", section) ||
+        !BytecodeUtil::getAbiVersion(index, abi_version) ||
+        abi_version != AbiVersion::ProxyWasm_0_2_0 ||
+        !BytecodeUtil::getFunctionNameIndex(index, function_names) ||
+        function_names.size() != kNumFunctions ||
+        !BytecodeUtil::getCustomSection(index, "precompiled_test", section) ||
+        !BytecodeUtil::getStrippedSource(index, stripped)) {
+      state.SkipWithError("Failed to parse the module");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * module.size());
+}
+
+// Building the index alone.
+void BM_BuildModuleIndex(benchmark::State &state) {
+  const auto &module = largeModule();
+  for (auto _ : state) {
+    ModuleIndex index;
+    if (!BytecodeUtil::getModuleIndex(module, index)) {
+      state.SkipWithError("Failed to index the module");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * module.size());
+}
+
+BENCHMARK(BM_LoadWithPerQueryPasses)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_LoadWithModuleIndex)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BuildModuleIndex)->Unit(benchmark::kMillisecond);
+
+} // namespace
+} // namespace proxy_wasm
@@ -53,6 +53,86 @@ TEST(TestBytecodeUtil, getCustomSection) {
   EXPECT_FALSE(BytecodeUtil::getCustomSection(corrupted, "hey", section));
 }
 
+TEST(TestBytecodeUtil, getModuleIndex) {
+  std::string source = {
+      0x00, 0x61, 0x73, 0x6d, // Wasm magic
+      0x01, 0x00, 0x00, 0x00, // Wasm version
+      0x01, 0x04,             // type section
+      0x01, 0x60, 0x00, 0x00, // (func)
+      0x02, 0x0b,             // import section
+      0x01, 0x03, 0x65, 0x6e, 0x76, 0x03, 0x6c, 0x6f, 0x67, 0x00, 0x00, // "env" "log" (func 0)
+      0x03, 0x02,                                                       // function section
+      0x01, 0x00,                                                       // (func 0)
+      0x07, 0x1b,                                                       // export section
+      0x01, 0x17, 0x70, 0x72, 0x6f, 0x78, 0x79, 0x5f, 0x61, 0x62, 0x69, 0x5f, 0x76, 0x65, 0x72,
+      0x73, 0x69, 0x6f, 0x6e, 0x5f, 0x30, 0x5f, 0x32, 0x5f, 0x30, 0x00, 0x01, // (func 1)
+      0x0a, 0x04,                                                             // code section
+      0x01, 0x02, 0x00, 0x0b,                                                 // (func 1)
+      0x00, 0x0a,                                                             // custom section
+      0x04, 0x68, 0x65, 0x79, 0x21,                                           // name: "hey!"
+      0x68, 0x65, 0x6c, 0x6c, 0x6f,                                           // content: "hello"
+  };
+  ModuleIndex index;
+  ASSERT_TRUE(BytecodeUtil::getModuleIndex(source, index));
+
+  ASSERT_EQ(index.sections.size(), 6);
+  EXPECT_EQ(index.sections[1].id, 2);
+  EXPECT_EQ(index.sections[5].id, 0);
+  EXPECT_EQ(index.sections[5].name, "hey!");
+  EXPECT_EQ(index.sections[5].contents, "hello");
+  EXPECT_EQ(index.sections[5].raw, source.substr(source.size() - 12));
+
+  ASSERT_EQ(index.imports.size(), 1);
+  EXPECT_EQ(index.imports[0].module, "env");
+  EXPECT_EQ(index.imports[0].name, "log");
+  EXPECT_EQ(index.imports[0].kind, 0);
+
+  ASSERT_EQ(index.exports.size(), 1);
+  EXPECT_EQ(index.exports[0].name, "proxy_abi_version_0_2_0");
+  EXPECT_EQ(index.exports[0].kind, 0);
+  EXPECT_EQ(index.exports[0].index, 1);
+
+  // Queries reuse the index.
+  AbiVersion abi_version;
+  EXPECT_TRUE(BytecodeUtil::getAbiVersion(index, abi_version));
+  EXPECT_EQ(abi_version, AbiVersion::ProxyWasm_0_2_0);
+  std::string_view section = {};
+  EXPECT_TRUE(BytecodeUtil::getCustomSection(index, "hey!", section));
+  EXPECT_EQ(section, "hello");
+
+  // Fail due to the corrupted bytecode.
+  EXPECT_FALSE(BytecodeUtil::getModuleIndex(source.substr(0, 20), index));
+}
+
+TEST(TestBytecodeUtil, parseSection) {
+  std::string section = {
+      0x00,                         // custom section id
+      0x0a,                         // section length
+      0x04, 0x68, 0x65, 0x79, 0x21, // section name: "hey!"
+      0x68, 0x65, 0x6c, 0x6c, 0x6f, // content: "hello"
+  };
+  ModuleIndex index;
+  size_t size = 0;
+
+  // Incomplete sections.
+  for (size_t i = 0; i < section.size(); i++) {
+    EXPECT_TRUE(BytecodeUtil::parseSection(section.substr(0, i), index, size));
+    EXPECT_EQ(size, 0);
+  }
+  EXPECT_TRUE(index.sections.empty());
+
+  // Complete section, followed by the next one.
+  const auto sections = section + section;
+  EXPECT_TRUE(BytecodeUtil::parseSection(sections, index, size));
+  EXPECT_EQ(size, section.size());
+  ASSERT_EQ(index.sections.size(), 1);
+  EXPECT_EQ(index.sections[0].name, "hey!");
+
+  // Fail due to the corrupted section length.
+  const std::string corrupted("\x00\xff\xff\xff\xff\x7f", 6);
+  EXPECT_FALSE(BytecodeUtil::parseSection(corrupted, index, size));
+}
+
 TEST(TestBytecodeUtil, getFunctionNameIndex) {
   const auto source = readTestWasmFile("abi_export.wasm");
   std::unordered_map<uint32_t, std::string> actual;
@@ -79,6 +159,45 @@ TEST(TestBytecodeUtil, getFunctionNameIndex) {
   EXPECT_TRUE(actual.empty());
 }
 
+TEST(TestBytecodeUtil, getMutableGlobals) {
+  std::string source = {
+      0x00, 0x61, 0x73, 0x6d, // Wasm magic
+      0x01, 0x00, 0x00, 0x00, // Wasm version
+      0x02, 0x0a,             // import section
+      0x01, 0x03, 0x65, 0x6e, 0x76, 0x01, 0x67, 0x03, 0x7f, 0x00, // "env" "g" (global 0)
+      0x06, 0x10,                                                 // global section
+      0x03, 0x7f, 0x01, 0x41, 0x10, 0x0b,             // (global 1 (mut i32) (i32.const 16))
+      0x7f, 0x00, 0x41, 0x08, 0x0b,                   // (global 2 i32 (i32.const 8))
+      0x7e, 0x01, 0x42, 0x00, 0x0b,                   // (global 3 (mut i64) (i64.const 0))
+      0x07, 0x0b,                                     // export section
+      0x01, 0x07, 0x63, 0x6f, 0x75, 0x6e, 0x74, 0x65, 0x72, 0x03, 0x03, // "counter" (global 3)
+      0x00, 0x19,                                                       // custom section
+      0x04, 0x6e, 0x61, 0x6d, 0x65,                                     // name: "name"
+      0x07, 0x12, 0x01, 0x01, 0x0f,                                     // global 1 name:
+      0x5f, 0x5f, 0x73, 0x74, 0x61, 0x63, 0x6b, 0x5f, 0x70, 0x6f, 0x69, 0x6e, 0x74, 0x65,
+      0x72, // "__stack_pointer"
+  };
+  ModuleIndex index;
+  ASSERT_TRUE(BytecodeUtil::getModuleIndex(source, index));
+  std::vector<std::string_view> actual;
+  EXPECT_TRUE(BytecodeUtil::getMutableGlobals(index, actual));
+  EXPECT_EQ(actual, std::vector<std::string_view>({"__stack_pointer", "counter"}));
+
+  // Unnamed globals, without the "name" section and the exports.
+  const std::string unnamed = source.substr(0, 38);
+  ASSERT_TRUE(BytecodeUtil::getModuleIndex(unnamed, index));
+  actual = {};
+  EXPECT_TRUE(BytecodeUtil::getMutableGlobals(index, actual));
+  EXPECT_EQ(actual, std::vector<std::string_view>({"", ""}));
+
+  // Fail due to the unsupported initializer (local.get 0).
+  std::string corrupted = unnamed;
+  corrupted[25] = 0x20;
+  ASSERT_TRUE(BytecodeUtil::getModuleIndex(corrupted, index));
+  actual = {};
+  EXPECT_FALSE(BytecodeUtil::getMutableGlobals(index, actual));
+}
+
 TEST(TestBytecodeUtil, getStrippedSource) {
   // Unmodified case.
   auto source = readTestWasmFile("abi_export.wasm");
@@ -116,6 +235,30 @@ TEST(TestBytecodeUtil, getStrippedSource) {
   EXPECT_EQ(actual.size(), source.size() - custom_section.size());
 }
 
+TEST(TestBytecodeUtil, getStrippedSourceWithoutCopy) {
+  // Unmodified case, the original bytecode is shared.
+  auto source = BytecodeUtil::makeBytecode(readTestWasmFile("abi_export.wasm"));
+  WasmBytecodePtr actual;
+  EXPECT_TRUE(BytecodeUtil::getStrippedSource(source, actual));
+  EXPECT_EQ(actual, source);
+
+  // Append "precompiled_test" custom section.
+  std::string custom_section = {0x00, 0x13, 0x10, 0x70, 0x72, 0x65, 0x63, 0x6f, 0x6d, 0x70, 0x69,
+                                0x6c, 0x65, 0x64, 0x5f, 0x74, 0x65, 0x73, 0x74, 0x01, 0x01};
+  auto source_with_section = BytecodeUtil::makeBytecode(std::string(*source) + custom_section);
+  EXPECT_TRUE(BytecodeUtil::getStrippedSource(source_with_section, actual));
+  ASSERT_NE(actual, source_with_section);
+  EXPECT_EQ(*actual, *source);
+}
+
+TEST(TestBytecodeUtil, mapBytecodeFile) {
+  EXPECT_EQ(BytecodeUtil::mapBytecodeFile("test/test_data/missing.wasm"), nullptr);
+
+  auto mapped = BytecodeUtil::mapBytecodeFile("test/test_data/abi_export.wasm");
+  ASSERT_NE(mapped, nullptr);
+  EXPECT_EQ(*mapped, readTestWasmFile("abi_export.wasm"));
+}
+
 TEST(TestBytecodeUtil, getAbiVersion) {
   const auto source = readTestWasmFile("abi_export.wasm");
   proxy_wasm::AbiVersion actual;
@@ -0,0 +1,82 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "include/proxy-wasm/compiled_module_cache.h"
+
+#include <filesystem>
+#include <random>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace proxy_wasm {
+namespace {
+
+class FileCompiledModuleCacheTest : public testing::Test {
+protected:
+  void SetUp() override {
+    auto path = std::filesystem::temp_directory_path() /
+                ("cache_" + std::to_string(std::random_device()()));
+    ASSERT_TRUE(std::filesystem::create_directory(path));
+    directory_ = path.string();
+  }
+
+  void TearDown() override {
+    std::error_code ec;
+    std::filesystem::remove_all(directory_, ec);
+  }
+
+  std::string directory_;
+};
+
+TEST_F(FileCompiledModuleCacheTest, PutAndGet) {
+  FileCompiledModuleCache cache(directory_);
+  EXPECT_EQ(nullptr, cache.get("key"));
+
+  cache.put("key", "compiled module");
+  auto compiled = cache.get("key");
+  ASSERT_NE(nullptr, compiled);
+  EXPECT_EQ("compiled module", *compiled);
+  EXPECT_EQ(nullptr, cache.get("other"));
+
+  // Replacing a module doesn't affect readers of the previous one.
+  cache.put("key", "new compiled module");
+  EXPECT_EQ("compiled module", *compiled);
+  EXPECT_EQ("new compiled module", *cache.get("key"));
+
+  // A new cache instance (e.g. after a restart) sees the stored modules.
+  FileCompiledModuleCache restarted(directory_);
+  EXPECT_EQ("new compiled module", *restarted.get("key"));
+}
+
+TEST_F(FileCompiledModuleCacheTest, InvalidKeys) {
+  FileCompiledModuleCache cache(directory_);
+  for (const auto *key : {"", "../key", ".key", "a/b"}) {
+    cache.put(key, "compiled module");
+    EXPECT_EQ(nullptr, cache.get(key));
+  }
+}
+
+TEST(CompiledModuleCache, Global) {
+  EXPECT_EQ(nullptr, getCompiledModuleCache());
+  auto cache = std::make_shared<FileCompiledModuleCache>("/nonexistent");
+  setCompiledModuleCache(cache);
+  EXPECT_EQ(cache, getCompiledModuleCache());
+  EXPECT_EQ(nullptr, getCompiledModuleCache()->get("key"));
+  setCompiledModuleCache(nullptr);
+  EXPECT_EQ(nullptr, getCompiledModuleCache());
+}
+
+} // namespace
+} // namespace proxy_wasm
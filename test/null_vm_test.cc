@@ -14,17 +14,36 @@
 
 #include "include/proxy-wasm/wasm_vm.h"
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 #include "include/proxy-wasm/null.h"
+#include "include/proxy-wasm/null_vm.h"
 #include "include/proxy-wasm/null_vm_plugin.h"
 
 #include "gtest/gtest.h"
 
+#include "test/utility.h"
+
 namespace proxy_wasm {
 
 class TestNullVmPlugin : public NullVmPlugin {
 public:
   TestNullVmPlugin() = default;
   ~TestNullVmPlugin() override = default;
+
+  using NullVmPlugin::getFunction;
+  void getFunction(std::string_view function_name, WasmCallWord<1> *f) override {
+    if (function_name == "sleep") {
+      *f = [](ContextBase *, Word duration_ms) -> Word {
+        std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms.u64_));
+        return duration_ms;
+      };
+    } else {
+      *f = nullptr;
+    }
+  }
 };
 
 TestNullVmPlugin *test_null_vm_plugin = nullptr;
@@ -79,4 +98,77 @@ TEST_F(BaseVmTest, ByteOrder) {
   EXPECT_FALSE(wasm_vm->usesWasmByteOrder());
 }
 
+// NullVm which records interruptions, since native code cannot be interrupted.
+class InterruptibleNullVm : public NullVm {
+public:
+  bool interrupt() override {
+    interrupted_ = true;
+    return true;
+  }
+
+  std::atomic<bool> interrupted_ = false;
+};
+
+TEST_F(BaseVmTest, ExecutionDeadline) {
+  InterruptibleNullVm wasm_vm;
+
+  // No deadline without an execution timeout.
+  {
+    ExecutionDeadline deadline(&wasm_vm);
+    EXPECT_FALSE(deadline.disarm());
+  }
+
+  // Calls within the timeout aren't interrupted.
+  wasm_vm.setExecutionTimeout(std::chrono::milliseconds(1000));
+  {
+    ExecutionDeadline deadline(&wasm_vm);
+    EXPECT_FALSE(ExecutionDeadline::exceeded());
+    EXPECT_FALSE(deadline.disarm());
+  }
+  EXPECT_FALSE(wasm_vm.interrupted_);
+
+  // Calls exceeding the timeout are interrupted, including their reentrant calls.
+  wasm_vm.setExecutionTimeout(std::chrono::milliseconds(1));
+  {
+    ExecutionDeadline deadline(&wasm_vm);
+    auto start = std::chrono::steady_clock::now();
+    while (!wasm_vm.interrupted_ &&
+           std::chrono::steady_clock::now() - start < std::chrono::seconds(10)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(wasm_vm.interrupted_);
+    EXPECT_TRUE(ExecutionDeadline::exceeded());
+    {
+      ExecutionDeadline reentrant_deadline(&wasm_vm);
+      EXPECT_FALSE(reentrant_deadline.disarm());
+    }
+    EXPECT_TRUE(deadline.disarm());
+  }
+  EXPECT_FALSE(ExecutionDeadline::exceeded());
+}
+
+TEST_F(BaseVmTest, NullVmExecutionTimeout) {
+  auto wasm_vm = createNullVm();
+  auto *integration = new TestIntegration;
+  wasm_vm->integration().reset(integration);
+  ASSERT_TRUE(wasm_vm->load("test_null_vm_plugin", {}, {}));
+  WasmCallWord<1> sleep;
+  wasm_vm->getFunction("sleep", &sleep);
+  ASSERT_TRUE(sleep != nullptr);
+
+  // Native code can't be interrupted.
+  EXPECT_TRUE(wasm_vm->setExecutionTimeout(std::chrono::milliseconds(0)));
+  EXPECT_FALSE(wasm_vm->setExecutionTimeout(std::chrono::milliseconds(1000)));
+
+  // Calls within the timeout succeed.
+  EXPECT_EQ(sleep(nullptr, 1), 1);
+  EXPECT_FALSE(wasm_vm->isFailed());
+
+  // Calls exceeding the timeout fail the VM once they return.
+  EXPECT_FALSE(wasm_vm->setExecutionTimeout(std::chrono::milliseconds(1)));
+  EXPECT_EQ(sleep(nullptr, 100), 100);
+  EXPECT_TRUE(wasm_vm->isFailed());
+  EXPECT_TRUE(integration->isErrorLogged("Function: sleep failed: execution timeout exceeded"));
+}
+
 } // namespace proxy_wasm
@@ -14,6 +14,7 @@
 
 #include "gtest/gtest.h"
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <thread>
@@ -111,6 +112,30 @@ TEST_P(TestVm, TerminateExecution) {
   EXPECT_TRUE(host->isErrorLogged("termination_exception"));
 }
 
+TEST_P(TestVm, ExecutionTimeout) {
+  // Other engines can only stop the call when it calls a host function, and say so.
+  EXPECT_EQ(engine_ == "v8" || engine_ == "wasmtime", vm_->supportsInterrupt());
+  if (!vm_->supportsInterrupt()) {
+    EXPECT_FALSE(vm_->setExecutionTimeout(std::chrono::milliseconds(100)));
+    return;
+  }
+  auto source = readTestWasmFile("resource_limits.wasm");
+  ASSERT_FALSE(source.empty());
+  auto wasm = TestWasm(std::move(vm_));
+  ASSERT_TRUE(wasm.load(source, false));
+  ASSERT_TRUE(wasm.initialize());
+  EXPECT_TRUE(wasm.wasm_vm()->setExecutionTimeout(std::chrono::milliseconds(100)));
+
+  WasmCallVoid<0> infinite_loop;
+  wasm.wasm_vm()->getFunction("infinite_loop", &infinite_loop);
+  ASSERT_TRUE(infinite_loop != nullptr);
+  infinite_loop(wasm.vm_context());
+
+  // Check integration logs.
+  auto *host = dynamic_cast<TestIntegration *>(wasm.wasm_vm()->integration().get());
+  EXPECT_TRUE(host->isErrorLogged("Function: infinite_loop failed: execution timeout exceeded"));
+}
+
 TEST_P(TestVm, WasmMemoryLimit) {
   // TODO(PiotrSikora): enforce memory limits in other engines.
   if (engine_ != "v8") {
@@ -0,0 +1,97 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/shared_data.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+namespace proxy_wasm {
+namespace {
+
+// Multi-threaded contention benchmark for SharedData. Each of the threads performs
+// `kOpsPerThread` operations on a small set of keys per iteration, with the given percentage of
+// them being writes.
+constexpr int kOpsPerThread = 10000;
+constexpr int kNumKeys = 64;
+
+void BM_SharedDataContention(benchmark::State &state) {
+  const auto num_threads = static_cast<int>(state.range(0));
+  const auto write_percent = static_cast<int>(state.range(1));
+  SharedData shared_data(false);
+  std::string_view vm_id = "benchmark";
+  std::string value(1024, 'x');
+  std::vector<std::string> keys;
+  for (auto i = 0; i < kNumKeys; i++) {
+    keys.push_back("key" + std::to_string(i));
+    if (shared_data.set(vm_id, keys.back(), value, 0) != WasmResult::Ok) {
+      state.SkipWithError("Failed to set the initial values");
+      return;
+    }
+  }
+
+  for (auto _ : state) {
+    std::atomic<bool> start = false;
+    std::vector<std::thread> threads;
+    for (auto t = 0; t < num_threads; t++) {
+      threads.emplace_back([&, t]() {
+        std::pair<std::string, uint32_t> result;
+        while (!start) {
+          std::this_thread::yield();
+        }
+        for (auto i = 0; i < kOpsPerThread; i++) {
+          const auto &key = keys[(i + t) % kNumKeys];
+          if (i % 100 < write_percent) {
+            shared_data.set(vm_id, key, value, 0);
+          } else {
+            shared_data.get(vm_id, key, &result);
+          }
+        }
+      });
+    }
+
+    // Only the operations are timed, not starting the threads.
+    auto begin = std::chrono::steady_clock::now();
+    start = true;
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    state.SetIterationTime(
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+  }
+  state.SetItemsProcessed(state.iterations() * num_threads * kOpsPerThread);
+}
+
+void contentionArguments(benchmark::internal::Benchmark *benchmark) {
+  const auto max_threads = std::max(2U, std::thread::hardware_concurrency());
+  for (auto write_percent : {0, 1, 10}) {
+    for (unsigned num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+      benchmark->Args({static_cast<int64_t>(num_threads), write_percent});
+    }
+  }
+}
+
+BENCHMARK(BM_SharedDataContention)
+    ->ArgNames({"threads", "write_percent"})
+    ->Apply(contentionArguments)
+    ->UseManualTime();
+
+} // namespace
+} // namespace proxy_wasm
@@ -14,7 +14,11 @@
 
 #include "src/shared_data.h"
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -85,6 +89,29 @@ TEST(SharedData, SingleThread) {
   EXPECT_EQ(removeResult.second, expectedCasValue);
 }
 
+TEST(SharedData, ValueReference) {
+  SharedData shared_data(false);
+  std::string_view vm_id = "id";
+  std::string_view key = "key";
+
+  SharedDataValuePtr value;
+  EXPECT_EQ(WasmResult::NotFound, shared_data.get(vm_id, key, &value));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, key, "1", 0));
+  EXPECT_EQ(WasmResult::Ok, shared_data.get(vm_id, key, &value));
+  EXPECT_EQ(value->data, "1");
+
+  // Reads share the stored value.
+  SharedDataValuePtr same_value;
+  EXPECT_EQ(WasmResult::Ok, shared_data.get(vm_id, key, &same_value));
+  EXPECT_EQ(value.get(), same_value.get());
+
+  // Existing references are unaffected by updates and removals.
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, key, "2", value->cas));
+  EXPECT_EQ(WasmResult::Ok, shared_data.remove(vm_id, key, 0, nullptr));
+  EXPECT_EQ(value->data, "1");
+  EXPECT_EQ(WasmResult::NotFound, shared_data.get(vm_id, key, &same_value));
+}
+
 void incrementData(SharedData *shared_data, std::string_view vm_id, std::string_view key) {
   std::pair<std::string, uint32_t> result;
   for (auto i = 0; i < 10; i++) {
@@ -117,6 +144,316 @@ TEST(SharedData, Concurrent) {
   EXPECT_EQ(result.first, "aaaaaaaaaaaaaaaaaaaa");
 }
 
+TEST(SharedData, ConcurrentReadersAndWriters) {
+  SharedData shared_data(false);
+  std::string_view vm_id = "id";
+  const int num_keys = 4 * SharedData::kNumShards;
+  for (auto i = 0; i < num_keys; i++) {
+    EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, std::to_string(i), "", 0));
+  }
+
+  std::atomic<bool> done = false;
+  auto reader = [&shared_data, &done, vm_id]() {
+    std::pair<std::string, uint32_t> result;
+    while (!done) {
+      for (auto i = 0; i < num_keys; i++) {
+        EXPECT_EQ(WasmResult::Ok, shared_data.get(vm_id, std::to_string(i), &result));
+      }
+    }
+  };
+  std::thread first_reader(reader);
+  std::thread second_reader(reader);
+
+  std::vector<std::thread> writers;
+  for (auto i = 0; i < num_keys; i += 2) {
+    writers.emplace_back(incrementData, &shared_data, vm_id, std::to_string(i));
+    writers.emplace_back(incrementData, &shared_data, vm_id, std::to_string(i + 1));
+  }
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  done = true;
+  first_reader.join();
+  second_reader.join();
+
+  std::vector<std::string> keys;
+  EXPECT_EQ(WasmResult::Ok, shared_data.keys(vm_id, &keys));
+  EXPECT_EQ(num_keys, keys.size());
+  std::pair<std::string, uint32_t> result;
+  for (auto i = 0; i < num_keys; i++) {
+    EXPECT_EQ(WasmResult::Ok, shared_data.get(vm_id, std::to_string(i), &result));
+    EXPECT_EQ(result.first, "aaaaaaaaaa");
+  }
+}
+
+TEST(SharedData, ConcurrentReadersAndRemovals) {
+  SharedData shared_data(false);
+  std::string_view vm_id = "id";
+  const int num_keys = 64 * SharedData::kNumShards;
+
+  std::atomic<bool> done = false;
+  auto reader = [&shared_data, &done, vm_id]() {
+    SharedDataValuePtr value;
+    std::vector<std::string> keys;
+    while (!done) {
+      for (auto i = 0; i < num_keys; i++) {
+        if (shared_data.get(vm_id, std::to_string(i), &value) == WasmResult::Ok) {
+          EXPECT_EQ(value->data, std::to_string(i));
+        }
+      }
+      EXPECT_EQ(WasmResult::Ok, shared_data.keys(vm_id, &keys));
+    }
+  };
+  std::thread first_reader(reader);
+  std::thread second_reader(reader);
+
+  // Keys are added (growing the tables), replaced and removed, while readers still see them.
+  for (auto round = 0; round < 10; round++) {
+    for (auto i = 0; i < num_keys; i++) {
+      EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, std::to_string(i), std::to_string(i), 0));
+      EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, std::to_string(i), std::to_string(i), 0));
+    }
+    for (auto i = 0; i < num_keys; i++) {
+      EXPECT_EQ(WasmResult::Ok, shared_data.remove(vm_id, std::to_string(i), 0, nullptr));
+    }
+  }
+  done = true;
+  first_reader.join();
+  second_reader.join();
+
+  auto stats = shared_data.getStats(vm_id);
+  EXPECT_EQ(0, stats.keys);
+  EXPECT_EQ(0, stats.bytes);
+}
+
+TEST(SharedData, Subscribe) {
+  SharedData shared_data(false);
+  std::string_view vm_id = "id";
+  std::string_view vm_key = "vm_key";
+  // Owners are only compared, never dereferenced.
+  const auto *wasm = reinterpret_cast<const WasmBase *>(0x1000);
+  uint32_t context_id = 1;
+
+  std::vector<std::function<void()>> pending;
+  std::function<void(std::function<void()>)> call_on_thread =
+      [&pending](const std::function<void()> &f) { pending.push_back(f); };
+  auto key_token =
+      shared_data.subscribe(vm_id, "key", false, wasm, context_id, call_on_thread, vm_key);
+  auto prefix_token =
+      shared_data.subscribe(vm_id, "prefix/", true, wasm, context_id, call_on_thread, vm_key);
+  EXPECT_NE(0, key_token);
+  EXPECT_NE(0, prefix_token);
+  EXPECT_NE(key_token, prefix_token);
+
+  // Non-matching keys and other VMs.
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "key2", "", 0));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "prefix", "", 0));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set("other", "key", "", 0));
+  EXPECT_EQ(0, pending.size());
+
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "key", "", 0));
+  EXPECT_EQ(1, pending.size());
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "prefix/a", "", 0));
+  EXPECT_EQ(2, pending.size());
+
+  // Notifications are coalesced until delivered. There is no thread-local VM for vm_key here, so
+  // the notifications are dropped, see TestVm.SharedDataSubscription for their delivery.
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "key", "", 0));
+  EXPECT_EQ(WasmResult::Ok, shared_data.remove(vm_id, "prefix/a", 0, nullptr));
+  EXPECT_EQ(2, pending.size());
+  for (auto &f : pending) {
+    f();
+  }
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "key", "", 0));
+  EXPECT_EQ(3, pending.size());
+
+  // Failed updates don't notify.
+  EXPECT_EQ(WasmResult::NotFound, shared_data.remove(vm_id, "prefix/b", 0, nullptr));
+  EXPECT_EQ(3, pending.size());
+
+  // Subscriptions can only be cancelled by their owner.
+  EXPECT_EQ(WasmResult::NotFound, shared_data.unsubscribe("other", wasm, context_id, prefix_token));
+  EXPECT_EQ(WasmResult::NotFound, shared_data.unsubscribe(vm_id, wasm, 2, prefix_token));
+  EXPECT_EQ(WasmResult::NotFound,
+            shared_data.unsubscribe(vm_id, nullptr, context_id, prefix_token));
+  EXPECT_EQ(WasmResult::Ok, shared_data.unsubscribe(vm_id, wasm, context_id, prefix_token));
+  EXPECT_EQ(WasmResult::NotFound, shared_data.unsubscribe(vm_id, wasm, context_id, prefix_token));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "prefix/a", "", 0));
+  EXPECT_EQ(3, pending.size());
+
+  shared_data.deleteByVmId(vm_id);
+  EXPECT_EQ(WasmResult::NotFound, shared_data.unsubscribe(vm_id, wasm, context_id, key_token));
+}
+
+TEST(SharedData, UnsubscribeContext) {
+  SharedData shared_data(false);
+  std::string_view vm_id = "id";
+  const auto *wasm = reinterpret_cast<const WasmBase *>(0x1000);
+  const auto *other_wasm = reinterpret_cast<const WasmBase *>(0x2000);
+
+  std::vector<std::function<void()>> pending;
+  std::function<void(std::function<void()>)> call_on_thread =
+      [&pending](const std::function<void()> &f) { pending.push_back(f); };
+  auto token = shared_data.subscribe(vm_id, "key", false, wasm, 1, call_on_thread, "vm_key");
+  shared_data.subscribe(vm_id, "key", true, wasm, 1, call_on_thread, "vm_key");
+  auto other_context_token =
+      shared_data.subscribe(vm_id, "key", false, wasm, 2, call_on_thread, "vm_key");
+  auto other_wasm_token =
+      shared_data.subscribe(vm_id, "key", false, other_wasm, 1, call_on_thread, "vm_key");
+
+  // Only the subscriptions of the destroyed root context are cancelled.
+  shared_data.unsubscribeContext(vm_id, wasm, 1);
+  EXPECT_EQ(WasmResult::NotFound, shared_data.unsubscribe(vm_id, wasm, 1, token));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "key", "", 0));
+  EXPECT_EQ(2, pending.size());
+  EXPECT_EQ(WasmResult::Ok, shared_data.unsubscribe(vm_id, wasm, 2, other_context_token));
+  EXPECT_EQ(WasmResult::Ok, shared_data.unsubscribe(vm_id, other_wasm, 1, other_wasm_token));
+}
+
+TEST(SharedData, GetMultipleKeys) {
+  SharedData shared_data(false);
+  std::string_view vm_id = "id";
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "a", "1", 0));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "b", "2", 0));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set("other", "c", "3", 0));
+
+  std::vector<SharedDataValuePtr> values;
+  shared_data.get(vm_id, {"b", "c", "a", "b"}, &values);
+  ASSERT_EQ(4, values.size());
+  ASSERT_TRUE(values[0]);
+  EXPECT_EQ("2", values[0]->data);
+  EXPECT_FALSE(values[1]);
+  ASSERT_TRUE(values[2]);
+  EXPECT_EQ("1", values[2]->data);
+  EXPECT_EQ(values[0], values[3]);
+
+  std::pair<std::string, uint32_t> result;
+  EXPECT_EQ(WasmResult::Ok, shared_data.get(vm_id, "a", &result));
+  EXPECT_EQ(result.second, values[2]->cas);
+
+  shared_data.get("missing", {"a"}, &values);
+  ASSERT_EQ(1, values.size());
+  EXPECT_FALSE(values[0]);
+  shared_data.get(vm_id, {}, &values);
+  EXPECT_TRUE(values.empty());
+}
+
+TEST(SharedData, Limits) {
+  SharedData shared_data(false);
+  std::string_view vm_id = "id";
+  EXPECT_EQ(WasmResult::Ok,
+            shared_data.setLimits(vm_id, {/*max_bytes=*/10, SharedDataEvictionPolicy::None}));
+
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "a", "1234", 0));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "b", "1234", 0));
+  EXPECT_EQ(WasmResult::InternalFailure, shared_data.set(vm_id, "c", "1234", 0));
+  // Replacing a value only needs room for the difference.
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "a", "1", 0));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "c", "1", 0));
+
+  auto stats = shared_data.getStats(vm_id);
+  EXPECT_EQ(9, stats.bytes);
+  EXPECT_EQ(3, stats.keys);
+  EXPECT_EQ(0, stats.evictions);
+
+  EXPECT_EQ(WasmResult::Ok, shared_data.remove(vm_id, "b", 0, nullptr));
+  stats = shared_data.getStats(vm_id);
+  EXPECT_EQ(4, stats.bytes);
+  EXPECT_EQ(2, stats.keys);
+
+  // Other VMs are unaffected.
+  EXPECT_EQ(WasmResult::Ok, shared_data.set("other", "c", "1234567890", 0));
+  EXPECT_EQ(11, shared_data.getStats("other").bytes);
+
+  shared_data.deleteByVmId(vm_id);
+  EXPECT_EQ(0, shared_data.getStats(vm_id).bytes);
+}
+
+TEST(SharedData, LruEviction) {
+  SharedData shared_data(false);
+  std::string_view vm_id = "id";
+  EXPECT_EQ(WasmResult::Ok,
+            shared_data.setLimits(vm_id, {/*max_bytes=*/15, SharedDataEvictionPolicy::Lru}));
+
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "a", "1234", 0));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "b", "1234", 0));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "c", "1234", 0));
+  // Use "a", so that "b" is the least recently used key. Access times have a resolution of 1ms.
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  std::pair<std::string, uint32_t> result;
+  EXPECT_EQ(WasmResult::Ok, shared_data.get(vm_id, "a", &result));
+
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "d", "1234", 0));
+  EXPECT_EQ(WasmResult::NotFound, shared_data.get(vm_id, "b", &result));
+  EXPECT_EQ(WasmResult::Ok, shared_data.get(vm_id, "a", &result));
+  EXPECT_EQ(WasmResult::Ok, shared_data.get(vm_id, "c", &result));
+  EXPECT_EQ(WasmResult::Ok, shared_data.get(vm_id, "d", &result));
+
+  auto stats = shared_data.getStats(vm_id);
+  EXPECT_EQ(15, stats.bytes);
+  EXPECT_EQ(3, stats.keys);
+  EXPECT_EQ(1, stats.evictions);
+
+  // Values larger than the limit are rejected without evicting anything.
+  EXPECT_EQ(WasmResult::InternalFailure, shared_data.set(vm_id, "e", "1234567890123456", 0));
+  EXPECT_EQ(1, shared_data.getStats(vm_id).evictions);
+}
+
+TEST(SharedData, SampledLruEviction) {
+  SharedData shared_data(false);
+  std::string_view vm_id = "id";
+  const int num_keys = 100;
+  EXPECT_EQ(WasmResult::Ok, shared_data.setLimits(vm_id, {/*max_bytes=*/(num_keys + 1) * 8,
+                                                          SharedDataEvictionPolicy::Lru}));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "used", "1234", 0));
+
+  // The key used before each update is never the least recently used key in the sample. Access
+  // times have a resolution of 1ms.
+  std::pair<std::string, uint32_t> result;
+  for (auto i = 0; i < 2 * num_keys; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    EXPECT_EQ(WasmResult::Ok, shared_data.get(vm_id, "used", &result));
+    EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, std::to_string(i + 1000), "1234", 0));
+  }
+  auto stats = shared_data.getStats(vm_id);
+  EXPECT_EQ((num_keys + 1) * 8, stats.bytes);
+  EXPECT_EQ(num_keys + 1, stats.keys);
+  EXPECT_EQ(num_keys, stats.evictions);
+}
+
+TEST(SharedData, TtlEviction) {
+  SharedData shared_data(false);
+  std::string_view vm_id = "id";
+  // The TTL policy requires a TTL.
+  EXPECT_EQ(WasmResult::BadArgument,
+            shared_data.setLimits(vm_id, {/*max_bytes=*/10, SharedDataEvictionPolicy::Ttl}));
+  EXPECT_EQ(WasmResult::BadArgument,
+            shared_data.setLimits(vm_id, {/*max_bytes=*/10, SharedDataEvictionPolicy::Ttl,
+                                          std::chrono::milliseconds(-1)}));
+  EXPECT_EQ(WasmResult::Ok,
+            shared_data.setLimits(vm_id, {/*max_bytes=*/10, SharedDataEvictionPolicy::Ttl,
+                                          std::chrono::milliseconds(50)}));
+
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "a", "1234", 0));
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "b", "1234", 0));
+  // Nothing has expired yet.
+  EXPECT_EQ(WasmResult::InternalFailure, shared_data.set(vm_id, "c", "1234", 0));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  std::pair<std::string, uint32_t> result;
+  EXPECT_EQ(WasmResult::NotFound, shared_data.get(vm_id, "a", &result));
+  EXPECT_EQ(WasmResult::NotFound, shared_data.remove(vm_id, "a", 0, nullptr));
+  std::vector<std::string> keys;
+  EXPECT_EQ(WasmResult::Ok, shared_data.keys(vm_id, &keys));
+  EXPECT_EQ(0, keys.size());
+
+  EXPECT_EQ(WasmResult::Ok, shared_data.set(vm_id, "c", "1234", 0));
+  EXPECT_EQ(WasmResult::Ok, shared_data.get(vm_id, "c", &result));
+  auto stats = shared_data.getStats(vm_id);
+  EXPECT_EQ(1, stats.evictions);
+  EXPECT_EQ(2, stats.keys);
+}
+
 TEST(SharedData, DeleteByVmId) {
   SharedData shared_data(false);
   std::string_view vm_id = "id";
@@ -14,7 +14,9 @@
 
 #include "src/shared_queue.h"
 
+#include <functional>
 #include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -114,6 +116,169 @@ TEST(SharedQueue, Concurrent) {
   EXPECT_EQ(first_cnt + second_cnt, 200);
 }
 
+TEST(SharedQueue, CoalescedNotifications) {
+  SharedQueue shared_queue(false);
+  std::vector<std::function<void()>> posted;
+  std::function<void(std::function<void()>)> call_on_thread =
+      [&posted](const std::function<void()> &f) { posted.push_back(f); };
+  shared_queue.setLimits("id", {PROXY_WASM_HOST_SHARED_QUEUE_MAX_ITEMS,
+                                SharedQueueOverflowPolicy::Reject,
+                                /*coalesce_notifications=*/true});
+  auto token = shared_queue.registerQueue("id", "name", 1, call_on_thread, "vm_key");
+
+  for (auto i = 0; i < 100; i++) {
+    EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(token, "a"));
+  }
+  EXPECT_EQ(1, posted.size());
+
+  // Once the notification has been delivered, the next enqueue posts a new one.
+  posted[0]();
+  EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(token, "a"));
+  EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(token, "a"));
+  EXPECT_EQ(2, posted.size());
+
+  size_t dequeued_count = 0;
+  dequeueData(&shared_queue, token, &dequeued_count);
+  EXPECT_EQ(102, dequeued_count);
+
+  // Notifications dropped by call_on_thread don't block the next ones.
+  bool drop = true;
+  size_t dropped = 0;
+  call_on_thread = [&drop, &dropped, &posted](const std::function<void()> &f) {
+    if (drop) {
+      dropped++;
+    } else {
+      posted.push_back(f);
+    }
+  };
+  token = shared_queue.registerQueue("id", "name", 1, call_on_thread, "vm_key");
+  posted.clear();
+  EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(token, "a"));
+  EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(token, "a"));
+  EXPECT_EQ(2, dropped);
+  drop = false;
+  EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(token, "a"));
+  EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(token, "a"));
+  EXPECT_EQ(1, posted.size());
+}
+
+TEST(SharedQueue, DequeueMultipleItems) {
+  SharedQueue shared_queue(false);
+  auto call_on_thread = [](const std::function<void()> &) {};
+  auto token = shared_queue.registerQueue("id", "name", 1, call_on_thread, "vm_key");
+
+  std::vector<std::string> data;
+  EXPECT_EQ(WasmResult::NotFound, shared_queue.dequeue(0, 10, 100, &data));
+  EXPECT_EQ(WasmResult::Empty, shared_queue.dequeue(token, 10, 100, &data));
+
+  for (auto i = 0; i < 10; i++) {
+    EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(token, std::to_string(i) + "bc"));
+  }
+  // Limited by the number of items.
+  EXPECT_EQ(WasmResult::Ok, shared_queue.dequeue(token, 2, 100, &data));
+  EXPECT_EQ((std::vector<std::string>{"0bc", "1bc"}), data);
+  // Limited by the size of the items.
+  EXPECT_EQ(WasmResult::Ok, shared_queue.dequeue(token, 10, 7, &data));
+  EXPECT_EQ((std::vector<std::string>{"2bc", "3bc", "4bc"}), data);
+  // Limited by the number of queued items.
+  EXPECT_EQ(WasmResult::Ok, shared_queue.dequeue(token, 10, 100, &data));
+  EXPECT_EQ(5, data.size());
+  EXPECT_EQ(WasmResult::Empty, shared_queue.dequeue(token, 10, 100, &data));
+}
+
+TEST(SharedQueue, Overflow) {
+  SharedQueue shared_queue(false);
+  std::string_view vm_key = "vm_key";
+  uint32_t context_id = 1;
+  auto call_on_thread = [](const std::function<void()> &) {};
+
+  shared_queue.setLimits("reject", {/*capacity=*/3, SharedQueueOverflowPolicy::Reject});
+  shared_queue.setLimits("drop_newest", {/*capacity=*/4, SharedQueueOverflowPolicy::DropNewest});
+  shared_queue.setLimits("drop_oldest", {/*capacity=*/4, SharedQueueOverflowPolicy::DropOldest});
+  auto reject = shared_queue.registerQueue("reject", "q", context_id, call_on_thread, vm_key);
+  auto drop_newest =
+      shared_queue.registerQueue("drop_newest", "q", context_id, call_on_thread, vm_key);
+  auto drop_oldest =
+      shared_queue.registerQueue("drop_oldest", "q", context_id, call_on_thread, vm_key);
+
+  // Capacity is rounded up to 4.
+  for (auto i = 0; i < 4; i++) {
+    EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(reject, std::to_string(i)));
+    EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(drop_newest, std::to_string(i)));
+    EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(drop_oldest, std::to_string(i)));
+  }
+  EXPECT_EQ(WasmResult::InternalFailure, shared_queue.enqueue(reject, "4"));
+  EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(drop_newest, "4"));
+  EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(drop_oldest, "4"));
+
+  std::string data;
+  for (auto i = 0; i < 4; i++) {
+    EXPECT_EQ(WasmResult::Ok, shared_queue.dequeue(reject, &data));
+    EXPECT_EQ(std::to_string(i), data);
+    EXPECT_EQ(WasmResult::Ok, shared_queue.dequeue(drop_newest, &data));
+    EXPECT_EQ(std::to_string(i), data);
+    EXPECT_EQ(WasmResult::Ok, shared_queue.dequeue(drop_oldest, &data));
+    EXPECT_EQ(std::to_string(i + 1), data);
+  }
+  EXPECT_EQ(WasmResult::Empty, shared_queue.dequeue(reject, &data));
+  EXPECT_EQ(WasmResult::Empty, shared_queue.dequeue(drop_newest, &data));
+  EXPECT_EQ(WasmResult::Empty, shared_queue.dequeue(drop_oldest, &data));
+
+  // The ring wraps around.
+  for (auto i = 0; i < 10; i++) {
+    EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(reject, std::to_string(i)));
+    EXPECT_EQ(WasmResult::Ok, shared_queue.dequeue(reject, &data));
+    EXPECT_EQ(std::to_string(i), data);
+  }
+}
+
+TEST(SharedQueue, UnboundedByDefault) {
+  SharedQueue shared_queue(false);
+  auto call_on_thread = [](const std::function<void()> &) {};
+  auto token = shared_queue.registerQueue("id", "name", 1, call_on_thread, "vm_key");
+
+  const size_t num_items = 10000;
+  for (size_t i = 0; i < num_items; i++) {
+    EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(token, std::to_string(i)));
+  }
+  std::string data;
+  for (size_t i = 0; i < num_items; i++) {
+    EXPECT_EQ(WasmResult::Ok, shared_queue.dequeue(token, &data));
+    EXPECT_EQ(std::to_string(i), data);
+  }
+  EXPECT_EQ(WasmResult::Empty, shared_queue.dequeue(token, &data));
+}
+
+TEST(SharedQueue, QueueLimits) {
+  SharedQueue shared_queue(false);
+  std::string_view vm_id = "id";
+  std::string_view vm_key = "vm_key";
+  uint32_t context_id = 1;
+  auto call_on_thread = [](const std::function<void()> &) {};
+
+  // Limits of a queue take precedence over the limits of its vm_id.
+  shared_queue.setLimits(vm_id, {/*capacity=*/2, SharedQueueOverflowPolicy::Reject});
+  shared_queue.setLimits(vm_id, "large", {/*capacity=*/8, SharedQueueOverflowPolicy::Reject});
+  auto small = shared_queue.registerQueue(vm_id, "small", context_id, call_on_thread, vm_key);
+  auto large = shared_queue.registerQueue(vm_id, "large", context_id, call_on_thread, vm_key);
+  for (auto i = 0; i < 8; i++) {
+    EXPECT_EQ(i < 2 ? WasmResult::Ok : WasmResult::InternalFailure,
+              shared_queue.enqueue(small, std::to_string(i)));
+    EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(large, std::to_string(i)));
+  }
+  EXPECT_EQ(WasmResult::InternalFailure, shared_queue.enqueue(large, "8"));
+
+  // Large items are handed over to the consumer.
+  std::string data;
+  EXPECT_EQ(WasmResult::Ok, shared_queue.dequeue(small, &data));
+  std::string large_item(64 * 1024, 'a');
+  EXPECT_EQ(WasmResult::Ok, shared_queue.enqueue(small, large_item));
+  EXPECT_EQ(WasmResult::Ok, shared_queue.dequeue(small, &data));
+  EXPECT_EQ(WasmResult::Ok, shared_queue.dequeue(small, &data));
+  EXPECT_EQ(large_item, data);
+  EXPECT_EQ(WasmResult::Empty, shared_queue.dequeue(small, &data));
+}
+
 TEST(SharedQueue, DeleteByVmId) {
   SharedQueue shared_queue(false);
   const auto *vm_id_1 = "id_1";
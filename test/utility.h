@@ -112,6 +112,15 @@ public:
     return unimplemented();
   }
 
+  void onSharedDataChanged(SharedDataSubscriptionToken token) override {
+    shared_data_changes_.push_back(token);
+    ContextBase::onSharedDataChanged(token);
+  }
+
+  const std::vector<SharedDataSubscriptionToken> &sharedDataChanges() {
+    return shared_data_changes_;
+  }
+
   bool isLogEmpty() { return log_.empty(); }
 
   bool isLogged(std::string_view message) { return log_.find(message) != std::string::npos; }
@@ -136,6 +145,7 @@ public:
 private:
   std::string log_;
   static std::string global_log_;
+  std::vector<SharedDataSubscriptionToken> shared_data_changes_;
 };
 
 class TestWasm : public WasmBase {
@@ -150,6 +160,11 @@ public:
 
   ContextBase *createVmContext() override { return new TestContext(this); };
 
+  // Runs the callbacks right away, on the calling thread.
+  CallOnThreadFunction callOnThreadFunction() override {
+    return [](const std::function<void()> &f) { f(); };
+  }
+
   ContextBase *createRootContext(const std::shared_ptr<PluginBase> &plugin) override {
     return new TestContext(this, plugin);
   }
@@ -0,0 +1,165 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "include/proxy-wasm/compiled_module_cache.h"
+#include "include/proxy-wasm/v8.h"
+#include "include/proxy-wasm/wasm.h"
+
+#include "test/utility.h"
+
+namespace proxy_wasm {
+namespace {
+
+// Measures the time to the first call into a module (compiling it, instantiating it and calling
+// it once), and the throughput of a CPU-bound function, for the V8 compilation mode set by the
+// V8_COMPILATION_MODE environment variable ("optimized", "tiered" or "lazy_tiered"). V8 flags are
+// process-wide, so each mode runs in its own process:
+//
+//   V8_COMPILATION_MODE=tiered bazel run -c opt //test:benchmark -- --benchmark_filter=BM_V8
+//
+// Both are measured with an empty compiled module cache, and after a simulated restart which loads
+// the module from the cache, updated once the hot function was optimized.
+constexpr int kNumWarmUpCalls = 1000;
+constexpr uint32_t kIterations = 100000;
+
+// Set before any VM is created, i.e. before any other benchmark runs.
+const std::string compilation_mode_name = [] {
+  const char *env = ::getenv("V8_COMPILATION_MODE");
+  const std::string mode_name = env != nullptr ? env : "optimized";
+  auto mode = V8CompilationMode::Optimized;
+  if (mode_name == "tiered") {
+    mode = V8CompilationMode::Tiered;
+  } else if (mode_name == "lazy_tiered") {
+    mode = V8CompilationMode::LazyTiered;
+  } else if (mode_name != "optimized") {
+    std::cerr << "Unknown V8_COMPILATION_MODE: " << mode_name << std::endl;
+    ::abort();
+  }
+  setV8CompilationMode(mode);
+  return mode_name;
+}();
+
+std::string computeSource() { return readTestWasmFile("compute.wasm"); }
+
+// Loads the module into a new base VM and calls the function once.
+std::unique_ptr<TestWasm> startWasm(const std::string &source, WasmCallWord<1> *compute) {
+  auto wasm =
+      std::make_unique<TestWasm>(createV8Vm(), std::unordered_map<std::string, std::string>{},
+                                 "vm_id", "", makeVmKey("vm_id", "", source));
+  if (!wasm->load(source, false) || !wasm->initialize()) {
+    return nullptr;
+  }
+  wasm->wasm_vm()->getFunction("compute", compute);
+  if (*compute == nullptr) {
+    return nullptr;
+  }
+  (*compute)(wasm->vm_context(), 1);
+  return wasm;
+}
+
+// Fills the compiled module cache with the module, once its hot function was optimized.
+bool fillCompiledModuleCache(const std::string &source) {
+  const char *tmpdir = ::getenv("TEST_TMPDIR");
+  setCompiledModuleCache(
+      std::make_shared<FileCompiledModuleCache>(tmpdir != nullptr ? tmpdir : "/tmp"));
+  WasmCallWord<1> compute;
+  auto wasm = startWasm(source, &compute);
+  if (wasm == nullptr) {
+    return false;
+  }
+  for (auto i = 0; i < kNumWarmUpCalls; i++) {
+    compute(wasm->vm_context(), kIterations);
+  }
+  wasm->updateCompiledModuleCache();
+  return true;
+}
+
+void BM_V8FirstCall(benchmark::State &state, bool from_cache) {
+  auto source = computeSource();
+  if (from_cache && !fillCompiledModuleCache(source)) {
+    state.SkipWithError("Failed to fill the compiled module cache");
+    setCompiledModuleCache(nullptr);
+    return;
+  }
+  for (auto _ : state) {
+    // Each base VM is destroyed before the next one is created, so that the compiled module isn't
+    // shared between them.
+    WasmCallWord<1> compute;
+    auto begin = std::chrono::steady_clock::now();
+    auto wasm = startWasm(source, &compute);
+    state.SetIterationTime(
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+    if (wasm == nullptr) {
+      state.SkipWithError("Failed to start the VM");
+      break;
+    }
+  }
+  setCompiledModuleCache(nullptr);
+}
+
+void BM_V8Call(benchmark::State &state, bool from_cache) {
+  auto source = computeSource();
+  if (from_cache && !fillCompiledModuleCache(source)) {
+    state.SkipWithError("Failed to fill the compiled module cache");
+    setCompiledModuleCache(nullptr);
+    return;
+  }
+  WasmCallWord<1> compute;
+  auto wasm = startWasm(source, &compute);
+  if (wasm == nullptr) {
+    state.SkipWithError("Failed to start the VM");
+    setCompiledModuleCache(nullptr);
+    return;
+  }
+  // Gives tiered modes a chance to optimize the function in the background.
+  for (auto i = 0; i < kNumWarmUpCalls; i++) {
+    compute(wasm->vm_context(), kIterations);
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(compute(wasm->vm_context(), kIterations));
+  }
+  if (wasm->isFailed()) {
+    state.SkipWithError("VM failed");
+  }
+  setCompiledModuleCache(nullptr);
+}
+
+const bool registered = [] {
+  for (const bool from_cache : {false, true}) {
+    const std::string suffix = compilation_mode_name + (from_cache ? "/cached" : "/cold");
+    benchmark::RegisterBenchmark(("BM_V8FirstCall/" + suffix).c_str(),
+                                 [from_cache](benchmark::State &state) {
+                                   BM_V8FirstCall(state, from_cache);
+                                 })
+        ->Unit(benchmark::kMicrosecond)
+        ->UseManualTime();
+    benchmark::RegisterBenchmark(("BM_V8Call/" + suffix).c_str(),
+                                 [from_cache](benchmark::State &state) {
+                                   BM_V8Call(state, from_cache);
+                                 })
+        ->Unit(benchmark::kMicrosecond);
+  }
+  return true;
+}();
+
+} // namespace
+} // namespace proxy_wasm
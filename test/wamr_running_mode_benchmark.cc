@@ -0,0 +1,175 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "include/proxy-wasm/wamr.h"
+#include "include/proxy-wasm/wasm.h"
+
+#include "test/utility.h"
+
+namespace proxy_wasm {
+namespace {
+
+// Measures the time to the first call into a module (loading it, instantiating it and calling it
+// once), and the throughput of a CPU-bound function, in each running mode WAMR was built with:
+//
+//   bazel run -c opt //test:benchmark -- --benchmark_filter=BM_Wamr
+//
+// The module precompiled with wamrc is measured as well, if WAMR_AOT_FILE is set:
+//
+//   wamrc -o /tmp/compute.aot compute.wasm
+//   WAMR_AOT_FILE=/tmp/compute.aot bazel run -c opt //test:benchmark -- --benchmark_filter=BM_Wamr
+//
+constexpr uint32_t kIterations = 100000;
+
+void appendLeb128(std::string &out, uint32_t value) {
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    if (value != 0) {
+      byte |= 0x80;
+    }
+    out.push_back(static_cast<char>(byte));
+  } while (value != 0);
+}
+
+// Embeds 'aot' in 'source' as the precompiled custom section.
+std::string appendPrecompiledSection(std::string source, std::string_view section_name,
+                                     const std::string &aot) {
+  std::string payload;
+  appendLeb128(payload, section_name.size());
+  payload.append(section_name);
+  payload.append(aot);
+  source.push_back(0); // Custom section.
+  appendLeb128(source, payload.size());
+  source.append(payload);
+  return source;
+}
+
+// Returns the module to run in the given mode, or an empty string if WAMR can't run it.
+std::string getSource(benchmark::State &state, WamrRunningMode mode, bool aot) {
+  auto source = readTestWasmFile("compute.wasm");
+  if (!aot) {
+    if (!isWamrRunningModeSupported(mode)) {
+      state.SkipWithError("Running mode not supported by this build of WAMR");
+      return "";
+    }
+    return source;
+  }
+  const char *aot_file = ::getenv("WAMR_AOT_FILE");
+  if (aot_file == nullptr) {
+    state.SkipWithError("WAMR_AOT_FILE not set");
+    return "";
+  }
+  std::ifstream file(aot_file, std::ios::binary);
+  if (file.fail()) {
+    state.SkipWithError("Failed to open WAMR_AOT_FILE");
+    return "";
+  }
+  std::string aot_module((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  return appendPrecompiledSection(source, createWamrVm()->getPrecompiledSectionName(), aot_module);
+}
+
+// Loads the module into a new base VM and calls the function once.
+std::unique_ptr<TestWasm> startWasm(WamrRunningMode mode, const std::string &source, bool aot,
+                                    WasmCallWord<1> *compute) {
+  auto wasm = std::make_unique<TestWasm>(createWamrVm(mode));
+  if (!wasm->load(source, aot) || !wasm->initialize()) {
+    return nullptr;
+  }
+  wasm->wasm_vm()->getFunction("compute", compute);
+  if (*compute == nullptr) {
+    return nullptr;
+  }
+  (*compute)(wasm->vm_context(), 1);
+  return wasm;
+}
+
+void BM_WamrFirstCall(benchmark::State &state, WamrRunningMode mode, bool aot) {
+  auto source = getSource(state, mode, aot);
+  if (source.empty()) {
+    return;
+  }
+  for (auto _ : state) {
+    WasmCallWord<1> compute;
+    auto begin = std::chrono::steady_clock::now();
+    auto wasm = startWasm(mode, source, aot, &compute);
+    state.SetIterationTime(
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+    if (wasm == nullptr) {
+      state.SkipWithError("Failed to start the VM");
+      break;
+    }
+  }
+}
+
+void BM_WamrCall(benchmark::State &state, WamrRunningMode mode, bool aot) {
+  auto source = getSource(state, mode, aot);
+  if (source.empty()) {
+    return;
+  }
+  WasmCallWord<1> compute;
+  auto wasm = startWasm(mode, source, aot, &compute);
+  if (wasm == nullptr) {
+    state.SkipWithError("Failed to start the VM");
+    return;
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(compute(wasm->vm_context(), kIterations));
+  }
+  if (wasm->isFailed()) {
+    state.SkipWithError("VM failed");
+  }
+}
+
+const bool registered = [] {
+  struct Mode {
+    std::string name;
+    WamrRunningMode mode;
+    bool aot;
+  };
+  const std::vector<Mode> modes = {
+      {"interpreter", WamrRunningMode::Interpreter, false},
+      {"fast_jit", WamrRunningMode::FastJit, false},
+      {"llvm_jit", WamrRunningMode::LlvmJit, false},
+      {"aot", WamrRunningMode::Default, true},
+  };
+  for (const auto &[name, mode, aot] : modes) {
+    benchmark::RegisterBenchmark(("BM_WamrFirstCall/" + name).c_str(),
+                                 [mode = mode, aot = aot](benchmark::State &state) {
+                                   BM_WamrFirstCall(state, mode, aot);
+                                 })
+        ->Unit(benchmark::kMicrosecond)
+        ->UseManualTime();
+    benchmark::RegisterBenchmark(("BM_WamrCall/" + name).c_str(),
+                                 [mode = mode, aot = aot](benchmark::State &state) {
+                                   BM_WamrCall(state, mode, aot);
+                                 })
+        ->Unit(benchmark::kMicrosecond);
+  }
+  return true;
+}();
+
+} // namespace
+} // namespace proxy_wasm
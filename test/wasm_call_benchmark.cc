@@ -0,0 +1,76 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "include/proxy-wasm/wasm.h"
+
+#include "test/utility.h"
+
+namespace proxy_wasm {
+namespace {
+
+// Measures the overhead of calls from the host into a VM, for exported functions which return
+// immediately.
+void BM_WasmCall(benchmark::State &state, const std::string &engine, bool returns_word) {
+  auto source = readTestWasmFile("abi_export.wasm");
+  auto wasm = TestWasm(TestVm::makeVm(engine));
+  if (!wasm.load(source, false) || !wasm.initialize()) {
+    state.SkipWithError("Failed to load the module");
+    return;
+  }
+
+  WasmCallVoid<2> on_context_create;
+  wasm.wasm_vm()->getFunction("proxy_on_context_create", &on_context_create);
+  WasmCallWord<2> on_vm_start;
+  wasm.wasm_vm()->getFunction("proxy_on_vm_start", &on_vm_start);
+  if (on_context_create == nullptr || on_vm_start == nullptr) {
+    state.SkipWithError("Missing exported functions");
+    return;
+  }
+
+  uint32_t i = 0;
+  if (returns_word) {
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(on_vm_start(wasm.vm_context(), i++, 0));
+    }
+  } else {
+    for (auto _ : state) {
+      on_context_create(wasm.vm_context(), i++, 0);
+    }
+  }
+  if (wasm.isFailed()) {
+    state.SkipWithError("VM failed");
+  }
+}
+
+const bool registered = [] {
+  for (const auto &engine : getWasmEngines()) {
+    benchmark::RegisterBenchmark(("BM_WasmCallVoid/" + engine).c_str(),
+                                 [engine](benchmark::State &state) {
+                                   BM_WasmCall(state, engine, false);
+                                 });
+    benchmark::RegisterBenchmark(("BM_WasmCallWord/" + engine).c_str(),
+                                 [engine](benchmark::State &state) {
+                                   BM_WasmCall(state, engine, true);
+                                 });
+  }
+  return true;
+}();
+
+} // namespace
+} // namespace proxy_wasm
@@ -0,0 +1,123 @@
+// Copyright 2023 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "include/proxy-wasm/wasm.h"
+
+#include "test/utility.h"
+
+namespace proxy_wasm {
+namespace {
+
+// Measures the time needed to create and initialize a thread-local clone of a base VM, one clone
+// at a time and on kNumWorkers threads at once (like workers starting up).
+constexpr int kNumWorkers = 64;
+
+std::shared_ptr<WasmHandleBase> makeBaseWasmHandle(const std::string &engine) {
+  auto source = readTestWasmFile("abi_export.wasm");
+  auto base_wasm = std::make_shared<WasmBase>(TestVm::makeVm(engine), "vm_id", "", "vm_key",
+                                              std::unordered_map<std::string, std::string>{},
+                                              AllowedCapabilitiesMap{});
+  if (!base_wasm->load(source, false) || !base_wasm->initialize()) {
+    return nullptr;
+  }
+  return std::make_shared<WasmHandleBase>(base_wasm);
+}
+
+std::shared_ptr<WasmBase> cloneWasm(const std::shared_ptr<WasmHandleBase> &base_wasm_handle,
+                                    const std::string &engine) {
+  auto wasm = std::make_shared<WasmBase>(
+      base_wasm_handle, [&engine]() -> std::unique_ptr<WasmVm> { return TestVm::makeVm(engine); });
+  if (!wasm->initialize()) {
+    return nullptr;
+  }
+  return wasm;
+}
+
+void BM_WasmClone(benchmark::State &state, const std::string &engine) {
+  auto base_wasm_handle = makeBaseWasmHandle(engine);
+  if (base_wasm_handle == nullptr) {
+    state.SkipWithError("Failed to create the base VM");
+    return;
+  }
+
+  // Clones are kept alive, so that destroying them isn't measured.
+  std::vector<std::shared_ptr<WasmBase>> clones;
+  for (auto _ : state) {
+    auto wasm = cloneWasm(base_wasm_handle, engine);
+    if (wasm == nullptr) {
+      state.SkipWithError("Failed to clone the VM");
+      break;
+    }
+    clones.push_back(std::move(wasm));
+  }
+}
+
+void BM_WasmCloneOnWorkers(benchmark::State &state, const std::string &engine) {
+  auto base_wasm_handle = makeBaseWasmHandle(engine);
+  if (base_wasm_handle == nullptr) {
+    state.SkipWithError("Failed to create the base VM");
+    return;
+  }
+
+  for (auto _ : state) {
+    std::vector<std::shared_ptr<WasmBase>> clones(kNumWorkers);
+    std::vector<std::thread> workers;
+    workers.reserve(kNumWorkers);
+    auto begin = std::chrono::steady_clock::now();
+    for (auto i = 0; i < kNumWorkers; i++) {
+      workers.emplace_back([i, &base_wasm_handle, &engine, &clones] {
+        clones[i] = cloneWasm(base_wasm_handle, engine);
+      });
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    state.SetIterationTime(
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+    for (const auto &clone : clones) {
+      if (clone == nullptr) {
+        state.SkipWithError("Failed to clone the VM");
+        return;
+      }
+    }
+  }
+}
+
+const bool registered = [] {
+  for (const auto &engine : getWasmEngines()) {
+    benchmark::RegisterBenchmark(("BM_WasmClone/" + engine).c_str(),
+                                 [engine](benchmark::State &state) {
+                                   BM_WasmClone(state, engine);
+                                 })
+        ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(("BM_WasmCloneOnWorkers/" + engine).c_str(),
+                                 [engine](benchmark::State &state) {
+                                   BM_WasmCloneOnWorkers(state, engine);
+                                 })
+        ->Unit(benchmark::kMillisecond)
+        ->UseManualTime();
+  }
+  return true;
+}();
+
+} // namespace
+} // namespace proxy_wasm
@@ -14,10 +14,21 @@
 
 #include "include/proxy-wasm/wasm.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "gtest/gtest.h"
 
+#include "include/proxy-wasm/bytecode_util.h"
+#include "include/proxy-wasm/compiled_module_cache.h"
+
 #include "test/utility.h"
 
 namespace proxy_wasm {
@@ -27,6 +38,40 @@ INSTANTIATE_TEST_SUITE_P(WasmEngines, TestVm, testing::ValuesIn(getWasmEngines()
                            return info.param;
                          });
 
+TEST(MakeVmKey, ReuseCodeHash) {
+  auto code = BytecodeUtil::makeBytecode("code");
+  const auto vm_key = makeVmKey("vm_id", "vm_config", code);
+  EXPECT_EQ(vm_key, makeVmKey("vm_id", "vm_config", code));
+  EXPECT_EQ(vm_key, makeVmKey("vm_id", "vm_config", "code"));
+  EXPECT_NE(vm_key, makeVmKey("vm_id", "vm_config", BytecodeUtil::makeBytecode("other_code")));
+  EXPECT_NE(vm_key, makeVmKey("other_vm_id", "vm_config", code));
+  EXPECT_NE(vm_key, makeVmKey("vm_id", "other_vm_config", code));
+}
+
+TEST(WasmBytecodeStream, AppendChunks) {
+  const auto source = readTestWasmFile("abi_export.wasm");
+  WasmBytecodeStream stream(source.size());
+  for (size_t pos = 0; pos < source.size(); pos += 7) {
+    ASSERT_TRUE(stream.append(std::string_view(source).substr(pos, 7)));
+  }
+  auto code = stream.finish();
+  ASSERT_NE(code, nullptr);
+  EXPECT_EQ(*code, source);
+  EXPECT_EQ(makeVmKey("vm_id", "vm_config", code), makeVmKey("vm_id", "vm_config", source));
+  EXPECT_EQ(stream.finish(), nullptr);
+
+  // Incomplete bytecode.
+  WasmBytecodeStream incomplete;
+  ASSERT_TRUE(incomplete.append(std::string_view(source).substr(0, source.size() - 1)));
+  EXPECT_EQ(incomplete.finish(), nullptr);
+
+  // Corrupted bytecode is rejected as soon as it's received.
+  WasmBytecodeStream corrupted;
+  EXPECT_FALSE(corrupted.append(std::string_view(source).substr(1, 16)));
+  EXPECT_FALSE(corrupted.append(std::string_view(source).substr(17)));
+  EXPECT_EQ(corrupted.finish(), nullptr);
+}
+
 // Fail callbacks only used for WasmVMs - not available for NullVM.
 TEST_P(TestVm, GetOrCreateThreadLocalWasmFailCallbacks) {
   const auto *const plugin_name = "plugin_name";
@@ -115,6 +160,519 @@ TEST_P(TestVm, GetOrCreateThreadLocalWasmFailCallbacks) {
   ASSERT_NE(thread_local_plugin3->wasm(), thread_local_plugin2->wasm());
 }
 
+TEST_P(TestVm, WarmUpThreadLocalPlugins) {
+  const auto *const vm_id = "vm_id";
+  const auto *const vm_config = "vm_config";
+  const auto plugin = std::make_shared<PluginBase>("plugin_name", "root_id", vm_id, engine_,
+                                                   "plugin_config", false, "plugin_key");
+
+  WasmHandleFactory wasm_handle_factory =
+      [this, vm_id, vm_config](std::string_view vm_key) -> std::shared_ptr<WasmHandleBase> {
+    auto base_wasm = std::make_shared<WasmBase>(makeVm(engine_), vm_id, vm_config, vm_key,
+                                                std::unordered_map<std::string, std::string>{},
+                                                AllowedCapabilitiesMap{});
+    return std::make_shared<WasmHandleBase>(base_wasm);
+  };
+  WasmHandleCloneFactory wasm_handle_clone_factory =
+      [this](const std::shared_ptr<WasmHandleBase> &base_wasm_handle)
+      -> std::shared_ptr<WasmHandleBase> {
+    auto wasm = std::make_shared<WasmBase>(
+        base_wasm_handle, [this]() -> std::unique_ptr<WasmVm> { return makeVm(engine_); });
+    return std::make_shared<WasmHandleBase>(wasm);
+  };
+  PluginHandleFactory plugin_handle_factory =
+      [](const std::shared_ptr<WasmHandleBase> &base_wasm,
+         const std::shared_ptr<PluginBase> &plugin) -> std::shared_ptr<PluginHandleBase> {
+    return std::make_shared<PluginHandleBase>(base_wasm, plugin);
+  };
+
+  auto source = readTestWasmFile("abi_export.wasm");
+  auto base_wasm_handle =
+      createWasm("vm_key", source, plugin, wasm_handle_factory, wasm_handle_clone_factory, false);
+  ASSERT_TRUE(base_wasm_handle && base_wasm_handle->wasm());
+
+  // Workers defer the warm-up until they are run.
+  std::vector<std::function<void()>> pending;
+  std::vector<CallOnThreadFunction> workers(3, [&pending](const std::function<void()> &f) {
+    pending.push_back(f);
+  });
+  std::vector<std::shared_ptr<PluginHandleBase>> plugin_handles(workers.size());
+  std::vector<bool> readiness;
+  auto done_count = 0;
+  warmUpThreadLocalPlugins(
+      base_wasm_handle, plugin, wasm_handle_clone_factory, plugin_handle_factory, workers,
+      [&plugin_handles](size_t worker, std::shared_ptr<PluginHandleBase> plugin_handle) {
+        plugin_handles[worker] = std::move(plugin_handle);
+      },
+      [&readiness, &done_count](const std::vector<bool> &ready) {
+        readiness = ready;
+        done_count++;
+      });
+  ASSERT_EQ(workers.size(), pending.size());
+
+  for (size_t i = 0; i < pending.size(); i++) {
+    EXPECT_EQ(0, done_count);
+    pending[i]();
+    ASSERT_TRUE(plugin_handles[i] && plugin_handles[i]->wasm());
+    EXPECT_NE(base_wasm_handle->wasm(), plugin_handles[i]->wasm());
+  }
+  EXPECT_EQ(1, done_count);
+  EXPECT_EQ(std::vector<bool>(workers.size(), true), readiness);
+
+  // The pre-warmed VM is used by the worker.
+  EXPECT_EQ(plugin_handles[0]->wasm(),
+            getOrCreateThreadLocalPlugin(base_wasm_handle, plugin, wasm_handle_clone_factory,
+                                         plugin_handle_factory)
+                ->wasm());
+}
+
+TEST_P(TestVm, ShareCompiledModule) {
+  auto source = readTestWasmFile("abi_export.wasm");
+
+  // Base VMs with different vm_ids and configurations, but the same bytecode.
+  std::vector<std::shared_ptr<WasmBase>> wasms;
+  for (const auto *vm_id : {"vm_id_1", "vm_id_2"}) {
+    auto wasm = std::make_shared<WasmBase>(
+        makeVm(engine_), vm_id, vm_id, makeVmKey(vm_id, vm_id, source),
+        std::unordered_map<std::string, std::string>{}, AllowedCapabilitiesMap{});
+    ASSERT_TRUE(wasm->load(source, false));
+    ASSERT_TRUE(wasm->initialize());
+    wasms.push_back(wasm);
+  }
+
+  // Engines which support it share a single compiled module.
+  EXPECT_EQ(wasms[0]->sharedModule(), wasms[1]->sharedModule());
+}
+
+// Keeps compiled modules in memory, and counts updates.
+class TestCompiledModuleCache : public CompiledModuleCache {
+public:
+  CompiledModulePtr get(std::string_view key) override {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = modules_.find(std::string(key));
+    if (it == modules_.end()) {
+      return nullptr;
+    }
+    // Keeps the data alive for as long as the view is.
+    auto data = it->second;
+    return CompiledModulePtr(new std::string_view(*data),
+                             [data](const std::string_view *view) { delete view; });
+  }
+  void put(std::string_view key, std::string_view compiled_module) override {
+    std::lock_guard<std::mutex> guard(mutex_);
+    modules_[std::string(key)] = std::make_shared<const std::string>(compiled_module);
+    puts_++;
+  }
+  size_t puts() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return puts_;
+  }
+
+private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::shared_ptr<const std::string>> modules_;
+  size_t puts_ = 0;
+};
+
+TEST_P(TestVm, UpdateCompiledModuleCache) {
+  auto source = readTestWasmFile("abi_export.wasm");
+  auto cache = std::make_shared<TestCompiledModuleCache>();
+  setCompiledModuleCache(cache);
+
+  const auto vm_key = makeVmKey("vm_id", "vm_config", source);
+  auto wasm = std::make_shared<WasmBase>(makeVm(engine_), "vm_id", "vm_config", vm_key,
+                                         std::unordered_map<std::string, std::string>{},
+                                         AllowedCapabilitiesMap{});
+  ASSERT_TRUE(wasm->load(source, false));
+  ASSERT_TRUE(wasm->initialize());
+
+  if (wasm->wasm_vm()->getCompiledModuleVersion().empty()) {
+    // The engine doesn't serialize compiled modules.
+    EXPECT_EQ(cache->puts(), 0U);
+    EXPECT_FALSE(wasm->updateCompiledModuleCache());
+  } else {
+    // Replaced on update (it's only stored on load if it was compiled by this base VM).
+    const auto puts = cache->puts();
+    EXPECT_TRUE(wasm->updateCompiledModuleCache());
+    EXPECT_EQ(cache->puts(), puts + 1);
+  }
+
+  setCompiledModuleCache(nullptr);
+}
+
+TEST_P(TestVm, ReuseCanaryWasm) {
+  const auto *const vm_id = "vm_id";
+  const auto *const vm_config = "vm_config";
+  const auto plugin = std::make_shared<PluginBase>("plugin_name", "root_id", vm_id, engine_,
+                                                   "plugin_config", false, "plugin_key");
+
+  WasmHandleFactory wasm_handle_factory =
+      [this, vm_id, vm_config](std::string_view vm_key) -> std::shared_ptr<WasmHandleBase> {
+    auto base_wasm = std::make_shared<WasmBase>(makeVm(engine_), vm_id, vm_config, vm_key,
+                                                std::unordered_map<std::string, std::string>{},
+                                                AllowedCapabilitiesMap{});
+    return std::make_shared<WasmHandleBase>(base_wasm);
+  };
+  auto clone_count = 0;
+  WasmHandleCloneFactory wasm_handle_clone_factory =
+      [this, &clone_count](const std::shared_ptr<WasmHandleBase> &base_wasm_handle)
+      -> std::shared_ptr<WasmHandleBase> {
+    auto wasm = std::make_shared<WasmBase>(
+        base_wasm_handle, [this]() -> std::unique_ptr<WasmVm> { return makeVm(engine_); });
+    clone_count++;
+    return std::make_shared<WasmHandleBase>(wasm);
+  };
+  PluginHandleFactory plugin_handle_factory =
+      [](const std::shared_ptr<WasmHandleBase> &base_wasm,
+         const std::shared_ptr<PluginBase> &plugin) -> std::shared_ptr<PluginHandleBase> {
+    return std::make_shared<PluginHandleBase>(base_wasm, plugin);
+  };
+
+  auto source = readTestWasmFile("abi_export.wasm");
+  auto base_wasm_handle =
+      createWasm("vm_key", source, plugin, wasm_handle_factory, wasm_handle_clone_factory, false);
+  ASSERT_TRUE(base_wasm_handle && base_wasm_handle->wasm());
+  EXPECT_EQ(1, clone_count);
+
+  // The canary VM is used as the thread-local VM.
+  auto thread_local_plugin = getOrCreateThreadLocalPlugin(
+      base_wasm_handle, plugin, wasm_handle_clone_factory, plugin_handle_factory);
+  ASSERT_TRUE(thread_local_plugin && thread_local_plugin->wasm());
+  EXPECT_NE(base_wasm_handle->wasm(), thread_local_plugin->wasm());
+  EXPECT_EQ(1, clone_count);
+
+  // The canary verdict is cached for the same base VM and plugin.
+  EXPECT_EQ(base_wasm_handle, createWasm("vm_key", source, plugin, wasm_handle_factory,
+                                         wasm_handle_clone_factory, false));
+  EXPECT_EQ(1, clone_count);
+
+  // Without a canary VM, the thread-local VM is cloned.
+  thread_local_plugin.reset();
+  thread_local_plugin = getOrCreateThreadLocalPlugin(base_wasm_handle, plugin,
+                                                     wasm_handle_clone_factory,
+                                                     plugin_handle_factory);
+  ASSERT_TRUE(thread_local_plugin && thread_local_plugin->wasm());
+  EXPECT_EQ(2, clone_count);
+
+  // Verdicts aren't kept once the base VM is destroyed, so the canary runs again.
+  thread_local_plugin.reset();
+  base_wasm_handle.reset();
+  base_wasm_handle =
+      createWasm("vm_key", source, plugin, wasm_handle_factory, wasm_handle_clone_factory, false);
+  ASSERT_TRUE(base_wasm_handle && base_wasm_handle->wasm());
+  EXPECT_EQ(3, clone_count);
+
+  // The canary VM is dropped by a createWasm() call for another VM, so it's cloned again.
+  auto other_wasm_handle = createWasm("other_vm_key", source, plugin, wasm_handle_factory,
+                                      wasm_handle_clone_factory, false);
+  ASSERT_TRUE(other_wasm_handle && other_wasm_handle->wasm());
+  EXPECT_EQ(4, clone_count);
+  thread_local_plugin = getOrCreateThreadLocalPlugin(base_wasm_handle, plugin,
+                                                     wasm_handle_clone_factory,
+                                                     plugin_handle_factory);
+  ASSERT_TRUE(thread_local_plugin && thread_local_plugin->wasm());
+  EXPECT_EQ(5, clone_count);
+}
+
+class TimerWasm : public WasmBase {
+public:
+  using WasmBase::WasmBase;
+
+  void setTimerPeriod(uint32_t root_context_id, std::chrono::milliseconds period) override {
+    armed_periods[root_context_id] = period;
+    WasmBase::setTimerPeriod(root_context_id, period);
+  }
+
+  std::unordered_map<uint32_t, std::chrono::milliseconds> armed_periods;
+};
+
+TEST_P(TestVm, PauseTimers) {
+  const auto plugin = std::make_shared<PluginBase>("plugin_name", "root_id", "vm_id", engine_,
+                                                   "plugin_config", false, "plugin_key");
+  TimerWasm wasm(makeVm(engine_), "vm_id", "vm_config", "vm_key",
+                 std::unordered_map<std::string, std::string>{}, AllowedCapabilitiesMap{});
+  ContextBase root_context(&wasm, plugin);
+  uint32_t token = 0;
+
+  root_context.setTimerPeriod(std::chrono::milliseconds(10), &token);
+  EXPECT_EQ(std::chrono::milliseconds(10), wasm.armed_periods[root_context.id()]);
+
+  wasm.pauseTimers();
+  EXPECT_EQ(std::chrono::milliseconds(0), wasm.armed_periods[root_context.id()]);
+
+  // Periods set while the timers are paused take effect once they're resumed.
+  root_context.setTimerPeriod(std::chrono::milliseconds(20), &token);
+  EXPECT_EQ(std::chrono::milliseconds(0), wasm.armed_periods[root_context.id()]);
+  wasm.resumeTimers();
+  EXPECT_EQ(std::chrono::milliseconds(20), wasm.armed_periods[root_context.id()]);
+}
+
+TEST_P(TestVm, SharedDataSubscription) {
+  const auto *const vm_id = "shared_data_subscription";
+  const auto plugin = std::make_shared<PluginBase>("plugin_name", "root_id", vm_id, engine_,
+                                                   "plugin_config", false, "plugin_key");
+
+  WasmHandleFactory wasm_handle_factory =
+      [this, vm_id](std::string_view vm_key) -> std::shared_ptr<WasmHandleBase> {
+    auto base_wasm = std::make_shared<TestWasm>(makeVm(engine_),
+                                                std::unordered_map<std::string, std::string>{},
+                                                vm_id, "vm_config", vm_key);
+    return std::make_shared<WasmHandleBase>(base_wasm);
+  };
+  WasmHandleCloneFactory wasm_handle_clone_factory =
+      [this](const std::shared_ptr<WasmHandleBase> &base_wasm_handle)
+      -> std::shared_ptr<WasmHandleBase> {
+    auto wasm = std::make_shared<TestWasm>(
+        base_wasm_handle, [this]() -> std::unique_ptr<WasmVm> { return makeVm(engine_); });
+    return std::make_shared<WasmHandleBase>(wasm);
+  };
+  PluginHandleFactory plugin_handle_factory =
+      [](const std::shared_ptr<WasmHandleBase> &base_wasm,
+         const std::shared_ptr<PluginBase> &plugin) -> std::shared_ptr<PluginHandleBase> {
+    return std::make_shared<PluginHandleBase>(base_wasm, plugin);
+  };
+
+  auto source = readTestWasmFile("abi_export.wasm");
+  auto base_wasm_handle =
+      createWasm("vm_key", source, plugin, wasm_handle_factory, wasm_handle_clone_factory, false);
+  ASSERT_TRUE(base_wasm_handle && base_wasm_handle->wasm());
+  auto thread_local_plugin = getOrCreateThreadLocalPlugin(
+      base_wasm_handle, plugin, wasm_handle_clone_factory, plugin_handle_factory);
+  ASSERT_TRUE(thread_local_plugin && thread_local_plugin->wasm());
+  auto *root_context =
+      dynamic_cast<TestContext *>(thread_local_plugin->wasm()->getRootContext(plugin, false));
+  ASSERT_TRUE(root_context != nullptr);
+
+  SharedDataSubscriptionToken token = 0;
+  ASSERT_EQ(WasmResult::Ok, root_context->subscribeSharedData("key", false, &token));
+  EXPECT_EQ(WasmResult::Ok, root_context->setSharedData("other_key", "", 0));
+  EXPECT_TRUE(root_context->sharedDataChanges().empty());
+
+  // The notification is delivered to the root context of the thread-local VM.
+  EXPECT_EQ(WasmResult::Ok, root_context->setSharedData("key", "", 0));
+  EXPECT_EQ(std::vector<SharedDataSubscriptionToken>{token}, root_context->sharedDataChanges());
+  std::pair<std::string, uint32_t> result;
+  EXPECT_EQ(WasmResult::Ok, root_context->removeSharedDataKey("key", 0, &result));
+  EXPECT_EQ(std::vector<SharedDataSubscriptionToken>({token, token}),
+            root_context->sharedDataChanges());
+
+  EXPECT_EQ(WasmResult::Ok, root_context->unsubscribeSharedData(token));
+  EXPECT_EQ(WasmResult::NotFound, root_context->unsubscribeSharedData(token));
+  EXPECT_EQ(WasmResult::Ok, root_context->setSharedData("key", "", 0));
+  EXPECT_EQ(2, root_context->sharedDataChanges().size());
+
+  // Notifications for the subscriptions of another VM aren't delivered to the thread-local VM, even
+  // if the context IDs match.
+  auto *base_root_context = dynamic_cast<TestContext *>(base_wasm_handle->wasm()->start(plugin));
+  ASSERT_TRUE(base_root_context != nullptr);
+  ASSERT_EQ(WasmResult::Ok, base_root_context->subscribeSharedData("key", false, &token));
+  EXPECT_EQ(WasmResult::Ok, root_context->setSharedData("key", "", 0));
+  EXPECT_EQ(2, root_context->sharedDataChanges().size());
+  EXPECT_TRUE(base_root_context->sharedDataChanges().empty());
+}
+
+TEST_P(TestVm, CreateWasmAsync) {
+  const auto *const vm_id = "vm_id";
+  const auto *const vm_config = "vm_config";
+  const auto plugin = std::make_shared<PluginBase>("plugin_name", "root_id", vm_id, engine_,
+                                                   "plugin_config", false, "plugin_key");
+
+  std::atomic<int> factory_count = 0;
+  WasmHandleFactory wasm_handle_factory =
+      [this, vm_id, vm_config,
+       &factory_count](std::string_view vm_key) -> std::shared_ptr<WasmHandleBase> {
+    factory_count++;
+    auto base_wasm = std::make_shared<WasmBase>(makeVm(engine_), vm_id, vm_config, vm_key,
+                                                std::unordered_map<std::string, std::string>{},
+                                                AllowedCapabilitiesMap{});
+    return std::make_shared<WasmHandleBase>(base_wasm);
+  };
+  std::mutex clones_mutex;
+  std::vector<std::weak_ptr<WasmBase>> clones;
+  WasmHandleCloneFactory wasm_handle_clone_factory =
+      [this, &clones_mutex, &clones](const std::shared_ptr<WasmHandleBase> &base_wasm_handle)
+      -> std::shared_ptr<WasmHandleBase> {
+    auto wasm = std::make_shared<WasmBase>(
+        base_wasm_handle, [this]() -> std::unique_ptr<WasmVm> { return makeVm(engine_); });
+    std::lock_guard<std::mutex> guard(clones_mutex);
+    clones.push_back(wasm);
+    return std::make_shared<WasmHandleBase>(wasm);
+  };
+
+  // Two requests for the same key and one for another key, which shares the code.
+  auto source = readTestWasmFile("abi_export.wasm");
+  const std::vector<std::string> vm_keys = {"vm_key_1", "vm_key_1", "vm_key_2"};
+  std::vector<std::promise<std::shared_ptr<WasmHandleBase>>> promises(vm_keys.size());
+  for (size_t i = 0; i < vm_keys.size(); i++) {
+    auto callback = [&promises, i](std::shared_ptr<WasmHandleBase> wasm_handle) {
+      promises[i].set_value(std::move(wasm_handle));
+    };
+    if (i + 1 < vm_keys.size()) {
+      createWasmAsync(vm_keys[i], source, plugin, wasm_handle_factory, wasm_handle_clone_factory,
+                      false, callback);
+    } else {
+      createWasmAsync(vm_keys[i], BytecodeUtil::makeBytecode(source), plugin, wasm_handle_factory,
+                      wasm_handle_clone_factory, false, callback);
+    }
+  }
+  std::vector<std::shared_ptr<WasmHandleBase>> wasm_handles;
+  for (auto &promise : promises) {
+    wasm_handles.push_back(promise.get_future().get());
+    ASSERT_TRUE(wasm_handles.back() && wasm_handles.back()->wasm());
+  }
+
+  // The base VM is created once per key.
+  EXPECT_EQ(wasm_handles[0], wasm_handles[1]);
+  EXPECT_NE(wasm_handles[0], wasm_handles[2]);
+  EXPECT_EQ(2, factory_count);
+
+  // Canary VMs aren't kept on the pool threads, which never use them as thread-local VMs.
+  std::lock_guard<std::mutex> guard(clones_mutex);
+  EXPECT_EQ(2, clones.size());
+  for (const auto &clone : clones) {
+    EXPECT_TRUE(clone.expired());
+  }
+}
+
+TEST_P(TestVm, SwapThreadLocalPlugins) {
+  const auto *const vm_id = "vm_id";
+  const auto *const vm_config = "vm_config";
+
+  WasmHandleFactory wasm_handle_factory =
+      [this, vm_id, vm_config](std::string_view vm_key) -> std::shared_ptr<WasmHandleBase> {
+    auto base_wasm = std::make_shared<WasmBase>(makeVm(engine_), vm_id, vm_config, vm_key,
+                                                std::unordered_map<std::string, std::string>{},
+                                                AllowedCapabilitiesMap{});
+    return std::make_shared<WasmHandleBase>(base_wasm);
+  };
+  WasmHandleCloneFactory wasm_handle_clone_factory =
+      [this](const std::shared_ptr<WasmHandleBase> &base_wasm_handle)
+      -> std::shared_ptr<WasmHandleBase> {
+    auto wasm = std::make_shared<WasmBase>(
+        base_wasm_handle, [this]() -> std::unique_ptr<WasmVm> { return makeVm(engine_); });
+    return std::make_shared<WasmHandleBase>(wasm);
+  };
+  PluginHandleFactory plugin_handle_factory =
+      [](const std::shared_ptr<WasmHandleBase> &base_wasm,
+         const std::shared_ptr<PluginBase> &plugin) -> std::shared_ptr<PluginHandleBase> {
+    return std::make_shared<PluginHandleBase>(base_wasm, plugin);
+  };
+
+  // Workers queue their tasks, which are run on this thread.
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> pending;
+  std::vector<PluginSwapProgress> progress;
+  std::vector<CallOnThreadFunction> workers(3, [&](const std::function<void()> &f) {
+    std::lock_guard<std::mutex> guard(mutex);
+    pending.push_back(f);
+    cv.notify_one();
+  });
+  auto swap = [&](const std::string &vm_key, const std::string &code,
+                  const std::string &plugin_key) {
+    progress.clear();
+    auto plugin = std::make_shared<PluginBase>("plugin_name", "root_id", vm_id, engine_,
+                                               "plugin_config", false, plugin_key);
+    swapThreadLocalPlugins("swap_key", vm_key, BytecodeUtil::makeBytecode(code), plugin,
+                           wasm_handle_factory, wasm_handle_clone_factory, plugin_handle_factory,
+                           false, workers, [&](const PluginSwapProgress &p) {
+                             std::lock_guard<std::mutex> guard(mutex);
+                             progress.push_back(p);
+                             cv.notify_one();
+                           });
+    auto finished = [&] {
+      return !progress.empty() && (progress.back().stage == PluginSwapStage::Done ||
+                                   progress.back().stage == PluginSwapStage::Failed);
+    };
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!finished() || !pending.empty()) {
+      cv.wait(lock, [&] { return finished() || !pending.empty(); });
+      if (!pending.empty()) {
+        auto task = std::move(pending.front());
+        pending.pop_front();
+        auto swapping = progress.back().stage == PluginSwapStage::Swapping;
+        lock.unlock();
+        // Streams keep using the old plugin until the swap.
+        if (!swapping) {
+          EXPECT_EQ(plugin_key == "plugin_key_1", !getThreadLocalActivePlugin("swap_key"));
+        }
+        task();
+        lock.lock();
+      }
+    }
+    return progress.back().stage;
+  };
+
+  auto source = readTestWasmFile("abi_export.wasm");
+  EXPECT_EQ(nullptr, getThreadLocalActivePlugin("swap_key"));
+  ASSERT_EQ(PluginSwapStage::Done, swap("vm_key_1", source, "plugin_key_1"));
+  ASSERT_EQ(9U, progress.size());
+  EXPECT_EQ(PluginSwapStage::CreatingBaseWasm, progress[0].stage);
+  EXPECT_EQ(PluginSwapStage::WarmingUp, progress[1].stage);
+  EXPECT_EQ(3U, progress[4].workers_warmed_up);
+  EXPECT_EQ(PluginSwapStage::Swapping, progress[5].stage);
+  EXPECT_EQ(3U, progress[8].workers_swapped);
+  auto plugin_handle = getThreadLocalActivePlugin("swap_key");
+  ASSERT_TRUE(plugin_handle && plugin_handle->wasm());
+  EXPECT_EQ("plugin_key_1", plugin_handle->plugin()->key());
+  std::weak_ptr<PluginHandleBase> old_plugin_handle = plugin_handle;
+  plugin_handle.reset();
+
+  // A failed swap keeps the old plugin.
+  EXPECT_EQ(PluginSwapStage::Failed, swap("vm_key_2", "bad code", "plugin_key_2"));
+  EXPECT_FALSE(old_plugin_handle.expired());
+
+  // The old plugin is released once the new one is active.
+  ASSERT_EQ(PluginSwapStage::Done, swap("vm_key_1", source, "plugin_key_2"));
+  plugin_handle = getThreadLocalActivePlugin("swap_key");
+  ASSERT_TRUE(plugin_handle && plugin_handle->wasm());
+  EXPECT_EQ("plugin_key_2", plugin_handle->plugin()->key());
+  EXPECT_TRUE(old_plugin_handle.expired());
+
+  removeThreadLocalActivePlugin("swap_key");
+  EXPECT_EQ(nullptr, getThreadLocalActivePlugin("swap_key"));
+}
+
+TEST_P(TestVm, MemorySnapshot) {
+  const auto *const vm_id = "vm_id";
+  const auto *const vm_config = "vm_config";
+  const auto plugin = std::make_shared<PluginBase>("plugin_name", "root_id", vm_id, engine_,
+                                                   "plugin_config", false, "plugin_key");
+
+  WasmHandleFactory wasm_handle_factory =
+      [this, vm_id, vm_config](std::string_view vm_key) -> std::shared_ptr<WasmHandleBase> {
+    auto base_wasm = std::make_shared<WasmBase>(makeVm(engine_), vm_id, vm_config, vm_key,
+                                                std::unordered_map<std::string, std::string>{},
+                                                AllowedCapabilitiesMap{});
+    base_wasm->enableMemorySnapshot();
+    return std::make_shared<WasmHandleBase>(base_wasm);
+  };
+  WasmHandleCloneFactory wasm_handle_clone_factory =
+      [this](const std::shared_ptr<WasmHandleBase> &base_wasm_handle)
+      -> std::shared_ptr<WasmHandleBase> {
+    auto wasm = std::make_shared<WasmBase>(
+        base_wasm_handle, [this]() -> std::unique_ptr<WasmVm> { return makeVm(engine_); });
+    return std::make_shared<WasmHandleBase>(wasm);
+  };
+
+  auto source = readTestWasmFile("abi_export.wasm");
+  auto base_wasm_handle =
+      createWasm("vm_key", source, plugin, wasm_handle_factory, wasm_handle_clone_factory, false);
+  ASSERT_TRUE(base_wasm_handle && base_wasm_handle->wasm());
+  const auto &snapshot = base_wasm_handle->wasm()->memorySnapshot();
+  ASSERT_FALSE(snapshot.empty());
+
+  // Cloned VMs start with the base VM's memory.
+  auto wasm_handle = wasm_handle_clone_factory(base_wasm_handle);
+  ASSERT_TRUE(wasm_handle && wasm_handle->wasm());
+  ASSERT_TRUE(wasm_handle->wasm()->initialize());
+  auto *vm = wasm_handle->wasm()->wasm_vm();
+  ASSERT_EQ(snapshot.size(), vm->getMemorySize());
+  auto memory = vm->getMemory(0, snapshot.size());
+  ASSERT_TRUE(memory.has_value());
+  EXPECT_EQ(snapshot, memory.value());
+}
+
 // Tests the canary is always applied when making a call `createWasm`
 TEST_P(TestVm, AlwaysApplyCanary) {
   // Use different root_id, but the others are the same
@@ -31,9 +31,7 @@ INSTANTIATE_TEST_SUITE_P(WasmEngines, TestVm, testing::ValuesIn(getWasmEngines()
                          });
 
 TEST_P(TestVm, Basic) {
-  if (engine_ == "wasmedge") {
-    EXPECT_EQ(vm_->cloneable(), proxy_wasm::Cloneable::NotCloneable);
-  } else if (engine_ == "wasmtime" || engine_ == "v8" || engine_ == "wamr") {
+  if (engine_ == "wasmtime" || engine_ == "v8" || engine_ == "wamr" || engine_ == "wasmedge") {
     EXPECT_EQ(vm_->cloneable(), proxy_wasm::Cloneable::CompiledBytecode);
   } else if (engine_ == "wavm") {
     EXPECT_EQ(vm_->cloneable(), proxy_wasm::Cloneable::InstantiatedModule);
@@ -62,6 +60,16 @@ TEST_P(TestVm, Memory) {
   ASSERT_EQ(200, static_cast<int32_t>(word.u64_));
 }
 
+TEST_P(TestVm, InvalidPrecompiledModule) {
+  if (engine_ != "wamr" && engine_ != "wasmedge") {
+    return;
+  }
+  // WAMR and WasmEdge fall back to the bytecode when the AOT module can't be loaded.
+  auto source = readTestWasmFile("abi_export.wasm");
+  ASSERT_TRUE(vm_->load(source, "not an AOT module", {}));
+  ASSERT_TRUE(vm_->link(""));
+}
+
 TEST_P(TestVm, Clone) {
   if (vm_->cloneable() == proxy_wasm::Cloneable::NotCloneable) {
     return;